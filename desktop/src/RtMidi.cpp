@@ -171,6 +171,11 @@ void RtMidiIn :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense )
   if ( midiSense ) inputData_.ignoreFlags |= 0x04;
 }
 
+void RtMidiIn :: setFilter( const MidiFilter& filter )
+{
+  inputData_.filter = filter;
+}
+
 double RtMidiIn :: getMessage( std::vector<unsigned char> *message )
 {
   message->clear();
@@ -402,6 +407,12 @@ void midiInputCallback( const MIDIPacketList *list, void *procRef, void *srcRef
         }
         else size = 1;
 
+        // Skip the messages rejected by the filter.
+        if ( size && !data->filter.accepts( &packet->data[iByte], size ) ) {
+          iByte += size;
+          continue;
+        }
+
         // Copy the MIDI data to our vector.
         if ( size ) {
           message.bytes.assign( &packet->data[iByte], &packet->data[iByte+size] );
@@ -964,6 +975,7 @@ void RtMidiOutCoreMidi :: sendMessage( std::vector<unsigned char> *message )
 // associated with the ALSA sequencer queues.
 
 #include <pthread.h>
+#include <poll.h>
 #include <sys/time.h>
 
 // ALSA header file.
@@ -990,6 +1002,60 @@ struct AlsaMidiData {
 //  Class Definitions: RtMidiIn
 //*********************************************************************//
 
+// The channel, status and note of a sequencer event are available
+// before decoding, so rejected events don't reach the MIDI coder.
+static bool alsaEventAccepted( const RtMidiIn::MidiFilter& filter, const snd_seq_event_t *ev )
+{
+  unsigned char status;
+  switch ( ev->type ) {
+  case SND_SEQ_EVENT_NOTEOFF:
+    status = 0x80;
+    break;
+  case SND_SEQ_EVENT_NOTEON:
+  case SND_SEQ_EVENT_NOTE:
+    status = 0x90;
+    break;
+  case SND_SEQ_EVENT_KEYPRESS:
+    status = 0xA0;
+    break;
+  case SND_SEQ_EVENT_CONTROLLER:
+  case SND_SEQ_EVENT_CONTROL14:
+  case SND_SEQ_EVENT_NONREGPARAM:
+  case SND_SEQ_EVENT_REGPARAM:
+    status = 0xB0;
+    break;
+  case SND_SEQ_EVENT_PGMCHANGE:
+    status = 0xC0;
+    break;
+  case SND_SEQ_EVENT_CHANPRESS:
+    status = 0xD0;
+    break;
+  case SND_SEQ_EVENT_PITCHBEND:
+    status = 0xE0;
+    break;
+  case SND_SEQ_EVENT_SONGPOS:
+  case SND_SEQ_EVENT_SONGSEL:
+  case SND_SEQ_EVENT_QFRAME:
+  case SND_SEQ_EVENT_TUNE_REQUEST:
+  case SND_SEQ_EVENT_CLOCK:
+  case SND_SEQ_EVENT_TICK:
+  case SND_SEQ_EVENT_START:
+  case SND_SEQ_EVENT_CONTINUE:
+  case SND_SEQ_EVENT_STOP:
+  case SND_SEQ_EVENT_SENSING:
+  case SND_SEQ_EVENT_RESET:
+    return ( filter.statusMask & 0x80 ) != 0;
+  default:
+    return true;
+  }
+  if ( status < 0xB0 ) {
+    unsigned char bytes[2] = { (unsigned char) ( status | ( ev->data.note.channel & 0x0F ) ),
+                               ev->data.note.note };
+    return filter.accepts( bytes, 2 );
+  }
+  return filter.acceptsStatus( status | ( ev->data.control.channel & 0x0F ) );
+}
+
 extern "C" void *alsaMidiHandler( void *ptr )
 {
   RtMidiIn::RtMidiInData *data = static_cast<RtMidiIn::RtMidiInData *> (ptr);
@@ -1019,11 +1085,15 @@ extern "C" void *alsaMidiHandler( void *ptr )
   snd_midi_event_init( apiData->coder );
   snd_midi_event_no_status( apiData->coder, 1 ); // suppress running status messages
 
+  struct pollfd pfds[4];
+  int npfds = snd_seq_poll_descriptors( apiData->seq, pfds, 4, POLLIN );
+
   while ( data->doInput ) {
 
     if ( snd_seq_event_input_pending( apiData->seq, 1 ) == 0 ) {
-      // No data pending ... sleep a bit.
-      usleep( 1000 );
+      // No data pending ... wait for the sequencer, waking up now
+      // and then to notice when the input is closed.
+      poll( pfds, npfds, 100 );
       continue;
     }
 
@@ -1038,6 +1108,11 @@ extern "C" void *alsaMidiHandler( void *ptr )
       continue;
     }
 
+    if ( !continueSysex && !alsaEventAccepted( data->filter, ev ) ) {
+      snd_seq_free_event( ev );
+      continue;
+    }
+
     // This is a bit weird, but we now have to decode an ALSA MIDI
     // event (back) into MIDI bytes.  We'll ignore non-MIDI types.
     if ( !continueSysex ) message.bytes.clear();
@@ -1298,6 +1373,8 @@ void RtMidiInAlsa :: openPort( unsigned int portNumber, const std::string portNa
     snd_seq_start_queue( data->seq, data->queue_id, NULL );
     snd_seq_drain_output( data->seq );
 #endif
+    updateEventFilter();
+
     // Start our MIDI input thread.
     pthread_attr_t attr;
     pthread_attr_init(&attr);
@@ -1352,6 +1429,8 @@ void RtMidiInAlsa :: openVirtualPort( std::string portName )
     snd_seq_start_queue( data->seq, data->queue_id, NULL );
     snd_seq_drain_output( data->seq );
 #endif
+    updateEventFilter();
+
     // Start our MIDI input thread.
     pthread_attr_t attr;
     pthread_attr_init(&attr);
@@ -1371,6 +1450,65 @@ void RtMidiInAlsa :: openVirtualPort( std::string portName )
   }
 }
 
+void RtMidiInAlsa :: setFilter( const MidiFilter& filter )
+{
+  RtMidiIn :: setFilter( filter );
+  updateEventFilter();
+}
+
+// The client event filter is a set of event types, checked by the
+// kernel before an event is queued for this client. Channels and note
+// ranges can't be expressed there, so alsaMidiHandler checks those.
+void RtMidiInAlsa :: updateEventFilter()
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  const MidiFilter& filter = inputData_.filter;
+  unsigned char flags = inputData_.ignoreFlags;
+  snd_seq_client_info_t *info;
+  snd_seq_client_info_alloca( &info );
+  if ( snd_seq_get_client_info( data->seq, info ) < 0 ) return;
+
+  snd_seq_client_info_event_filter_clear( info );
+  if ( !filter.passesAll() || flags != 0 ) {
+    static const int channelTypes[7][4] = {
+      { SND_SEQ_EVENT_NOTEOFF, -1 },
+      { SND_SEQ_EVENT_NOTEON, SND_SEQ_EVENT_NOTE, -1 },
+      { SND_SEQ_EVENT_KEYPRESS, -1 },
+      { SND_SEQ_EVENT_CONTROLLER, SND_SEQ_EVENT_CONTROL14,
+        SND_SEQ_EVENT_NONREGPARAM, SND_SEQ_EVENT_REGPARAM },
+      { SND_SEQ_EVENT_PGMCHANGE, -1 },
+      { SND_SEQ_EVENT_CHANPRESS, -1 },
+      { SND_SEQ_EVENT_PITCHBEND, -1 }
+    };
+    for ( int i = 0; i < 7; i++ ) {
+      if ( !( filter.statusMask & ( 1 << i ) ) || filter.channelMask == 0 ) continue;
+      for ( int j = 0; j < 4 && channelTypes[i][j] >= 0; j++ )
+        snd_seq_client_info_event_filter_add( info, channelTypes[i][j] );
+    }
+    if ( filter.statusMask & 0x80 ) {
+      snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_SONGPOS );
+      snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_SONGSEL );
+      snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_TUNE_REQUEST );
+      snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_START );
+      snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_CONTINUE );
+      snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_STOP );
+      snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_RESET );
+      if ( !( flags & 0x02 ) ) {
+        snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_QFRAME );
+        snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_CLOCK );
+        snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_TICK );
+      }
+      if ( !( flags & 0x04 ) )
+        snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_SENSING );
+    }
+    if ( !( flags & 0x01 ) )
+      snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_SYSEX );
+    snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_PORT_SUBSCRIBED );
+    snd_seq_client_info_event_filter_add( info, SND_SEQ_EVENT_PORT_UNSUBSCRIBED );
+  }
+  snd_seq_set_client_info( data->seq, info );
+}
+
 void RtMidiInAlsa :: closePort( void )
 {
   if ( connected_ ) {
@@ -1801,6 +1939,9 @@ extern "C" void *irixMidiHandler( void *ptr )
     }
     else size = 1;
 
+    // Drop the messages rejected by the filter.
+    if ( size && !data->filter.accepts( (const unsigned char *) &event.msg[0], size ) ) size = 0;
+
     // Copy the MIDI data to our vector.
     if ( size ) {
       message.bytes.assign( &event.msg[0], &event.msg[size] );
@@ -2174,8 +2315,11 @@ static void CALLBACK midiInputCallback( HMIDIIN hmin,
       return;
     }
 
-    // Copy bytes to our MIDI message.
+    // Drop the messages rejected by the filter.
     unsigned char *ptr = (unsigned char *) &midiMessage;
+    if ( !data->filter.accepts( ptr, nBytes ) ) return;
+
+    // Copy bytes to our MIDI message.
     for ( int i=0; i<nBytes; ++i ) apiData->message.bytes.push_back( *ptr++ );
   }
   else { // Sysex message ( MIM_LONGDATA or MIM_LONGERROR )
@@ -2641,6 +2785,8 @@ int jackProcessIn( jack_nframes_t nframes, void *arg )
     message.bytes.clear();
 
     jack_midi_event_get( &event, buff, 0 );
+    if ( !rtData->continueSysex && !rtData->filter.accepts( event.buffer, event.size ) )
+      return 0;
 
     for (unsigned int i = 0; i < event.size; i++ )
       message.bytes.push_back( event.buffer[i] );
@@ -161,6 +161,54 @@ class RtMidiIn : public RtMidi
   */
   void ignoreTypes( bool midiSysex = true, bool midiTime = true, bool midiSense = true );
 
+  //! A declarative filter for incoming messages.
+  /*!
+      A channel message passes when the bits of its status and of its
+      channel are set, and a note message (note off, note on and
+      polyphonic aftertouch) also needs its note number within the
+      range. System common and real time messages pass when the system
+      bit is set; System Exclusive is governed by ignoreTypes() alone.
+  */
+  struct MidiFilter {
+    unsigned char statusMask;   // bit n: status 0x80 + n * 0x10 (n < 7); bit 7: system
+    unsigned short channelMask; // bit n: MIDI channel n
+    unsigned char lowNote;
+    unsigned char highNote;
+
+    MidiFilter()
+      : statusMask(0xFF), channelMask(0xFFFF), lowNote(0), highNote(127) {}
+
+    bool passesAll() const
+    { return statusMask == 0xFF && channelMask == 0xFFFF && lowNote == 0 && highNote == 127; }
+
+    bool acceptsStatus( unsigned char status ) const
+    {
+      if ( status < 0x80 ) return true; // SysEx continuation
+      if ( status >= 0xF0 ) return status == 0xF0 || ( statusMask & 0x80 );
+      return ( statusMask & ( 1 << ( ( status >> 4 ) - 8 ) ) ) &&
+             ( channelMask & ( 1 << ( status & 0x0F ) ) );
+    }
+
+    bool accepts( const unsigned char *bytes, size_t size ) const
+    {
+      if ( size == 0 || !acceptsStatus( bytes[0] ) ) return false;
+      if ( bytes[0] < 0xB0 && size > 1 ) return bytes[1] >= lowNote && bytes[1] <= highNote;
+      return true;
+    }
+  };
+
+  //! Set the filter for incoming messages.
+  /*!
+      Backends apply the filter before a message is decoded or queued.
+      The ALSA backend also pushes the accepted event types down into
+      the sequencer client event filter, so the input thread is not
+      woken up by the rejected traffic at all.
+  */
+  virtual void setFilter( const MidiFilter& filter );
+
+  //! Return the filter for incoming messages.
+  const MidiFilter& getFilter() const { return inputData_.filter; }
+
   //! Fill the user-provided vector with the data bytes for the next available MIDI message in the input queue and return the event delta-time in seconds.
   /*!
       This function returns immediately whether a new message is
@@ -207,6 +255,7 @@ class RtMidiIn : public RtMidi
     void *userCallback;
     void *userData;
     bool continueSysex;
+    MidiFilter filter;
 
     // Default constructor.
     RtMidiInData()
@@ -440,9 +489,13 @@ class RtMidiInAlsa : public RtMidiIn
   */
   std::string getPortName( unsigned int portNumber = 0 );
 
+  //! Set the filter for incoming messages, updating the client event filter.
+  void setFilter( const MidiFilter& filter );
+
  private:
 
   void initialize( const std::string& clientName );
+  void updateEventFilter();
 
 };
 
@@ -68,6 +68,7 @@ ColorDialog::onAnyColorWidgetClicked(int i)
         if (color.isValid()) {
             wdg->setFillColor(color);
             currentPalette()->setColor(i, color);
+            currentPalette()->updateBrushes();
         }
     }
 }
@@ -116,6 +117,7 @@ ColorDialog::loadPalette(int i)
         PianoPalette *p = m_paletteList[i];
         m_currentPalette = p;
         m_currentPalette->loadColors();
+        m_currentPalette->updateBrushes();
         m_ui->paletteNames->setCurrentIndex(i);
         refreshPalette();
     }
@@ -54,10 +54,18 @@ const QString QSTR_TRANSPOSE("Transpose");
 const QString QSTR_NUMOCTAVES("NumOctaves");
 const QString QSTR_INSTRUMENTSDEFINITION("InstrumentsDefinition");
 const QString QSTR_INSTRUMENTNAME("InstrumentName");
+const QString QSTR_SOUNDFONTDIRS("SoundFontDirs");
 const QString QSTR_CONNECTIONS("Connections");
 const QString QSTR_INENABLED("InEnabled");
 const QString QSTR_THRUENABLED("ThruEnabled");
 const QString QSTR_OMNIENABLED("OmniEnabled");
+const QString QSTR_THRUSTATUSMASK("ThruStatusMask");
+const QString QSTR_THRUCHANNELMASK("ThruChannelMask");
+const QString QSTR_THRULOWNOTE("ThruLowNote");
+const QString QSTR_THRUHIGHNOTE("ThruHighNote");
+const QString QSTR_MERGEINPUTS("MergeInputs");
+const QString QSTR_MERGEPORT("Port");
+const QString QSTR_MERGECHANNEL("Channel");
 const QString QSTR_INPORT("InPort");
 const QString QSTR_OUTPORT("OutPort");
 const QString QSTR_KEYBOARD("Keyboard");
@@ -74,6 +82,8 @@ const QString QSTR_STYLEDKNOBS("StyledKnobs");
 const QString QSTR_ALWAYSONTOP("AlwaysOnTop");
 const QString QSTR_SHOWNOTENAMES("ShowNoteNames");
 const QString QSTR_SHOWSTATUSBAR("ShowStatusBar");
+const QString QSTR_SHOWPIANOROLL("ShowPianoRoll");
+const QString QSTR_CLOCKTEMPO("ClockTempo");
 const QString QSTR_RAWKEYBOARDMODE("RawKeyboardMode");
 const QString QSTR_EXTRACONTROLLERS("ExtraControllers");
 const QString QSTR_EXTRACTLPREFIX("ExtraCtl_");
@@ -87,10 +97,12 @@ const QString QSTR_LANGUAGE("Language");
 const QString QSTR_VELOCITYCOLOR("VelocityColor");
 const QString QSTR_NETWORKPORT("NetworkPort");
 const QString QSTR_NETWORKIFACE("NetworkInterface");
+const QString QSTR_NETWORKPEERS("NetworkPeers");
 const QString QSTR_ENFORCECHANSTATE("EnforceChannelState");
 const QString QSTR_ENABLEKEYBOARDINPUT("EnableKeyboardInput");
 const QString QSTR_ENABLEMOUSEINPUT("EnableMouseInput");
 const QString QSTR_ENABLETOUCHINPUT("EnableTouchInput");
+const QString QSTR_SOUNDFONT("SoundFont");
 
 const QString QSTR_MIDIDRIVER("MIDIDriver");
 const QString QSTR_DRIVERNAMEALSA("ALSA Sequencer");
@@ -99,6 +111,8 @@ const QString QSTR_DRIVERNAMEMACOSX("Mac OSX CoreMIDI");
 const QString QSTR_DRIVERNAMEIRIX("SGI Irix MD");
 const QString QSTR_DRIVERNAMEWINMM("Windows MM");
 const QString QSTR_DRIVERNAMENET("Network UDP (IpMIDI)");
+const QString QSTR_DRIVERNAMERTP("Network RTP-MIDI");
+const QString QSTR_DRIVERNAMESYNTH("FluidSynth");
 const QString QSTR_MULTICAST_ADDRESS("225.0.0.37");
 const QString QSTR_PALETTEPREFIX("Palette_");
 const QString QSTR_CURRENTPALETTE("CurrentPalette");
@@ -130,7 +144,9 @@ const char MIDICTLNUMBER[] = "MIDICTLNUMBER\0";
 const char MIDICTLONVALUE[] = "MIDICTLONVAL\0";
 const char MIDICTLOFFVALUE[] = "MIDICTLOFFVAL\0";
 const char SYSEXFILENAME[] = "SYSEXFILENAME\0";
-const char SYSEXFILEDATA[] = "SYSEXFILEDATA\0";
+const char SYSEXPACKETSIZE[] = "SYSEXPACKETSIZE\0";
+const char SYSEXBYTERATE[] = "SYSEXBYTERATE\0";
+const char SYSEXDELAY[] = "SYSEXDELAY\0";
 
 const int MIDIGMDRUMSCHANNEL = 9;
 const int MIDICHANNELS = 16;
@@ -138,6 +154,8 @@ const int MIDIVELOCITY = 100;
 const int MIDIPAN = 64;
 const int MIDIVOLUME = 100;
 const int MIDIEXPRESSION = 127;
+const int MIDIWIREBYTERATE = 3125;
+const int DEFAULTSYSEXPACKETSIZE = 256;
 
 #if defined(SMALL_SCREEN)
 const int DEFAULTNUMBEROFOCTAVES = 2;
@@ -58,6 +58,9 @@ DialogExtraControls::DialogExtraControls(QWidget *parent) :
     connect( m_ui->spinSliderSize, SIGNAL(valueChanged(int)), SLOT(sizeChanged(int)) );
     connect( m_ui->spinValue, SIGNAL(valueChanged(int)), SLOT(minimumChanged(int)) );
     connect( m_ui->btnFileSyx, SIGNAL(clicked()), SLOT(openFile()) );
+    connect( m_ui->spinPacketSize, SIGNAL(valueChanged(int)), SLOT(packetSizeChanged(int)) );
+    connect( m_ui->spinByteRate, SIGNAL(valueChanged(int)), SLOT(byteRateChanged(int)) );
+    connect( m_ui->spinDelay, SIGNAL(valueChanged(int)), SLOT(delayChanged(int)) );
 #if defined(SMALL_SCREEN)
     setWindowState(Qt::WindowActive | Qt::WindowMaximized);
 #endif
@@ -130,6 +133,9 @@ void DialogExtraControls::itemSelected( QListWidgetItem *current, QListWidgetIte
         m_ui->spinSliderSize->setValue(e->getSize());
         m_ui->spinValue->setValue(e->getMinimum());
         m_ui->edtFileSyx->setText(e->getFileName());
+        m_ui->spinPacketSize->setValue(e->getPacketSize());
+        m_ui->spinByteRate->setValue(e->getByteRate());
+        m_ui->spinDelay->setValue(e->getDelay());
     }
 }
 
@@ -200,6 +206,24 @@ void DialogExtraControls::sizeChanged(int size)
     if (e != NULL) e->setSize(size);
 }
 
+void DialogExtraControls::packetSizeChanged(int size)
+{
+    ExtraControl *e = dynamic_cast<ExtraControl*>(m_ui->extraList->currentItem());
+    if (e != NULL) e->setPacketSize(size);
+}
+
+void DialogExtraControls::byteRateChanged(int rate)
+{
+    ExtraControl *e = dynamic_cast<ExtraControl*>(m_ui->extraList->currentItem());
+    if (e != NULL) e->setByteRate(rate);
+}
+
+void DialogExtraControls::delayChanged(int delay)
+{
+    ExtraControl *e = dynamic_cast<ExtraControl*>(m_ui->extraList->currentItem());
+    if (e != NULL) e->setDelay(delay);
+}
+
 void DialogExtraControls::setControls(const QStringList& ctls)
 {
     m_ui->extraList->clear();
@@ -260,8 +284,12 @@ QString ExtraControl::toString()
     lst << QString::number(m_defValue);
     if (m_type == 3)
         lst << QString::number(m_size);
-    if (m_type == 5)
+    if (m_type == 5) {
         lst << m_fileName;
+        lst << QString::number(m_packetSize);
+        lst << QString::number(m_byteRate);
+        lst << QString::number(m_delay);
+    }
     return lst.join(",");
 }
 
@@ -281,7 +309,10 @@ void ExtraControl::decodeString( const QString s,
                           int& maxValue,
                           int& defValue,
                           int& size,
-                          QString& fileName)
+                          QString& fileName,
+                          int& packetSize,
+                          int& byteRate,
+                          int& delay)
 {
     QStringList lst = s.split(",");
     if (!lst.isEmpty())
@@ -300,6 +331,12 @@ void ExtraControl::decodeString( const QString s,
         size = ExtraControl::mbrFromString(lst.takeFirst(), 100);
     if (!lst.isEmpty() && type == 5)
         fileName = lst.takeFirst();
+    if (!lst.isEmpty() && type == 5)
+        packetSize = ExtraControl::mbrFromString(lst.takeFirst(), DEFAULTSYSEXPACKETSIZE);
+    if (!lst.isEmpty() && type == 5)
+        byteRate = ExtraControl::mbrFromString(lst.takeFirst(), MIDIWIREBYTERATE);
+    if (!lst.isEmpty() && type == 5)
+        delay = ExtraControl::mbrFromString(lst.takeFirst(), 0);
 }
 
 void ExtraControl::initFromString(const QString s)
@@ -307,6 +344,7 @@ void ExtraControl::initFromString(const QString s)
     QString lbl;
     ExtraControl::decodeString( s, lbl, m_control, m_type,
                                 m_minValue, m_maxValue, m_defValue,
-                                m_size, m_fileName );
+                                m_size, m_fileName,
+                                m_packetSize, m_byteRate, m_delay );
     setText(lbl);
 }
@@ -19,6 +19,7 @@
 #ifndef EXTRACONTROLS_H
 #define EXTRACONTROLS_H
 
+#include "constants.h"
 #include <QDialog>
 #include <QListWidgetItem>
 
@@ -32,7 +33,8 @@ class ExtraControl : public QListWidgetItem {
 public:
     ExtraControl( QListWidget *parent = 0, int type = extraControlType ):
             QListWidgetItem( parent, type ),
-            m_type(0), m_minValue(0), m_maxValue(127), m_defValue(0), m_size(100) {}
+            m_type(0), m_minValue(0), m_maxValue(127), m_defValue(0), m_size(100),
+            m_packetSize(DEFAULTSYSEXPACKETSIZE), m_byteRate(MIDIWIREBYTERATE), m_delay(0) {}
     virtual ~ExtraControl() {}
     void setControl(int ctl) { m_control = ctl; }
     void setType(int type) { m_type = type; }
@@ -44,6 +46,9 @@ public:
     void setOffValue(int v) { m_minValue = v; }
     void setOnDefault(bool b) { m_defValue = int(b); }
     void setFileName(QString s) { m_fileName = s; }
+    void setPacketSize(int s) { m_packetSize = s; }
+    void setByteRate(int r) { m_byteRate = r; }
+    void setDelay(int d) { m_delay = d; }
     int getControl() { return m_control; }
     int getType() { return m_type; }
     int getMinimum() { return m_minValue; }
@@ -54,6 +59,9 @@ public:
     int getOffValue() { return m_minValue; }
     bool getOnDefault() { return bool(m_defValue); }
     QString getFileName() { return m_fileName; }
+    int getPacketSize() { return m_packetSize; }
+    int getByteRate() { return m_byteRate; }
+    int getDelay() { return m_delay; }
 
     QString toString();
     void initFromString(const QString s);
@@ -66,7 +74,10 @@ public:
                               int& maxValue,
                               int& defValue,
                               int& size,
-                              QString& fileName);
+                              QString& fileName,
+                              int& packetSize,
+                              int& byteRate,
+                              int& delay);
 
 private:
     int m_control;
@@ -76,6 +87,9 @@ private:
     int m_defValue;
     int m_size;
     QString m_fileName;
+    int m_packetSize;
+    int m_byteRate;
+    int m_delay;
 };
 
 class DialogExtraControls : public QDialog {
@@ -103,6 +117,9 @@ public slots:
     void defaultChanged(int defvalue);
     void defOnChanged(bool defOn);
     void sizeChanged(int size);
+    void packetSizeChanged(int size);
+    void byteRateChanged(int rate);
+    void delayChanged(int delay);
     void openFile();
 
 protected:
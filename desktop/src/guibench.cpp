@@ -0,0 +1,617 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ *  vmpk-guibench: rendering benchmark for the keyboard widget.
+ *
+ *  Instantiates PianoKeybd at several octave counts and window sizes,
+ *  replays note streams, pointer and touch traces, and reports frame times,
+ *  paint events and memory allocations. With Qt 5 the "offscreen"
+ *  platform is selected unless QT_QPA_PLATFORM says otherwise; with Qt 4
+ *  run it under a virtual X server (Xvfb).
+ *
+ *  Usage: vmpk-guibench [options]
+ *    --scenario all|notes|drag|touch|hittest   workload (all)
+ *    --octaves LIST     comma separated octave counts (3,5,7,10)
+ *    --sizes LIST       comma separated window sizes (640x100,1280x200,1920x300)
+ *    --frames N         frames per run (300)
+ *    --rate N           note-on messages per frame, notes scenario (32)
+ *    --moves N          pointer moves, hittest scenario (100000)
+ *    --trace FILE       replay a recorded trace instead of the generated ones
+ *    --seed N           pseudo-random seed (1)
+ *
+ *  Trace files have one event per line, '#' starts a comment:
+ *    <ms> on <note> <velocity> [<channel>]
+ *    <ms> off <note>
+ *    <ms> press|move|release <x> <y>
+ *    <ms> touch <id> press|move|release <x> <y>
+ *  Coordinates are relative to the keyboard, from 0.0 to 1.0. Touch points
+ *  are sent to the scene as touch events, one per sample of each finger,
+ *  with the other fingers down as stationary points.
+ */
+
+#include <cstdlib>
+#include <new>
+
+#include <QApplication>
+#include <QStringList>
+#include <QVector>
+#include <QFile>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QMouseEvent>
+#include <QTouchEvent>
+#include <QPaintEvent>
+#include <QGraphicsSceneMouseEvent>
+#include <QAtomicInt>
+#include <QPair>
+#include <QMap>
+#include <QSet>
+
+#include <algorithm>
+
+#include "pianokeybd.h"
+#include "pianopalette.h"
+#include "constants.h"
+
+/* Every allocation of the process goes through these */
+static QAtomicInt g_allocations;
+
+#if __cplusplus >= 201103L
+#define BENCH_THROW_BADALLOC
+#define BENCH_NOTHROW noexcept
+#else
+#define BENCH_THROW_BADALLOC throw(std::bad_alloc)
+#define BENCH_NOTHROW throw()
+#endif
+
+void *operator new(std::size_t size) BENCH_THROW_BADALLOC
+{
+    g_allocations.fetchAndAddRelaxed(1);
+    void *p = std::malloc(size ? size : 1);
+    if (p == 0)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](std::size_t size) BENCH_THROW_BADALLOC
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) BENCH_NOTHROW
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) BENCH_NOTHROW
+{
+    std::free(p);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void *p, std::size_t) BENCH_NOTHROW
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) BENCH_NOTHROW
+{
+    std::free(p);
+}
+#endif
+
+struct TraceEvent {
+    enum Type { NoteOn, NoteOff, Press, Move, Release,
+                TouchPress, TouchMove, TouchRelease };
+    int frame;
+    Type type;
+    int touch;
+    int note;
+    int velocity;
+    int channel;
+    qreal x;
+    qreal y;
+};
+
+typedef QVector<TraceEvent> Trace;
+
+static bool traceOrder(const TraceEvent &a, const TraceEvent &b)
+{
+    return a.frame < b.frame;
+}
+
+struct BenchOptions {
+    QString scenario;
+    QList<int> octaves;
+    QList<QSize> sizes;
+    int frames;
+    int rate;
+    int moves;
+    QString trace;
+    uint seed;
+
+    BenchOptions() : scenario("all"), frames(300), rate(32), moves(100000), seed(1)
+    {
+        octaves << 3 << 5 << 7 << 10;
+        sizes << QSize(640, 100) << QSize(1280, 200) << QSize(1920, 300);
+    }
+};
+
+class Lcg
+{
+public:
+    Lcg(uint seed) : m_state(seed) {}
+    uint next(uint range)
+    {
+        m_state = m_state * 1103515245u + 12345u;
+        return (m_state >> 16) % range;
+    }
+private:
+    uint m_state;
+};
+
+static TraceEvent noteEvent(int frame, TraceEvent::Type type, int note, int vel, int chan)
+{
+    TraceEvent ev;
+    ev.frame = frame;
+    ev.type = type;
+    ev.touch = 0;
+    ev.note = note;
+    ev.velocity = vel;
+    ev.channel = chan;
+    ev.x = ev.y = 0;
+    return ev;
+}
+
+static TraceEvent pointerEvent(int frame, TraceEvent::Type type, qreal x, qreal y)
+{
+    TraceEvent ev = noteEvent(frame, type, 0, 0, 0);
+    ev.x = x;
+    ev.y = y;
+    return ev;
+}
+
+static TraceEvent touchEvent(int frame, TraceEvent::Type type, int id, qreal x, qreal y)
+{
+    TraceEvent ev = pointerEvent(frame, type, x, y);
+    ev.touch = id;
+    return ev;
+}
+
+/* Dense input on all 16 channels: short and long notes, some of them
+   shorter than a frame */
+static Trace notesTrace(const BenchOptions &opt)
+{
+    Trace trace;
+    Lcg rnd(opt.seed);
+    for (int f = 0; f < opt.frames; ++f) {
+        for (int i = 0; i < opt.rate; ++i) {
+            int note = 24 + rnd.next(84);
+            int chan = rnd.next(MIDICHANNELS);
+            trace << noteEvent(f, TraceEvent::NoteOn, note, 1 + rnd.next(127), chan);
+            trace << noteEvent(f + rnd.next(30), TraceEvent::NoteOff, note, 0, chan);
+        }
+    }
+    std::stable_sort(trace.begin(), trace.end(), traceOrder);
+    return trace;
+}
+
+/* Glissando: the pointer sweeps the keyboard back and forth, alternating
+   the white and black key rows */
+static Trace dragTrace(const BenchOptions &opt)
+{
+    Trace trace;
+    const int movesPerFrame = 8;
+    const int sweep = 120;
+    trace << pointerEvent(0, TraceEvent::Press, 0.0, 0.9);
+    for (int f = 0; f < opt.frames; ++f) {
+        for (int i = 0; i < movesPerFrame; ++i) {
+            int step = (f * movesPerFrame + i) % (2 * sweep);
+            qreal x = (step < sweep ? step : 2 * sweep - step) / qreal(sweep);
+            qreal y = ((f / sweep) % 2) ? 0.3 : 0.9;
+            trace << pointerEvent(f, TraceEvent::Move, qBound(0.0, x, 0.999), y);
+        }
+    }
+    trace << pointerEvent(opt.frames - 1, TraceEvent::Release, 0.5, 0.9);
+    return trace;
+}
+
+/* Four fingers sweeping the keyboard at different speeds, two on each key
+   row, so they skip keys between two samples and often share a key. The
+   last finger lifts and lands again every second. */
+static Trace touchTrace(const BenchOptions &opt)
+{
+    Trace trace;
+    const int fingers = 4;
+    const int sweep = 40;
+    for (int f = 0; f < opt.frames; ++f) {
+        for (int t = 0; t < fingers; ++t) {
+            int step = (f * (t + 1)) % (2 * sweep);
+            qreal x = (step < sweep ? step : 2 * sweep - step) / qreal(sweep);
+            qreal y = (t < fingers / 2) ? 0.9 : 0.3;
+            TraceEvent::Type type = TraceEvent::TouchMove;
+            if (f == 0 || (t == fingers - 1 && f % 60 == 0))
+                type = TraceEvent::TouchPress;
+            else if (f == opt.frames - 1 || (t == fingers - 1 && f % 60 == 59))
+                type = TraceEvent::TouchRelease;
+            trace << touchEvent(f, type, t, qBound(0.0, x, 0.999), y);
+        }
+    }
+    return trace;
+}
+
+static bool loadTrace(const QString &fileName, Trace &trace, QTextStream &out)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        out << "cannot open " << fileName << endl;
+        return false;
+    }
+    QTextStream in(&file);
+    int lineNumber = 0;
+    while (!in.atEnd()) {
+        QString line = in.readLine();
+        lineNumber++;
+        int hash = line.indexOf('#');
+        if (hash >= 0)
+            line.truncate(hash);
+        QStringList f = line.simplified().split(' ', QString::SkipEmptyParts);
+        if (f.isEmpty())
+            continue;
+        bool ok = f.size() >= 3;
+        int frame = ok ? qRound(f[0].toDouble(&ok) * 60 / 1000) : 0;
+        if (ok && f[1] == "on" && f.size() >= 4)
+            trace << noteEvent(frame, TraceEvent::NoteOn, f[2].toInt(), f[3].toInt(),
+                               f.size() > 4 ? f[4].toInt() : 0);
+        else if (ok && f[1] == "off")
+            trace << noteEvent(frame, TraceEvent::NoteOff, f[2].toInt(), 0, 0);
+        else if (ok && f.size() >= 4 && (f[1] == "press" || f[1] == "move" || f[1] == "release"))
+            trace << pointerEvent(frame, f[1] == "press" ? TraceEvent::Press :
+                                  f[1] == "move" ? TraceEvent::Move : TraceEvent::Release,
+                                  f[2].toDouble(), f[3].toDouble());
+        else if (ok && f.size() >= 6 && f[1] == "touch" &&
+                 (f[3] == "press" || f[3] == "move" || f[3] == "release"))
+            trace << touchEvent(frame, f[3] == "press" ? TraceEvent::TouchPress :
+                                f[3] == "move" ? TraceEvent::TouchMove : TraceEvent::TouchRelease,
+                                f[2].toInt(), f[4].toDouble(), f[5].toDouble());
+        else
+            ok = false;
+        if (!ok) {
+            out << fileName << ":" << lineNumber << ": invalid event" << endl;
+            return false;
+        }
+    }
+    std::stable_sort(trace.begin(), trace.end(), traceOrder);
+    return true;
+}
+
+/* Counts the paint events of the keyboard viewport and the painted area */
+class PaintCounter : public QObject
+{
+public:
+    PaintCounter() : m_paints(0), m_pixels(0) {}
+    int paints() const { return m_paints; }
+    qint64 pixels() const { return m_pixels; }
+
+protected:
+    bool eventFilter(QObject *, QEvent *event)
+    {
+        if (event->type() == QEvent::Paint) {
+            QPaintEvent *pe = static_cast<QPaintEvent*>(event);
+            m_paints++;
+            foreach(const QRect &r, pe->region().rects())
+                m_pixels += qint64(r.width()) * r.height();
+        }
+        return false;
+    }
+
+private:
+    int m_paints;
+    qint64 m_pixels;
+};
+
+static void sendMouse(QWidget *viewport, QEvent::Type type, const QPoint &pos,
+                      Qt::MouseButton button, Qt::MouseButtons buttons)
+{
+    QMouseEvent ev(type, pos, viewport->mapToGlobal(pos), button, buttons, Qt::NoModifier);
+    QApplication::sendEvent(viewport, &ev);
+}
+
+/* Groups the touch samples of a trace into touch events, as a touch screen
+   driver does: each event carries every finger down, the ones without a new
+   sample being stationary, and a second sample of a finger starts the next
+   event. */
+class TouchReplay
+{
+public:
+    TouchReplay(PianoScene *scene) : m_scene(scene) {}
+    void add(const TraceEvent &ev, const QPointF &scenePos);
+    void flush();
+
+private:
+    PianoScene *m_scene;
+    QMap<int, QTouchEvent::TouchPoint> m_points; // fingers down, by id
+    QSet<int> m_changed;
+};
+
+void TouchReplay::add(const TraceEvent &ev, const QPointF &scenePos)
+{
+    if (m_changed.contains(ev.touch))
+        flush();
+    bool down = m_points.contains(ev.touch);
+    if (ev.type == TraceEvent::TouchRelease && !down)
+        return;
+    QTouchEvent::TouchPoint &point = m_points[ev.touch];
+    point.setId(ev.touch);
+    if (ev.type == TraceEvent::TouchRelease)
+        point.setState(Qt::TouchPointReleased);
+    else
+        point.setState(down ? Qt::TouchPointMoved : Qt::TouchPointPressed);
+    point.setLastScenePos(down ? point.scenePos() : scenePos);
+    point.setScenePos(scenePos);
+    point.setPressure(1.0);
+    m_changed.insert(ev.touch);
+}
+
+void TouchReplay::flush()
+{
+    if (m_changed.isEmpty())
+        return;
+    QList<QTouchEvent::TouchPoint> points;
+    Qt::TouchPointStates states = 0;
+    bool begin = true, end = true;
+    QMap<int, QTouchEvent::TouchPoint>::Iterator it = m_points.begin();
+    while (it != m_points.end()) {
+        if (!m_changed.contains(it.key()))
+            it->setState(Qt::TouchPointStationary);
+        begin = begin && it->state() == Qt::TouchPointPressed;
+        end = end && it->state() == Qt::TouchPointReleased;
+        states |= it->state();
+        points << *it;
+        if (it->state() == Qt::TouchPointReleased)
+            it = m_points.erase(it);
+        else
+            ++it;
+    }
+    QEvent::Type type = begin ? QEvent::TouchBegin :
+                        end ? QEvent::TouchEnd : QEvent::TouchUpdate;
+#if QT_VERSION >= 0x050000
+    QTouchEvent ev(type, 0, Qt::NoModifier, states, points);
+#else
+    QTouchEvent ev(type, QTouchEvent::TouchScreen, Qt::NoModifier, states, points);
+#endif
+    QApplication::sendEvent(m_scene, &ev);
+    m_changed.clear();
+}
+
+static qint64 percentile(const QVector<qint64> &sorted, int p)
+{
+    return sorted.isEmpty() ? 0 : sorted[qMin(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+/* Replays a trace frame by frame. Each frame delivers its events, flushes
+   the note states the scene would otherwise apply on its frame timer, and
+   processes the resulting repaint. */
+static void runFrames(const QString &name, const Trace &trace, int octaves,
+                      const QSize &size, int frames, QTextStream &out)
+{
+    PianoPalette palette(MIDICHANNELS, PAL_CHANNELS);
+    for (int i = 0; i < MIDICHANNELS; ++i)
+        palette.setColor(i, QColor::fromHsv(i * 360 / MIDICHANNELS, 255, 255));
+    palette.updateBrushes();
+
+    PianoKeybd keybd(qMax(0, 5 - octaves / 2), octaves);
+    PianoScene *scene = keybd.getPianoScene();
+    scene->setPianoPalette(&palette);
+    keybd.resize(size);
+    keybd.show();
+    PaintCounter counter;
+    keybd.viewport()->installEventFilter(&counter);
+    QApplication::processEvents();
+
+    QWidget *viewport = keybd.viewport();
+    QRectF area = scene->sceneRect();
+    TouchReplay touch(scene);
+    QVector<qint64> frameTimes;
+    frameTimes.reserve(frames);
+    int paints = counter.paints();
+    qint64 pixels = counter.pixels();
+    int allocations = g_allocations.fetchAndAddRelaxed(0);
+    QElapsedTimer total, frame;
+    total.start();
+    int next = 0;
+    for (int f = 0; f < frames; ++f) {
+        frame.start();
+        for (; next < trace.size() && trace[next].frame <= f; ++next) {
+            const TraceEvent &ev = trace[next];
+            QPointF scenePos(area.left() + ev.x * area.width(),
+                             area.top() + ev.y * area.height());
+            QPoint pos = keybd.mapFromScene(scenePos);
+            if (ev.type >= TraceEvent::TouchPress) {
+                touch.add(ev, scenePos);
+                continue;
+            }
+            touch.flush();
+            switch (ev.type) {
+            case TraceEvent::NoteOn:
+                scene->showNoteOn(ev.note, palette.getBrush(ev.channel, ev.velocity));
+                break;
+            case TraceEvent::NoteOff:
+                scene->showNoteOff(ev.note);
+                break;
+            case TraceEvent::Press:
+                sendMouse(viewport, QEvent::MouseButtonPress, pos, Qt::LeftButton, Qt::LeftButton);
+                break;
+            case TraceEvent::Move:
+                sendMouse(viewport, QEvent::MouseMove, pos, Qt::NoButton, Qt::LeftButton);
+                break;
+            case TraceEvent::Release:
+                sendMouse(viewport, QEvent::MouseButtonRelease, pos, Qt::LeftButton, Qt::NoButton);
+                break;
+            default:
+                break;
+            }
+        }
+        touch.flush();
+        QMetaObject::invokeMethod(scene, "flushKeyStates");
+        for (int i = 0; i < 3; ++i)
+            QApplication::processEvents();
+        frameTimes << frame.nsecsElapsed() / 1000;
+    }
+    double seconds = total.nsecsElapsed() / 1e9;
+    allocations = g_allocations.fetchAndAddRelaxed(0) - allocations;
+    paints = counter.paints() - paints;
+    pixels = counter.pixels() - pixels;
+    keybd.viewport()->removeEventFilter(&counter);
+
+    qint64 sum = 0;
+    foreach(qint64 t, frameTimes)
+        sum += t;
+    std::sort(frameTimes.begin(), frameTimes.end());
+    out << qSetFieldWidth(8) << left << name << qSetFieldWidth(0)
+        << " oct " << qSetFieldWidth(2) << right << octaves << qSetFieldWidth(0)
+        << "  " << qSetFieldWidth(9) << left
+        << QString("%1x%2").arg(size.width()).arg(size.height()) << qSetFieldWidth(0) << right
+        << "  frame us: mean " << (frameTimes.isEmpty() ? 0 : sum / frameTimes.size())
+        << " p50 " << percentile(frameTimes, 50)
+        << " p95 " << percentile(frameTimes, 95)
+        << " max " << (frameTimes.isEmpty() ? 0 : frameTimes.last())
+        << "  paints " << paints << " (" << pixels / frames << " px/frame)"
+        << "  allocs/s " << (seconds > 0 ? qRound64(allocations / seconds) : 0)
+        << endl;
+}
+
+/* Pointer moves sent straight to the scene, measuring the event handling
+   and key lookup alone */
+static void runHitTest(int octaves, int moves, QTextStream &out)
+{
+    PianoScene scene(qMax(0, 5 - octaves / 2), octaves);
+    PianoPalette palette(1, PAL_SINGLE);
+    scene.setPianoPalette(&palette);
+    QRectF area = scene.sceneRect();
+    QGraphicsSceneMouseEvent press(QEvent::GraphicsSceneMousePress);
+    press.setButton(Qt::LeftButton);
+    press.setButtons(Qt::LeftButton);
+    press.setScenePos(QPointF(area.left() + 1, area.bottom() - 1));
+    QApplication::sendEvent(&scene, &press);
+
+    int allocations = g_allocations.fetchAndAddRelaxed(0);
+    QElapsedTimer timer;
+    timer.start();
+    QPointF last = press.scenePos();
+    for (int i = 0; i < moves; ++i) {
+        qreal x = area.left() + (i * 7919 % 10007) / 10007.0 * area.width();
+        qreal y = (i % 3 == 0) ? area.height() * 0.3 : area.height() * 0.9;
+        QGraphicsSceneMouseEvent move(QEvent::GraphicsSceneMouseMove);
+        move.setButtons(Qt::LeftButton);
+        move.setScenePos(QPointF(x, y));
+        move.setLastScenePos(last);
+        QApplication::sendEvent(&scene, &move);
+        last = move.scenePos();
+        if (i % 1000 == 999)
+            QApplication::processEvents();
+    }
+    double seconds = timer.nsecsElapsed() / 1e9;
+    allocations = g_allocations.fetchAndAddRelaxed(0) - allocations;
+    out << qSetFieldWidth(8) << left << "hittest" << qSetFieldWidth(0)
+        << " oct " << qSetFieldWidth(2) << right << octaves << qSetFieldWidth(0)
+        << "  moves " << moves
+        << "  moves/s " << (seconds > 0 ? qRound64(moves / seconds) : 0)
+        << "  allocs/move " << (moves > 0 ? allocations / moves : 0)
+        << endl;
+}
+
+int main(int argc, char *argv[])
+{
+#if QT_VERSION >= 0x050000
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+#endif
+    QApplication app(argc, argv);
+    QTextStream out(stdout);
+    BenchOptions opt;
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        QString arg = args[i];
+        QString value = (i + 1 < args.size()) ? args[i + 1] : QString();
+        if (value.isEmpty()) {
+            out << "missing value for " << arg << endl;
+            return 1;
+        }
+        i++;
+        if (arg == "--scenario") {
+            opt.scenario = value;
+        } else if (arg == "--octaves") {
+            opt.octaves.clear();
+            foreach(const QString &s, value.split(',', QString::SkipEmptyParts))
+                opt.octaves << qBound(1, s.toInt(), 10);
+        } else if (arg == "--sizes") {
+            opt.sizes.clear();
+            foreach(const QString &s, value.split(',', QString::SkipEmptyParts)) {
+                QStringList wh = s.split('x');
+                if (wh.size() == 2)
+                    opt.sizes << QSize(qMax(16, wh[0].toInt()), qMax(16, wh[1].toInt()));
+            }
+        } else if (arg == "--frames") {
+            opt.frames = qMax(1, value.toInt());
+        } else if (arg == "--rate") {
+            opt.rate = qMax(0, value.toInt());
+        } else if (arg == "--moves") {
+            opt.moves = qMax(1, value.toInt());
+        } else if (arg == "--trace") {
+            opt.trace = value;
+        } else if (arg == "--seed") {
+            opt.seed = value.toUInt();
+        } else {
+            out << "unknown option " << arg << endl;
+            return 1;
+        }
+    }
+    QStringList scenarios;
+    scenarios << "all" << "notes" << "drag" << "touch" << "hittest";
+    if (!scenarios.contains(opt.scenario) || opt.octaves.isEmpty() || opt.sizes.isEmpty()) {
+        out << "invalid scenario, octaves or sizes" << endl;
+        return 1;
+    }
+
+    QList<QPair<QString, Trace> > runs;
+    if (!opt.trace.isEmpty()) {
+        Trace trace;
+        if (!loadTrace(opt.trace, trace, out))
+            return 1;
+        if (!trace.isEmpty())
+            opt.frames = trace.last().frame + 1;
+        runs << qMakePair(QString("trace"), trace);
+    } else {
+        if (opt.scenario == "all" || opt.scenario == "notes")
+            runs << qMakePair(QString("notes"), notesTrace(opt));
+        if (opt.scenario == "all" || opt.scenario == "drag")
+            runs << qMakePair(QString("drag"), dragTrace(opt));
+        if (opt.scenario == "all" || opt.scenario == "touch")
+            runs << qMakePair(QString("touch"), touchTrace(opt));
+    }
+    for (int r = 0; r < runs.size(); ++r)
+        foreach(int octaves, opt.octaves)
+            foreach(const QSize &size, opt.sizes)
+                runFrames(runs[r].first, runs[r].second, octaves, size, opt.frames, out);
+    if (opt.trace.isEmpty() && (opt.scenario == "all" || opt.scenario == "hittest"))
+        foreach(int octaves, opt.octaves)
+            runHitTest(octaves, opt.moves, out);
+    return 0;
+}
@@ -0,0 +1,484 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ *  vmpk-insbench: benchmark for the instrument definitions (.ins) parser.
+ *
+ *  Generates a large Cakewalk .ins corpus, or takes the given file, and
+ *  parses it several times with the plain parser, bypassing the binary
+ *  cache. Reports the parse time of every run, the throughput in lines
+ *  and megabytes per second, and what was found in the file. The same
+ *  file is then parsed by a reference copy of the former parser, which
+ *  matched every line against a set of regular expressions, and the
+ *  speedup of the current parser over it is reported.
+ *
+ *  With glibc, it also reports the heap used by the names lists: as
+ *  stored now (dense arrays and interned strings), and rebuilt with the
+ *  former layout (a map and a separate copy of every string per list).
+ *  The first figure covers the whole list, instruments included, so the
+ *  comparison rather favours the former layout.
+ *
+ *  Usage: vmpk-insbench [options]
+ *    --instruments N    generated instrument definitions (200)
+ *    --banks N          patch banks per instrument (8)
+ *    --runs N           timed parse runs, of each parser (5)
+ *    --seed N           pseudo-random seed (1)
+ *    --file FILE        parse FILE instead of a generated corpus
+ *    --save FILE        also write the generated corpus to FILE
+ */
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QVector>
+#include <QFile>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QRegExp>
+
+#include <algorithm>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "instrument.h"
+
+struct BenchOptions {
+    int instruments;
+    int banks;
+    int runs;
+    uint seed;
+    QString file;
+    QString save;
+
+    BenchOptions() :
+        instruments(200), banks(8), runs(5), seed(1) {}
+};
+
+/* Small deterministic generator, so runs are comparable */
+class Lcg
+{
+public:
+    Lcg(uint seed) : m_state(seed) {}
+    uint next(uint range)
+    {
+        m_state = m_state * 1103515245u + 12345u;
+        return (m_state >> 16) % range;
+    }
+private:
+    uint m_state;
+};
+
+/* Exposes the plain parser, which InstrumentList::load() hides behind the
+   cache, and adds the former one as a reference */
+class BenchInstrumentList : public InstrumentList
+{
+public:
+    bool parseFile(const QString &sFilename) { return parse(sFilename); }
+    bool parseReference(const QString &sFilename);
+
+private:
+    enum Section { None, PatchNames, NoteNames, ControlNames, RpnNames, NrpnNames, InstrDefs };
+    InstrumentData &names(Section sect, const QString &sName);
+};
+
+InstrumentData &BenchInstrumentList::names(Section sect, const QString &sName)
+{
+    switch (sect) {
+    case NoteNames:
+        return note(sName);
+    case ControlNames:
+        return controller(sName);
+    case RpnNames:
+        return rpn(sName);
+    case NrpnNames:
+        return nrpn(sName);
+    default:
+        return patch(sName);
+    }
+}
+
+/* The former parser: a line at a time through QTextStream, every line
+   simplified and matched against regular expressions. Kept as it was,
+   except that values go through setValue() and unknown entries are
+   skipped without a warning. */
+bool BenchInstrumentList::parseReference(const QString &sFilename)
+{
+    QFile file(sFilename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    Section sect = None;
+    Instrument *pInstrument = 0;
+    InstrumentData *pData = 0;
+
+    QRegExp rxTitle   ("^\\[([^\\]]+)\\]$");
+    QRegExp rxData    ("^([0-9]+)=(.*)$");
+    QRegExp rxBasedOn ("^BasedOn=(.+)$");
+    QRegExp rxBankSel ("^BankSelMethod=(0|1|2|3)$");
+    QRegExp rxUseNotes("^UsesNotesAsControllers=(0|1)$");
+    QRegExp rxControl ("^Control=(.+)$");
+    QRegExp rxRpn     ("^RPN=(.+)$");
+    QRegExp rxNrpn    ("^NRPN=(.+)$");
+    QRegExp rxPatch   ("^Patch\\[([0-9]+|\\*)\\]=(.+)$");
+    QRegExp rxKey     ("^Key\\[([0-9]+|\\*),([0-9]+|\\*)\\]=(.+)$");
+    QRegExp rxDrum    ("^Drum\\[([0-9]+|\\*),([0-9]+|\\*)\\]=(0|1)$");
+
+    const QString s0_127    = "0..127";
+    const QString s1_128    = "1..128";
+    const QString s0_16383  = "0..16383";
+    const QString sAsterisk = "*";
+
+    QTextStream ts(&file);
+    while (!ts.atEnd()) {
+        QString sLine = ts.readLine().simplified();
+        if (sLine.isEmpty() || sLine[0] == ';')
+            continue;
+        if (sLine[0] == '.') {
+            if (sLine == ".Patch Names") {
+                sect = PatchNames;
+                patch(s0_127).setName(s0_127);
+                patch(s1_128).setName(s1_128);
+            } else if (sLine == ".Note Names") {
+                sect = NoteNames;
+                note(s0_127).setName(s0_127);
+            } else if (sLine == ".Controller Names") {
+                sect = ControlNames;
+                controller(s0_127).setName(s0_127);
+            } else if (sLine == ".RPN Names") {
+                sect = RpnNames;
+                rpn(s0_16383).setName(s0_16383);
+            } else if (sLine == ".NRPN Names") {
+                sect = NrpnNames;
+                nrpn(s0_16383).setName(s0_16383);
+            } else if (sLine == ".Instrument Definitions") {
+                sect = InstrDefs;
+            }
+            continue;
+        }
+        if (sect == None)
+            continue;
+        if (sect != InstrDefs) {
+            if (rxTitle.exactMatch(sLine)) {
+                const QString& sTitle = rxTitle.cap(1);
+                pData = &names(sect, sTitle);
+                pData->setName(sTitle);
+            } else if (pData == 0) {
+                continue;
+            } else if (rxBasedOn.exactMatch(sLine)) {
+                pData->setBasedOn(rxBasedOn.cap(1));
+            } else if (rxData.exactMatch(sLine)) {
+                pData->setValue(rxData.cap(1).toInt(), rxData.cap(2));
+            }
+            continue;
+        }
+        if (rxTitle.exactMatch(sLine)) {
+            const QString& sTitle = rxTitle.cap(1);
+            pInstrument = &((*this)[sTitle]);
+            pInstrument->setInstrumentName(sTitle);
+        } else if (pInstrument == 0) {
+            continue;
+        } else if (rxBankSel.exactMatch(sLine)) {
+            pInstrument->setBankSelMethod(rxBankSel.cap(1).toInt());
+        } else if (rxUseNotes.exactMatch(sLine)) {
+            pInstrument->setUsesNotesAsControllers(rxUseNotes.cap(1).toInt() != 0);
+        } else if (rxPatch.exactMatch(sLine)) {
+            int iBank = (rxPatch.cap(1) == sAsterisk ? -1 : rxPatch.cap(1).toInt());
+            pInstrument->setPatch(iBank, patch(rxPatch.cap(2)));
+        } else if (rxControl.exactMatch(sLine)) {
+            pInstrument->setControl(controller(rxControl.cap(1)));
+        } else if (rxRpn.exactMatch(sLine)) {
+            pInstrument->setRpn(rpn(rxRpn.cap(1)));
+        } else if (rxNrpn.exactMatch(sLine)) {
+            pInstrument->setNrpn(nrpn(rxNrpn.cap(1)));
+        } else if (rxKey.exactMatch(sLine)) {
+            int iBank = (rxKey.cap(1) == sAsterisk ? -1 : rxKey.cap(1).toInt());
+            int iProg = (rxKey.cap(2) == sAsterisk ? -1 : rxKey.cap(2).toInt());
+            pInstrument->setNotes(iBank, iProg, note(rxKey.cap(3)));
+        } else if (rxDrum.exactMatch(sLine)) {
+            int iBank = (rxDrum.cap(1) == sAsterisk ? -1 : rxDrum.cap(1).toInt());
+            int iProg = (rxDrum.cap(2) == sAsterisk ? -1 : rxDrum.cap(2).toInt());
+            pInstrument->setDrum(iBank, iProg, rxDrum.cap(3).toInt() != 0);
+        }
+    }
+    file.close();
+    return true;
+}
+
+/* Heap bytes in use, or -1 when the C library doesn't tell */
+static qint64 heapInUse()
+{
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+    return qint64(info.uordblks) + qint64(info.hblkhd);
+#else
+    struct mallinfo info = mallinfo();
+    return qint64(uint(info.uordblks)) + qint64(uint(info.hblkhd));
+#endif
+#else
+    return -1;
+#endif
+}
+
+/* A names list entry as stored before the dense layout */
+struct LegacyData {
+    QString name;
+    QString basedOn;
+    QMap<int, QString> values;
+};
+
+static QString deepCopy(const QString &s)
+{
+    return QString(s.unicode(), s.length());
+}
+
+static void buildLegacy(const InstrumentDataList &list, QList<LegacyData> &legacy)
+{
+    InstrumentDataList::ConstIterator it;
+    for (it = list.constBegin(); it != list.constEnd(); ++it) {
+        LegacyData data;
+        data.name = deepCopy(it.value().name());
+        data.basedOn = deepCopy(it.value().basedOn());
+        InstrumentData::ConstIterator dit;
+        for (dit = it.value().constBegin(); dit != it.value().constEnd(); ++dit)
+            data.values.insert(dit.key(), deepCopy(dit.value()));
+        legacy << data;
+    }
+}
+
+static void reportMemory(const QString &fileName, QTextStream &out)
+{
+    qint64 before = heapInUse();
+    if (before < 0) {
+        out << "memory:      not available on this system" << endl;
+        return;
+    }
+    BenchInstrumentList list;
+    list.parseFile(fileName);
+    qint64 dense = heapInUse();
+    QList<LegacyData> legacy;
+    buildLegacy(list.patches(), legacy);
+    buildLegacy(list.notes(), legacy);
+    buildLegacy(list.controllers(), legacy);
+    buildLegacy(list.rpns(), legacy);
+    buildLegacy(list.nrpns(), legacy);
+    qint64 maps = heapInUse();
+    out << "heap before: " << before / 1024 << " KiB" << endl;
+    out << "dense:       +" << (dense - before) / 1024 << " KiB (whole list, interned strings)" << endl;
+    out << "maps:        +" << (maps - dense) / 1024 << " KiB (names lists in the former layout)" << endl;
+    legacy.clear();
+    list.clearAll();
+}
+
+static const char *const s_words[] = {
+    "Grand", "Bright", "Electric", "Honky-tonk", "Piano", "Organ", "Strings",
+    "Brass", "Pad", "Lead", "Bass", "Guitar", "Choir", "Bell", "Synth",
+    "Warm", "Soft", "Hard", "Slow", "Fast", "Ensemble", "Solo", "Stereo"
+};
+static const uint s_wordCount = sizeof(s_words) / sizeof(s_words[0]);
+
+/* Two words and a number: names repeat across banks, as in real files */
+static QByteArray randomName(Lcg &rnd)
+{
+    QByteArray name(s_words[rnd.next(s_wordCount)]);
+    name += ' ';
+    name += s_words[rnd.next(s_wordCount)];
+    name += ' ';
+    name += QByteArray::number(rnd.next(100));
+    return name;
+}
+
+static QByteArray buildCorpus(const BenchOptions &opt)
+{
+    QByteArray ins;
+    Lcg rnd(opt.seed);
+    ins += "; vmpk-insbench generated instrument definitions\r\n\r\n";
+
+    ins += ".Patch Names\r\n\r\n";
+    for (int i = 0; i < opt.instruments; ++i) {
+        for (int b = 0; b < opt.banks; ++b) {
+            ins += "[Instrument " + QByteArray::number(i) + " Bank " + QByteArray::number(b) + "]\r\n";
+            if (b > 0 && rnd.next(4) == 0)
+                ins += "BasedOn=Instrument " + QByteArray::number(i) + " Bank 0\r\n";
+            for (int p = 0; p < 128; ++p)
+                ins += QByteArray::number(p) + '=' + randomName(rnd) + "\r\n";
+            ins += "\r\n";
+        }
+    }
+
+    ins += ".Note Names\r\n\r\n";
+    for (int i = 0; i < opt.instruments; ++i) {
+        ins += "[Instrument " + QByteArray::number(i) + " Drums]\r\n";
+        for (int n = 35; n <= 81; ++n)
+            ins += QByteArray::number(n) + '=' + randomName(rnd) + "\r\n";
+        ins += "\r\n";
+    }
+
+    ins += ".Controller Names\r\n\r\n";
+    for (int i = 0; i < opt.instruments; ++i) {
+        ins += "[Instrument " + QByteArray::number(i) + " Controllers]\r\n";
+        for (int c = 0; c < 128; ++c)
+            if (rnd.next(2) == 0)
+                ins += QByteArray::number(c) + '=' + randomName(rnd) + "\r\n";
+        ins += "\r\n";
+    }
+
+    ins += ".RPN Names\r\n\r\n";
+    ins += "[Standard RPN]\r\n0=Pitch Bend Sensitivity\r\n1=Fine Tuning\r\n"
+           "2=Coarse Tuning\r\n5=Modulation Depth Range\r\n\r\n";
+
+    ins += ".NRPN Names\r\n\r\n";
+    for (int i = 0; i < opt.instruments; ++i) {
+        ins += "[Instrument " + QByteArray::number(i) + " NRPN]\r\n";
+        for (int n = 0; n < 32; ++n)
+            ins += QByteArray::number(136 + n * 128) + '=' + randomName(rnd) + "\r\n";
+        ins += "\r\n";
+    }
+
+    ins += ".Instrument Definitions\r\n\r\n";
+    for (int i = 0; i < opt.instruments; ++i) {
+        QByteArray id = QByteArray::number(i);
+        ins += "[Instrument " + id + "]\r\n";
+        ins += "BankSelMethod=" + QByteArray::number(i % 4) + "\r\n";
+        ins += "Control=Instrument " + id + " Controllers\r\n";
+        ins += "RPN=Standard RPN\r\n";
+        ins += "NRPN=Instrument " + id + " NRPN\r\n";
+        for (int b = 0; b < opt.banks; ++b)
+            ins += "Patch[" + QByteArray::number(b * 128) + "]=Instrument " + id
+                 + " Bank " + QByteArray::number(b) + "\r\n";
+        ins += "Key[*,*]=Instrument " + id + " Drums\r\n";
+        ins += "Drum[" + QByteArray::number((opt.banks - 1) * 128) + ",*]=1\r\n";
+        ins += "\r\n";
+    }
+    return ins;
+}
+
+/* Times the given parser over the file, returning the median time in
+   seconds, or -1 on failure */
+static double timeParser(const QString &parser, const QString &fileName, int runs,
+                         int lines, double megabytes, QTextStream &out)
+{
+    bool reference = (parser == "reference");
+    out << parser << (reference ? " parser (QRegExp per line)" : " parser") << endl;
+    QVector<qint64> times;
+    for (int r = 0; r < runs; ++r) {
+        BenchInstrumentList list;
+        QElapsedTimer timer;
+        timer.start();
+        bool ok = reference ? list.parseReference(fileName) : list.parseFile(fileName);
+        qint64 elapsed = timer.nsecsElapsed();
+        if (!ok) {
+            out << "cannot parse " << fileName << endl;
+            return -1;
+        }
+        times << elapsed;
+        out << "run " << (r + 1) << ":       " << elapsed / 1000000.0 << " ms" << endl;
+        if (r == 0)
+            out << "found:       " << list.count() << " instruments, "
+                << list.patches().count() << " patch lists, "
+                << list.notes().count() << " note lists, "
+                << list.controllers().count() << " controller lists, "
+                << list.nrpns().count() << " NRPN lists" << endl;
+    }
+
+    std::sort(times.begin(), times.end());
+    double best = times.first() / 1e9;
+    double median = times[times.size() / 2] / 1e9;
+    out << "parse (ms):  best " << best * 1000 << "  median " << median * 1000 << endl;
+    if (median > 0)
+        out << "throughput:  " << qRound64(lines / median) << " lines/s, "
+            << (megabytes / median) << " MiB/s (median)" << endl;
+    return median;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    BenchOptions opt;
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        QString arg = args[i];
+        QString value = (i + 1 < args.size()) ? args[i + 1] : QString();
+        if (value.isEmpty()) {
+            out << "missing value for " << arg << endl;
+            return 1;
+        }
+        i++;
+        if (arg == "--instruments")
+            opt.instruments = qMax(1, value.toInt());
+        else if (arg == "--banks")
+            opt.banks = qBound(1, value.toInt(), 128);
+        else if (arg == "--runs")
+            opt.runs = qMax(1, value.toInt());
+        else if (arg == "--seed")
+            opt.seed = value.toUInt();
+        else if (arg == "--file")
+            opt.file = value;
+        else if (arg == "--save")
+            opt.save = value;
+        else {
+            out << "unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    QString fileName = opt.file;
+    QTemporaryFile corpus;
+    if (fileName.isEmpty()) {
+        QByteArray ins = buildCorpus(opt);
+        if (!opt.save.isEmpty()) {
+            QFile file(opt.save);
+            if (!file.open(QIODevice::WriteOnly) || file.write(ins) != ins.size()) {
+                out << "cannot write " << opt.save << endl;
+                return 1;
+            }
+        }
+        if (!corpus.open() || corpus.write(ins) != ins.size()) {
+            out << "cannot write the generated corpus" << endl;
+            return 1;
+        }
+        corpus.close();
+        fileName = corpus.fileName();
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        out << "cannot open " << fileName << endl;
+        return 1;
+    }
+    QByteArray contents = file.readAll();
+    file.close();
+    double megabytes = contents.size() / (1024.0 * 1024.0);
+    int lines = contents.count('\n');
+    out << "file:        " << (opt.file.isEmpty() ? QString("generated") : opt.file)
+        << ", " << megabytes << " MiB, " << lines << " lines" << endl;
+
+    reportMemory(fileName, out);
+
+    double current = timeParser("current", fileName, opt.runs, lines, megabytes, out);
+    double reference = timeParser("reference", fileName, opt.runs, lines, megabytes, out);
+    if (current < 0 || reference < 0)
+        return 1;
+    if (current > 0)
+        out << "speedup:     " << reference / current << "x (median, reference over current)" << endl;
+    return 0;
+}
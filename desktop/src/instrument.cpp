@@ -24,9 +24,149 @@
 
 #include <QFileInfo>
 #include <QFile>
+#include <QTemporaryFile>
+#include <QDir>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QVector>
 #include <QTextStream>
-#include <QRegExp>
 #include <QDate>
+#include <QCryptographicHash>
+#include <QDesktopServices>
+
+#include <climits>
+#include <cstring>
+
+//----------------------------------------------------------------------
+// class InstrumentData -- instrument definition data classes.
+//
+
+// Interned strings: the same patch or note name is usually repeated for
+// many banks and instruments, so all of them share a single copy.
+static QSet<QString> g_strings;
+static QMutex        g_stringsMutex;
+
+static const QString g_sNull;
+
+
+// Global string intern pool.
+QString InstrumentData::intern ( const QString& s )
+{
+	if (s.isEmpty())
+		return s;
+
+	QMutexLocker locker(&g_stringsMutex);
+	QSet<QString>::ConstIterator it = g_strings.constFind(s);
+	if (it != g_strings.constEnd())
+		return *it;
+
+	// Raw (cached file) data has no spare capacity, so it's kept as is.
+	QString sIntern(s);
+	if (sIntern.capacity() > sIntern.size())
+		sIntern.squeeze();
+	g_strings.insert(sIntern);
+	return sIntern;
+}
+
+
+// Drop the interned strings nobody else refers to anymore.
+void InstrumentData::squeezeStrings (void)
+{
+	QMutexLocker locker(&g_stringsMutex);
+	QSet<QString>::Iterator it = g_strings.begin();
+	while (it != g_strings.end()) {
+		if (it->isDetached())
+			it = g_strings.erase(it);
+		else
+			++it;
+	}
+}
+
+
+// Accessor operator (a null string when not found).
+const QString& InstrumentData::operator[] ( int iIndex ) const
+{
+	if (iIndex >= 0 && iIndex < 128)
+		return (contains(iIndex) ? m_pData->dense[iIndex] : g_sNull);
+
+	DataMap::ConstIterator it = m_pData->sparse.constFind(iIndex);
+	return (it != m_pData->sparse.constEnd() ? it.value() : g_sNull);
+}
+
+
+// Value (interned) modifier.
+void InstrumentData::setValue ( int iIndex, const QString& sValue )
+{
+	if (iIndex >= 0 && iIndex < 128) {
+		if (m_pData->dense == NULL)
+			m_pData->dense = new QString [128];
+		quint32& iBits = m_pData->present[iIndex >> 5];
+		const quint32 iBit = (1U << (iIndex & 31));
+		if ((iBits & iBit) == 0) {
+			iBits |= iBit;
+			m_pData->count++;
+		}
+		m_pData->dense[iIndex] = intern(sValue);
+	} else {
+		if (!m_pData->sparse.contains(iIndex))
+			m_pData->count++;
+		m_pData->sparse.insert(iIndex, intern(sValue));
+	}
+}
+
+
+// Iterators: negative sparse keys first, then the dense
+// entries, then the remaining (above 127) sparse keys.
+InstrumentData::ConstIterator InstrumentData::constBegin (void) const
+{
+	ConstIterator it;
+	it.m_pDense    = m_pData->dense;
+	it.m_pPresent  = m_pData->present;
+	it.m_sparse    = m_pData->sparse.constBegin();
+	it.m_sparseEnd = m_pData->sparse.constEnd();
+	if (it.m_sparse == it.m_sparseEnd || it.m_sparse.key() >= 0)
+		it.nextDense(0);
+	return it;
+}
+
+InstrumentData::ConstIterator InstrumentData::constEnd (void) const
+{
+	ConstIterator it;
+	it.m_pDense    = m_pData->dense;
+	it.m_pPresent  = m_pData->present;
+	it.m_sparse    = m_pData->sparse.constEnd();
+	it.m_sparseEnd = it.m_sparse;
+	return it;
+}
+
+InstrumentData::ConstIterator& InstrumentData::ConstIterator::operator++ (void)
+{
+	if (m_iDense >= 0) {
+		nextDense(m_iDense + 1);
+	} else if (m_sparse != m_sparseEnd) {
+		const bool bNegative = (m_sparse.key() < 0);
+		++m_sparse;
+		if (bNegative && (m_sparse == m_sparseEnd || m_sparse.key() >= 0))
+			nextDense(0);
+	}
+	return *this;
+}
+
+void InstrumentData::ConstIterator::nextDense ( int iKey )
+{
+	while (iKey < 128) {
+		const quint32 iBits = (m_pPresent[iKey >> 5] >> (iKey & 31));
+		if (iBits & 1) {
+			m_iDense = iKey;
+			return;
+		}
+		// Skip the rest of an empty word at once.
+		iKey = (iBits ? iKey + 1 : (iKey | 31) + 1);
+	}
+	m_iDense = -1;
+}
+
 
 //----------------------------------------------------------------------
 // class Instrument -- instrument definition instance class.
@@ -94,6 +234,9 @@ void InstrumentList::clearAll (void)
 	m_nrpns.clear();
 
 	m_files.clear();
+
+	InstrumentData::squeezeStrings();
+	releaseCaches();
 }
 
 
@@ -137,14 +280,120 @@ const QStringList& InstrumentList::files (void) const
 }
 
 
+// Cakewalk .ins tokenizer helpers: all of them work on a simplified
+// line (no leading/trailing blanks, single spaces) of the raw buffer.
+
+// Line starts with the given literal prefix.
+static inline bool insPrefix (
+	const char *pLine, int iLen, const char *pszPrefix, int iPrefix )
+{
+	return (iLen >= iPrefix && ::memcmp(pLine, pszPrefix, iPrefix) == 0);
+}
+
+// Whole line equals the given literal.
+static inline bool insEquals (
+	const char *pLine, int iLen, const char *pszText )
+{
+	return (iLen == int(::strlen(pszText)) && ::memcmp(pLine, pszText, iLen) == 0);
+}
+
+// Scan a decimal number, or an asterisk (-1) when allowed.
+static inline int insNumber (
+	const char *pLine, int iLen, int& iPos, int& iValue, bool bAsterisk )
+{
+	int iStart = iPos;
+	if (bAsterisk && iPos < iLen && pLine[iPos] == '*') {
+		iValue = -1;
+		return ++iPos - iStart;
+	}
+	qint64 iNumber = 0;
+	while (iPos < iLen && pLine[iPos] >= '0' && pLine[iPos] <= '9') {
+		if (iNumber <= INT_MAX)
+			iNumber = iNumber * 10 + (pLine[iPos] - '0');
+		++iPos;
+	}
+	iValue = (iNumber <= INT_MAX ? int(iNumber) : 0);
+	return iPos - iStart;
+}
+
+// Match "[title]", without any inner closing bracket.
+static inline bool insTitle (
+	const char *pLine, int iLen, QString& sTitle )
+{
+	if (iLen < 3 || pLine[0] != '[' || pLine[iLen - 1] != ']'
+		|| ::memchr(pLine + 1, ']', iLen - 2) != NULL)
+		return false;
+	sTitle = QString::fromUtf8(pLine + 1, iLen - 2);
+	return true;
+}
+
+// Match "Key=value" with a non empty value.
+static inline bool insValue (
+	const char *pLine, int iLen, const char *pszKey, int iKey, QString& sValue )
+{
+	if (iLen <= iKey || !insPrefix(pLine, iLen, pszKey, iKey))
+		return false;
+	sValue = QString::fromUtf8(pLine + iKey, iLen - iKey);
+	return true;
+}
+
+// Match "Key[bank]=value" or "Key[bank,prog]=value" (with bank/prog
+// being a number or an asterisk); returns the value position or zero.
+static inline int insIndexed (
+	const char *pLine, int iLen, const char *pszKey, int iKey,
+	int& iBank, int *piProg )
+{
+	if (!insPrefix(pLine, iLen, pszKey, iKey))
+		return 0;
+	int iPos = iKey;
+	if (insNumber(pLine, iLen, iPos, iBank, true) == 0)
+		return 0;
+	if (piProg) {
+		if (iPos >= iLen || pLine[iPos++] != ',')
+			return 0;
+		if (insNumber(pLine, iLen, iPos, *piProg, true) == 0)
+			return 0;
+	}
+	if (iPos + 2 >= iLen || pLine[iPos] != ']' || pLine[iPos + 1] != '=')
+		return 0;
+	return iPos + 2;
+}
+
+
 // File load method.
 bool InstrumentList::load ( const QString& sFilename )
+{
+	// The binary cache only ever holds a single file contents, so it
+	// can't be used when merging into an already populated list.
+	const bool bEmpty = isEmpty()
+		&& m_patches.isEmpty() && m_notes.isEmpty()
+		&& m_controllers.isEmpty() && m_rpns.isEmpty() && m_nrpns.isEmpty();
+
+	if (!bEmpty || !loadCache(sFilename)) {
+		if (!parse(sFilename))
+			return false;
+		if (bEmpty)
+			saveCache(sFilename);
+	}
+
+	// We're in business...
+	appendFile(sFilename);
+
+	return true;
+}
+
+
+// Plain file parser method.
+bool InstrumentList::parse ( const QString& sFilename )
 {
 	// Open and read from real file.
 	QFile file(sFilename);
 	if (!file.open(QIODevice::ReadOnly))
 		return false;
 
+	QByteArray buffer = file.readAll();
+	file.close();
+
 	enum FileSection {
 		None         = 0,
 		PatchNames   = 1,
@@ -158,210 +407,178 @@ bool InstrumentList::load ( const QString& sFilename )
 	Instrument     *pInstrument = NULL;
 	InstrumentData *pData = NULL;
 
-	QRegExp rxTitle   ("^\\[([^\\]]+)\\]$");
-	QRegExp rxData    ("^([0-9]+)=(.*)$");
-	QRegExp rxBasedOn ("^BasedOn=(.+)$");
-	QRegExp rxBankSel ("^BankSelMethod=(0|1|2|3)$");
-	QRegExp rxUseNotes("^UsesNotesAsControllers=(0|1)$");
-	QRegExp rxControl ("^Control=(.+)$");
-	QRegExp rxRpn     ("^RPN=(.+)$");
-	QRegExp rxNrpn    ("^NRPN=(.+)$");
-	QRegExp rxPatch   ("^Patch\\[([0-9]+|\\*)\\]=(.+)$");
-	QRegExp rxKey     ("^Key\\[([0-9]+|\\*),([0-9]+|\\*)\\]=(.+)$");
-	QRegExp rxDrum    ("^Drum\\[([0-9]+|\\*),([0-9]+|\\*)\\]=(0|1)$");
-
 	const QString s0_127    = "0..127";
 	const QString s1_128    = "1..128";
 	const QString s0_16383  = "0..16383";
-	const QString sAsterisk = "*";
 
-	// Read the file.
-	unsigned int iLine = 0;
-	QTextStream ts(&file);
+	const char *pszSection = "";
+	QString sTitle, sValue;
+	int iBank, iProg, iPos;
+
+	// Single pass over the raw buffer: each line is simplified in place,
+	// then matched by hand against the few possible entry shapes.
+	char *pBegin = buffer.data();
+	char *pEnd = pBegin + buffer.size();
+	if (buffer.startsWith("\xef\xbb\xbf"))
+		pBegin += 3;
 
-	while (!ts.atEnd()) {
+	unsigned int iLine = 0;
+	while (pBegin < pEnd) {
 
 		// Read the line.
 		iLine++;
-		QString sLine = ts.readLine().simplified();
+		char *pEol = (char *) ::memchr(pBegin, '\n', pEnd - pBegin);
+		if (pEol == NULL)
+			pEol = pEnd;
+		char *pDst = pBegin;
+		bool bSpace = false;
+		for (const char *pSrc = pBegin; pSrc < pEol; ++pSrc) {
+			const char ch = *pSrc;
+			if (ch == ' ' || (ch >= '\t' && ch <= '\r')) {
+				bSpace = (pDst > pBegin);
+			} else {
+				if (bSpace) {
+					*pDst++ = ' ';
+					bSpace = false;
+				}
+				*pDst++ = ch;
+			}
+		}
+		const char *pLine = pBegin;
+		const int iLen = int(pDst - pBegin);
+		pBegin = pEol + 1;
+
 		// If not empty, nor a comment, call the server...
-		if (sLine.isEmpty() || sLine[0] == ';')
+		if (iLen == 0 || pLine[0] == ';')
 			continue;
 
 		// Check for section intro line...
-		if (sLine[0] == '.') {
-			if (sLine == ".Patch Names") {
+		if (pLine[0] == '.') {
+			if (insEquals(pLine, iLen, ".Patch Names")) {
 				sect = PatchNames;
+				pszSection = ".Patch Names";
 			//	m_patches.clear();
 				m_patches[s0_127].setName(s0_127);
 				m_patches[s1_128].setName(s1_128);
 			}
-			else if (sLine == ".Note Names") {
+			else if (insEquals(pLine, iLen, ".Note Names")) {
 				sect = NoteNames;
+				pszSection = ".Note Names";
 			//	m_notes.clear();
 				m_notes[s0_127].setName(s0_127);
 			}
-			else if (sLine == ".Controller Names") {
+			else if (insEquals(pLine, iLen, ".Controller Names")) {
 				sect = ControlNames;
+				pszSection = ".Controller Names";
 			//	m_controllers.clear();
 				m_controllers[s0_127].setName(s0_127);
 			}
-			else if (sLine == ".RPN Names") {
+			else if (insEquals(pLine, iLen, ".RPN Names")) {
 				sect = RpnNames;
+				pszSection = ".RPN Names";
 			//	m_rpns.clear();
 				m_rpns[s0_16383].setName(s0_16383);
 			}
-			else if (sLine == ".NRPN Names") {
+			else if (insEquals(pLine, iLen, ".NRPN Names")) {
 				sect = NrpnNames;
+				pszSection = ".NRPN Names";
 			//	m_nrpns.clear();
 				m_nrpns[s0_16383].setName(s0_16383);
 			}
-			else if (sLine == ".Instrument Definitions") {
+			else if (insEquals(pLine, iLen, ".Instrument Definitions")) {
 				sect = InstrDefs;
+				pszSection = ".Instrument Definitions";
 			//  clear();
 			}
 			else {
 				// Unknown section found...
 				qWarning("%s(%d): %s: Unknown section.",
-					sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+					sFilename.toUtf8().constData(), iLine,
+					QByteArray(pLine, iLen).constData());
 			}
 			// Go on...
 			continue;
 		}
 
 		// Now it depends on the section...
+		bool bKnown = true;
 		switch (sect) {
-			case PatchNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New patch name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_patches[sTitle]);
-					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
-				} else {
-					qWarning("%s(%d): %s: Unknown .Patch Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
-				}
-				break;
-			}
-			case NoteNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New note name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_notes[sTitle]);
-					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
-				} else {
-					qWarning("%s(%d): %s: Unknown .Note Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
-				}
-				break;
-			}
-			case ControlNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New controller name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_controllers[sTitle]);
-					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
-				} else {
-					qWarning("%s(%d): %s: Unknown .Controller Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
-				}
-				break;
-			}
-			case RpnNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New RPN name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_rpns[sTitle]);
-					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
-				} else {
-					qWarning("%s(%d): %s: Unknown .RPN Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
-				}
-				break;
-			}
+			case PatchNames:
+			case NoteNames:
+			case ControlNames:
+			case RpnNames:
 			case NrpnNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New NRPN name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_nrpns[sTitle]);
+				if (insTitle(pLine, iLen, sTitle)) {
+					// New patch/note/controller/RPN/NRPN name...
+					InstrumentDataList *pList;
+					switch (sect) {
+						case PatchNames:   pList = &m_patches;     break;
+						case NoteNames:    pList = &m_notes;       break;
+						case ControlNames: pList = &m_controllers; break;
+						case RpnNames:     pList = &m_rpns;        break;
+						default:           pList = &m_nrpns;       break;
+					}
+					pData = &((*pList)[sTitle]);
 					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
+				} else if (pData == NULL) {
+					bKnown = false;
+				} else if (insValue(pLine, iLen, "BasedOn=", 8, sValue)) {
+					pData->setBasedOn(sValue);
 				} else {
-					qWarning("%s(%d): %s: Unknown .NRPN Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+					iPos = 0;
+					if (insNumber(pLine, iLen, iPos, iBank, false) > 0
+						&& iPos < iLen && pLine[iPos] == '=') {
+						++iPos;
+						pData->setValue(iBank, QString::fromUtf8(pLine + iPos, iLen - iPos));
+					} else {
+						bKnown = false;
+					}
 				}
 				break;
 			}
 			case InstrDefs: {
-				if (rxTitle.exactMatch(sLine)) {
+				if (insTitle(pLine, iLen, sTitle)) {
 					// New instrument definition...
-					const QString& sTitle = rxTitle.cap(1);
 					pInstrument = &((*this)[sTitle]);
 					pInstrument->setInstrumentName(sTitle);
-				} else if (rxBankSel.exactMatch(sLine)) {
-					pInstrument->setBankSelMethod(
-						rxBankSel.cap(1).toInt());
-				} else if (rxUseNotes.exactMatch(sLine)) {
-					pInstrument->setUsesNotesAsControllers(
-						(bool) rxBankSel.cap(1).toInt());
-				} else if (rxPatch.exactMatch(sLine)) {
-					int iBank = (rxPatch.cap(1) == sAsterisk
-						? -1 : rxPatch.cap(1).toInt());
-					pInstrument->setPatch(iBank, m_patches[rxPatch.cap(2)]);
-				} else if (rxControl.exactMatch(sLine)) {
-					pInstrument->setControl(m_controllers[rxControl.cap(1)]);
-				} else if (rxRpn.exactMatch(sLine)) {
-					pInstrument->setRpn(m_rpns[rxRpn.cap(1)]);
-				} else if (rxNrpn.exactMatch(sLine)) {
-					pInstrument->setNrpn(m_nrpns[rxNrpn.cap(1)]);
-				} else if (rxKey.exactMatch(sLine)) {
-					int iBank = (rxKey.cap(1) == sAsterisk
-						? -1 : rxKey.cap(1).toInt());
-					int iProg = (rxKey.cap(2) == sAsterisk
-						? -1 : rxKey.cap(2).toInt());
-					pInstrument->setNotes(iBank, iProg,	m_notes[rxKey.cap(3)]);
-				} else if (rxDrum.exactMatch(sLine)) {
-					int iBank = (rxDrum.cap(1) == sAsterisk
-						? -1 : rxDrum.cap(1).toInt());
-					int iProg = (rxDrum.cap(2) == sAsterisk
-						? -1 : rxKey.cap(2).toInt());
-					pInstrument->setDrum(iBank, iProg,
-						(bool) rxDrum.cap(3).toInt());
+				} else if (pInstrument == NULL) {
+					bKnown = false;
+				} else if (iLen == 15 && insPrefix(pLine, iLen, "BankSelMethod=", 14)
+					&& pLine[14] >= '0' && pLine[14] <= '3') {
+					pInstrument->setBankSelMethod(pLine[14] - '0');
+				} else if (iLen == 24 && insPrefix(pLine, iLen, "UsesNotesAsControllers=", 23)
+					&& (pLine[23] == '0' || pLine[23] == '1')) {
+					pInstrument->setUsesNotesAsControllers(pLine[23] == '1');
+				} else if ((iPos = insIndexed(pLine, iLen, "Patch[", 6, iBank, NULL)) > 0) {
+					pInstrument->setPatch(iBank,
+						m_patches[QString::fromUtf8(pLine + iPos, iLen - iPos)]);
+				} else if (insValue(pLine, iLen, "Control=", 8, sValue)) {
+					pInstrument->setControl(m_controllers[sValue]);
+				} else if (insValue(pLine, iLen, "RPN=", 4, sValue)) {
+					pInstrument->setRpn(m_rpns[sValue]);
+				} else if (insValue(pLine, iLen, "NRPN=", 5, sValue)) {
+					pInstrument->setNrpn(m_nrpns[sValue]);
+				} else if ((iPos = insIndexed(pLine, iLen, "Key[", 4, iBank, &iProg)) > 0) {
+					pInstrument->setNotes(iBank, iProg,
+						m_notes[QString::fromUtf8(pLine + iPos, iLen - iPos)]);
+				} else if ((iPos = insIndexed(pLine, iLen, "Drum[", 5, iBank, &iProg)) > 0
+					&& iPos + 1 == iLen && (pLine[iPos] == '0' || pLine[iPos] == '1')) {
+					pInstrument->setDrum(iBank, iProg, pLine[iPos] == '1');
 				} else {
-					qWarning("%s(%d): %s: Unknown .Instrument Definitions entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+					bKnown = false;
 				}
 				break;
 			}
 			default:
 				break;
 		}
-	}
 
-	// Ok. We've read it all.
-	file.close();
-
-	// We're in business...
-	appendFile(sFilename);
+		if (!bKnown) {
+			qWarning("%s(%d): %s: Unknown %s entry.",
+				sFilename.toUtf8().constData(), iLine,
+				QByteArray(pLine, iLen).constData(), pszSection);
+		}
+	}
 
 	return true;
 }
@@ -514,3 +731,546 @@ void InstrumentList::saveData ( QTextStream& ts,
 		ts << it.key() << "=" << it.value() << endl;
 	ts << endl;
 }
+
+
+//----------------------------------------------------------------------
+// Binary cache of parsed instrument definitions.
+//
+// Layout, in native byte order and 32-bit aligned:
+//   header | data words | string table | UTF-16 string pool
+// Data words describe the names lists and the instruments, every string
+// being an index into the string table. On load the file is memory mapped
+// and strings are built with QString::fromRawData, so their characters
+// stay in the mapped pages until first modified. Only interned strings
+// keep referring to them: list keys and instrument names are copied.
+
+static const char    c_szCacheMagic[8] = { 'V','M','P','K','I','N','S','C' };
+static const quint32 c_iCacheVersion   = 1;
+static const quint32 c_iCacheByteOrder = 0x01020304;
+static const quint32 c_iCacheNone      = 0xffffffff;
+
+struct InstrumentCacheHeader
+{
+	char    magic[8];
+	quint32 version;
+	quint32 byteOrder;
+	qint64  fileSize;
+	qint64  fileTime;
+	quint32 filePath;       // String index.
+	quint32 dataCount;      // Data words.
+	quint32 stringCount;
+	quint32 reserved;
+};
+
+// A memory mapped cache file.
+struct InstrumentCacheMap
+{
+	InstrumentCacheMap(const QString& sCache)
+		: file(sCache), pBase(NULL), iSize(0), iUsers(0) {}
+	~InstrumentCacheMap()
+		{ if (pBase) file.unmap(const_cast<uchar *> (pBase)); }
+
+	bool map()
+	{
+		if (!file.open(QIODevice::ReadOnly))
+			return false;
+		iSize = file.size();
+		if (iSize < qint64(sizeof(InstrumentCacheHeader)) || iSize > INT_MAX)
+			return false;
+		pBase = file.map(0, iSize);
+		return (pBase != NULL);
+	}
+
+	const InstrumentCacheHeader *header() const
+		{ return reinterpret_cast<const InstrumentCacheHeader *> (pBase); }
+	const quint32 *data() const
+		{ return reinterpret_cast<const quint32 *> (pBase + sizeof(InstrumentCacheHeader)); }
+	const quint32 *table() const
+		{ return data() + header()->dataCount; }
+
+	// Whether a string points into the mapped file.
+	bool contains(const QString& s) const
+	{
+		const uchar *pData = reinterpret_cast<const uchar *> (s.unicode());
+		return (pData >= pBase && pData < pBase + iSize);
+	}
+
+	QFile        file;
+	const uchar *pBase;
+	qint64       iSize;
+	int          iUsers;    // Loads in progress.
+};
+
+// Mapped cache files, by file path. A file stays mapped while interned
+// strings refer to its contents, so every save writes a brand new file,
+// never replacing a mapped one (which Windows doesn't allow anyway).
+static QHash<QString, InstrumentCacheMap *> g_cacheMaps;
+static QString g_sCacheDir;
+static QMutex  g_cacheMutex;    // Files may be loaded on worker threads.
+
+
+// Cache writer helper.
+class InstrumentCacheWriter
+{
+public:
+
+	typedef QHash<const void *, quint32> DataIds;
+
+	void word(quint32 iWord)
+		{ m_data.append(iWord); }
+
+	quint32 string(const QString& s)
+	{
+		QHash<QString, quint32>::ConstIterator it = m_index.constFind(s);
+		if (it != m_index.constEnd())
+			return it.value();
+		const quint32 iIndex = m_strings.count();
+		m_index.insert(s, iIndex);
+		m_strings.append(s);
+		return iIndex;
+	}
+
+	void dataList(const InstrumentDataList& list, DataIds& ids)
+	{
+		word(list.count());
+		InstrumentDataList::ConstIterator it;
+		for (it = list.constBegin(); it != list.constEnd(); ++it) {
+			const InstrumentData& data = it.value();
+			const quint32 iKey = string(it.key());
+			ids.insert(data.dataId(), iKey);
+			word(iKey);
+			word(string(data.name()));
+			word(string(data.basedOn()));
+			word(data.count());
+			InstrumentData::ConstIterator dit;
+			for (dit = data.constBegin(); dit != data.constEnd(); ++dit) {
+				word(quint32(dit.key()));
+				word(string(dit.value()));
+			}
+		}
+	}
+
+	void dataRef(const DataIds& ids, const InstrumentData& data)
+		{ word(ids.value(data.dataId(), c_iCacheNone)); }
+
+	QVector<quint32> m_data;
+	QList<QString> m_strings;
+
+private:
+
+	QHash<QString, quint32> m_index;
+};
+
+
+// Cache reader helper: every access is bounds checked, any
+// inconsistency just invalidates the whole cache.
+class InstrumentCacheReader
+{
+public:
+
+	InstrumentCacheReader(const uchar *pBase, const quint32 *pData,
+		quint32 iCount, const quint32 *pTable, quint32 iStrings )
+		: m_pBase(pBase), m_pData(pData), m_pEnd(pData + iCount),
+		  m_pTable(pTable), m_iStrings(iStrings), m_bOk(true) {}
+
+	bool isOk() const { return m_bOk; }
+
+	quint32 word()
+	{
+		if (m_pData < m_pEnd)
+			return *m_pData++;
+		m_bOk = false;
+		return 0;
+	}
+
+	int number() { return int(word()); }
+
+	// Item count, which can't exceed the remaining words.
+	quint32 count()
+	{
+		const quint32 iCount = word();
+		if (iCount > quint32(m_pEnd - m_pData)) {
+			m_bOk = false;
+			return 0;
+		}
+		return iCount;
+	}
+
+	QString string(quint32 iIndex)
+	{
+		if (iIndex >= m_iStrings) {
+			m_bOk = false;
+			return QString();
+		}
+		return QString::fromRawData(
+			reinterpret_cast<const QChar *> (m_pBase + m_pTable[iIndex * 2]),
+			int(m_pTable[iIndex * 2 + 1]));
+	}
+
+	QString string() { return string(word()); }
+
+	// Deep copy, for strings kept out of the interned pool.
+	QString copy(quint32 iIndex)
+	{
+		const QString s = string(iIndex);
+		return QString(s.unicode(), s.length());
+	}
+
+	QString copy() { return copy(word()); }
+
+	void dataList(InstrumentDataList& list)
+	{
+		const quint32 iCount = count();
+		for (quint32 i = 0; i < iCount && m_bOk; ++i) {
+			InstrumentData& data = list[copy()];
+			data.setName(string());
+			data.setBasedOn(string());
+			const quint32 iItems = count();
+			for (quint32 j = 0; j < iItems && m_bOk; ++j) {
+				const int iKey = number();
+				data.setValue(iKey, string());
+			}
+		}
+	}
+
+	// Returns a names list entry, or null when not referenced.
+	InstrumentData *dataRef(InstrumentDataList& list)
+	{
+		const quint32 iIndex = word();
+		if (iIndex == c_iCacheNone || !m_bOk)
+			return NULL;
+		const QString sKey = copy(iIndex);
+		return (m_bOk ? &list[sKey] : NULL);
+	}
+
+private:
+
+	const uchar   *m_pBase;
+	const quint32 *m_pData;
+	const quint32 *m_pEnd;
+	const quint32 *m_pTable;
+	quint32        m_iStrings;
+	bool           m_bOk;
+};
+
+
+// Mapped cache file lookup (with the cache mutex held): maps and checks
+// the file if needed; null when invalid or out of date.
+static InstrumentCacheMap *cacheMap (
+	const QString& sCache, qint64 iFileSize, qint64 iFileTime )
+{
+	InstrumentCacheMap *pMap = g_cacheMaps.value(sCache, NULL);
+	if (pMap) {
+		const InstrumentCacheHeader *pHeader = pMap->header();
+		return (pHeader->fileSize == iFileSize
+			&& pHeader->fileTime == iFileTime ? pMap : NULL);
+	}
+
+	pMap = new InstrumentCacheMap(sCache);
+	if (!pMap->map()) {
+		delete pMap;
+		return NULL;
+	}
+	// Check the header and the string table bounds.
+	const InstrumentCacheHeader *pHeader = pMap->header();
+	const qint64 iTableEnd = qint64(sizeof(InstrumentCacheHeader))
+		+ 4 * qint64(pHeader->dataCount) + 8 * qint64(pHeader->stringCount);
+	bool bValid = (::memcmp(pHeader->magic, c_szCacheMagic, 8) == 0
+		&& pHeader->version == c_iCacheVersion
+		&& pHeader->byteOrder == c_iCacheByteOrder
+		&& pHeader->fileSize == iFileSize
+		&& pHeader->fileTime == iFileTime
+		&& iTableEnd <= pMap->iSize);
+	const quint32 *pTable = pMap->table();
+	for (quint32 i = 0; bValid && i < pHeader->stringCount; ++i) {
+		const qint64 iOffset = pTable[i * 2];
+		const qint64 iLength = pTable[i * 2 + 1];
+		bValid = (iOffset >= iTableEnd && (iOffset & 1) == 0
+			&& iOffset + 2 * iLength <= pMap->iSize);
+	}
+	if (!bValid) {
+		delete pMap;
+		return NULL;
+	}
+	g_cacheMaps.insert(sCache, pMap);
+	return pMap;
+}
+
+
+// Unmap the cache files no interned string refers to anymore.
+void InstrumentList::releaseCaches (void)
+{
+	QMutexLocker locker(&g_cacheMutex);
+	QMutexLocker strings(&g_stringsMutex);
+	QHash<QString, InstrumentCacheMap *>::Iterator it = g_cacheMaps.begin();
+	while (it != g_cacheMaps.end()) {
+		InstrumentCacheMap *pMap = it.value();
+		bool bUsed = (pMap->iUsers > 0);
+		QSet<QString>::ConstIterator sit;
+		for (sit = g_strings.constBegin(); !bUsed && sit != g_strings.constEnd(); ++sit)
+			bUsed = pMap->contains(*sit);
+		if (bUsed) {
+			++it;
+		} else {
+			delete pMap;
+			it = g_cacheMaps.erase(it);
+		}
+	}
+}
+
+
+// Cache file name for the given instrument definitions file.
+QString InstrumentList::cacheFileName ( const QString& sFilename )
+{
+	QMutexLocker locker(&g_cacheMutex);
+	if (g_sCacheDir.isNull()) {
+		g_sCacheDir = QDesktopServices::storageLocation(
+			QDesktopServices::CacheLocation);
+		if (g_sCacheDir.isNull())
+			g_sCacheDir = "";
+	}
+	if (g_sCacheDir.isEmpty())
+		return QString();
+
+	const QByteArray hash = QCryptographicHash::hash(
+		QFileInfo(sFilename).absoluteFilePath().toUtf8(),
+		QCryptographicHash::Md5).toHex();
+
+	return QDir(g_sCacheDir).filePath("instruments-" + QString::fromLatin1(hash) + ".cache");
+}
+
+
+// Cache load method: fails unless up to date with the source file.
+bool InstrumentList::loadCache ( const QString& sFilename )
+{
+	const QString sCache = cacheFileName(sFilename);
+	if (sCache.isEmpty())
+		return false;
+
+	const QFileInfo info(sFilename);
+	const QString sPath = info.absoluteFilePath();
+	const qint64 iFileSize = info.size();
+	const qint64 iFileTime = info.lastModified().toMSecsSinceEpoch();
+
+	// Every save writes a new file: take the newest valid one, reusing
+	// its mapping when already there.
+	const QFileInfo cache(sCache);
+	const QDir dir = cache.dir();
+	const QStringList caches = dir.entryList(
+		QStringList(cache.fileName() + '*'), QDir::Files, QDir::Time);
+	QMutexLocker locker(&g_cacheMutex);
+	InstrumentCacheMap *pMap = NULL;
+	QStringList::ConstIterator cit;
+	for (cit = caches.constBegin(); pMap == NULL && cit != caches.constEnd(); ++cit)
+		pMap = cacheMap(dir.filePath(*cit), iFileSize, iFileTime);
+	if (pMap == NULL)
+		return false;
+
+	const InstrumentCacheHeader *pHeader = pMap->header();
+	InstrumentCacheReader reader(pMap->pBase, pMap->data(),
+		pHeader->dataCount, pMap->table(), pHeader->stringCount);
+
+	// A different file hashed to the same cache name?
+	if (reader.string(pHeader->filePath) != sPath)
+		return false;
+
+	// Not to be released while reading.
+	pMap->iUsers++;
+	locker.unlock();
+
+	// Names data lists...
+	reader.dataList(m_patches);
+	reader.dataList(m_notes);
+	reader.dataList(m_controllers);
+	reader.dataList(m_rpns);
+	reader.dataList(m_nrpns);
+
+	// Instrument definitions...
+	const quint32 iInstruments = reader.count();
+	for (quint32 i = 0; i < iInstruments && reader.isOk(); ++i) {
+		Instrument& instr = (*this)[reader.copy()];
+		instr.setInstrumentName(reader.copy());
+		instr.setBankSelMethod(reader.number());
+		instr.setUsesNotesAsControllers(reader.word() != 0);
+		InstrumentData *pData;
+		const quint32 iPatches = reader.count();
+		for (quint32 j = 0; j < iPatches && reader.isOk(); ++j) {
+			const int iBank = reader.number();
+			if ((pData = reader.dataRef(m_patches)) != NULL)
+				instr.setPatch(iBank, *pData);
+		}
+		if ((pData = reader.dataRef(m_controllers)) != NULL)
+			instr.setControl(*pData);
+		if ((pData = reader.dataRef(m_rpns)) != NULL)
+			instr.setRpn(*pData);
+		if ((pData = reader.dataRef(m_nrpns)) != NULL)
+			instr.setNrpn(*pData);
+		const quint32 iKeys = reader.count();
+		for (quint32 j = 0; j < iKeys && reader.isOk(); ++j) {
+			const int iBank = reader.number();
+			const quint32 iNotes = reader.count();
+			for (quint32 k = 0; k < iNotes && reader.isOk(); ++k) {
+				const int iProg = reader.number();
+				if ((pData = reader.dataRef(m_notes)) != NULL)
+					instr.setNotes(iBank, iProg, *pData);
+			}
+		}
+		const quint32 iDrums = reader.count();
+		for (quint32 j = 0; j < iDrums && reader.isOk(); ++j) {
+			const int iBank = reader.number();
+			const quint32 iFlags = reader.count();
+			for (quint32 k = 0; k < iFlags && reader.isOk(); ++k) {
+				const int iProg = reader.number();
+				instr.setDrum(iBank, iProg, reader.word() != 0);
+			}
+		}
+	}
+
+	locker.relock();
+	pMap->iUsers--;
+	locker.unlock();
+
+	if (!reader.isOk()) {
+		qWarning("%s: Corrupt instrument cache.", sCache.toUtf8().constData());
+		// Leave the list as empty as it was.
+		clear();
+		m_patches.clear();
+		m_notes.clear();
+		m_controllers.clear();
+		m_rpns.clear();
+		m_nrpns.clear();
+		return false;
+	}
+
+	return true;
+}
+
+
+// Cache save method.
+bool InstrumentList::saveCache ( const QString& sFilename ) const
+{
+	const QString sCache = cacheFileName(sFilename);
+	if (sCache.isEmpty() || !QDir().mkpath(QFileInfo(sCache).absolutePath()))
+		return false;
+
+	const QFileInfo info(sFilename);
+
+	InstrumentCacheWriter writer;
+	InstrumentCacheWriter::DataIds patches, notes, controllers, rpns, nrpns;
+	const quint32 iFilePath = writer.string(info.absoluteFilePath());
+
+	// Names data lists...
+	writer.dataList(m_patches, patches);
+	writer.dataList(m_notes, notes);
+	writer.dataList(m_controllers, controllers);
+	writer.dataList(m_rpns, rpns);
+	writer.dataList(m_nrpns, nrpns);
+
+	// Instrument definitions...
+	writer.word(count());
+	InstrumentList::ConstIterator iter;
+	for (iter = constBegin(); iter != constEnd(); ++iter) {
+		const Instrument& instr = iter.value();
+		writer.word(writer.string(iter.key()));
+		writer.word(writer.string(instr.instrumentName()));
+		writer.word(quint32(instr.bankSelMethod()));
+		writer.word(instr.usesNotesAsControllers() ? 1 : 0);
+		writer.word(instr.patches().count());
+		InstrumentPatches::ConstIterator pit;
+		for (pit = instr.patches().constBegin();
+				pit != instr.patches().constEnd(); ++pit) {
+			writer.word(quint32(pit.key()));
+			writer.dataRef(patches, pit.value());
+		}
+		writer.dataRef(controllers, instr.control());
+		writer.dataRef(rpns, instr.rpn());
+		writer.dataRef(nrpns, instr.nrpn());
+		writer.word(instr.keys().count());
+		InstrumentKeys::ConstIterator kit;
+		for (kit = instr.keys().constBegin(); kit != instr.keys().constEnd(); ++kit) {
+			writer.word(quint32(kit.key()));
+			writer.word(kit.value().count());
+			InstrumentNotes::ConstIterator nit;
+			for (nit = kit.value().constBegin(); nit != kit.value().constEnd(); ++nit) {
+				writer.word(quint32(nit.key()));
+				writer.dataRef(notes, nit.value());
+			}
+		}
+		writer.word(instr.drums().count());
+		InstrumentDrums::ConstIterator dit;
+		for (dit = instr.drums().constBegin(); dit != instr.drums().constEnd(); ++dit) {
+			writer.word(quint32(dit.key()));
+			writer.word(dit.value().count());
+			InstrumentDrumFlags::ConstIterator fit;
+			for (fit = dit.value().constBegin(); fit != dit.value().constEnd(); ++fit) {
+				writer.word(quint32(fit.key()));
+				writer.word(fit.value() ? 1 : 0);
+			}
+		}
+	}
+
+	// Header...
+	InstrumentCacheHeader header;
+	::memcpy(header.magic, c_szCacheMagic, 8);
+	header.version     = c_iCacheVersion;
+	header.byteOrder   = c_iCacheByteOrder;
+	header.fileSize    = info.size();
+	header.fileTime    = info.lastModified().toMSecsSinceEpoch();
+	header.filePath    = iFilePath;
+	header.dataCount   = writer.m_data.count();
+	header.stringCount = writer.m_strings.count();
+	header.reserved    = 0;
+
+	// String table, followed by the pool itself.
+	QVector<quint32> table;
+	table.reserve(2 * writer.m_strings.count());
+	quint32 iOffset = sizeof(header)
+		+ 4 * writer.m_data.count() + 8 * writer.m_strings.count();
+	QList<QString>::ConstIterator sit;
+	for (sit = writer.m_strings.constBegin();
+			sit != writer.m_strings.constEnd(); ++sit) {
+		table.append(iOffset);
+		table.append(sit->length());
+		iOffset += 2 * sit->length();
+	}
+
+	// Write a new file, so any previous mapping (maybe from another
+	// instance) keeps its contents.
+	QTemporaryFile file(sCache + ".XXXXXX");
+	file.setAutoRemove(false);
+	if (!file.open())
+		return false;
+	bool bOk = (file.write((const char *) &header, sizeof(header)) == sizeof(header));
+	bOk = bOk && file.write((const char *) writer.m_data.constData(),
+		4 * writer.m_data.count()) == 4 * writer.m_data.count();
+	bOk = bOk && file.write((const char *) table.constData(),
+		4 * table.count()) == 4 * table.count();
+	for (sit = writer.m_strings.constBegin();
+			bOk && sit != writer.m_strings.constEnd(); ++sit) {
+		bOk = file.write((const char *) sit->constData(),
+			2 * sit->length()) == 2 * sit->length();
+	}
+	file.close();
+
+	if (!bOk) {
+		file.remove();
+		return false;
+	}
+
+	// Drop the older files not mapped here; those mapped by another
+	// instance can't be removed on Windows, a later save will do.
+	const QFileInfo cache(sCache);
+	const QDir dir = cache.dir();
+	const QString sNew = QFileInfo(file.fileName()).fileName();
+	const QStringList caches = dir.entryList(
+		QStringList(cache.fileName() + '*'), QDir::Files);
+	QMutexLocker locker(&g_cacheMutex);
+	QStringList::ConstIterator cit;
+	for (cit = caches.constBegin(); cit != caches.constEnd(); ++cit) {
+		const QString sOld = dir.filePath(*cit);
+		if (*cit != sNew && !g_cacheMaps.contains(sOld))
+			QFile::remove(sOld);
+	}
+
+	return true;
+}
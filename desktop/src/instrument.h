@@ -40,6 +40,7 @@ class InstrumentData
 {
 public:
 
+	// Names outside of the dense 0..127 range.
 	typedef QMap<int, QString> DataMap;
 
 	// Constructor.
@@ -62,32 +63,75 @@ public:
 		return *this;
 	}
 
-	// Accessor operator.
-	QString& operator[] (int iIndex) const
-		{ return m_pData->map[iIndex]; }
+	// Accessor operator (a null string when not found).
+	const QString& operator[] (int iIndex) const;
+
+	// Value (interned) modifier.
+	void setValue(int iIndex, const QString& sValue);
 
 	// Property accessors.
 	void setName(const QString& sName)
-		{ m_pData->name = sName; }
+		{ m_pData->name = intern(sName); }
 	const QString& name() const { return m_pData->name; }
 
 	void setBasedOn(const QString& sBasedOn)
-		{ m_pData->basedOn = sBasedOn; }
+		{ m_pData->basedOn = intern(sBasedOn); }
 	const QString& basedOn() const { return m_pData->basedOn; }
 
-	// Indirect iterator stuff.
-	typedef DataMap::Iterator Iterator;
-	Iterator begin() { return m_pData->map.begin(); }
-	Iterator end()   { return m_pData->map.end(); }
+	// Ascending key order iterator, over dense and sparse entries.
+	class ConstIterator
+	{
+	public:
+
+		ConstIterator()
+			: m_pDense(NULL), m_pPresent(NULL), m_iDense(-1) {}
+
+		int key() const
+			{ return (m_iDense < 0 ? m_sparse.key() : m_iDense); }
+		const QString& value() const
+			{ return (m_iDense < 0 ? m_sparse.value() : m_pDense[m_iDense]); }
+		const QString& operator* () const
+			{ return value(); }
+
+		ConstIterator& operator++ ();
+
+		bool operator== (const ConstIterator& it) const
+			{ return (m_iDense == it.m_iDense && m_sparse == it.m_sparse); }
+		bool operator!= (const ConstIterator& it) const
+			{ return !operator==(it); }
+
+	private:
+
+		friend class InstrumentData;
 
-	typedef DataMap::ConstIterator ConstIterator;
-	ConstIterator constBegin() const { return m_pData->map.constBegin(); }
-	ConstIterator constEnd()   const { return m_pData->map.constEnd(); }
+		// Move to the first dense entry from the given key on.
+		void nextDense(int iKey);
 
-	unsigned int count() const { return m_pData->map.count(); }
+		const QString *m_pDense;
+		const quint32 *m_pPresent;
+		DataMap::ConstIterator m_sparse;
+		DataMap::ConstIterator m_sparseEnd;
+		int m_iDense;
+	};
+
+	ConstIterator constBegin() const;
+	ConstIterator constEnd() const;
+
+	unsigned int count() const { return m_pData->count; }
 
 	bool contains(int iKey) const
-		{ return m_pData->map.contains(iKey); }
+	{
+		if (iKey >= 0 && iKey < 128)
+			return (m_pData->present[iKey >> 5] & (1U << (iKey & 31))) != 0;
+		return m_pData->sparse.contains(iKey);
+	}
+
+	// Shared payload identity (to tell list entries apart).
+	const void *dataId() const { return m_pData; }
+
+	// Global string intern pool.
+	static QString intern(const QString& s);
+	static void squeezeStrings();
 
 protected:
 
@@ -104,12 +148,18 @@ private:
 	struct DataRef
 	{
 		// Default payload constructor.
-		DataRef() : refCount(1) {};
+		DataRef() : refCount(1), count(0), dense(NULL)
+			{ present[0] = present[1] = present[2] = present[3] = 0; }
+		// Payload destructor.
+		~DataRef() { delete [] dense; }
 		// Payload members.
-		int     refCount;
-		QString name;
-		QString basedOn;
-		DataMap map;
+		int      refCount;
+		QString  name;
+		QString  basedOn;
+		unsigned int count;
+		quint32  present[4];    // Dense entries bit mask.
+		QString *dense;         // Keys 0..127, allocated on demand.
+		DataMap  sparse;
 
 	} * m_pData;
 };
@@ -289,7 +339,7 @@ public:
 	// Patch Names definition accessors.
 	const InstrumentDataList& patches() const
 		{ return m_patches; }
-	const InstrumentData& patch(const QString& sName)
+	InstrumentData& patch(const QString& sName)
 		{ return m_patches[sName]; }
 
 	// Note Names definition accessors.
@@ -328,6 +378,15 @@ protected:
 	void saveDataList(QTextStream& ts, const InstrumentDataList& list);
 	void saveData(QTextStream& ts, const InstrumentData& data);
 
+	// Plain Cakewalk .ins file parser.
+	bool parse(const QString& sFilename);
+
+	// Binary cache of a parsed file, keyed by path, size and mtime.
+	bool loadCache(const QString& sFilename);
+	bool saveCache(const QString& sFilename) const;
+	static QString cacheFileName(const QString& sFilename);
+	static void releaseCaches();
+
 	// Special instrument data list merge method.
 	void mergeDataList(InstrumentDataList& dst,
 		const InstrumentDataList& src);
@@ -0,0 +1,89 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "instrumentloader.h"
+#include <QtConcurrentMap>
+
+static InstrumentList loadInstrumentFile(const QString& fileName)
+{
+    InstrumentList list;
+    list.load(fileName);
+    return list;
+}
+
+InstrumentLoader::InstrumentLoader(QObject *parent) : QObject(parent)
+{
+    m_watcher = new QFutureWatcher<InstrumentList>(this);
+    connect(m_watcher, SIGNAL(progressValueChanged(int)), SLOT(slotProgress(int)));
+    connect(m_watcher, SIGNAL(finished()), SLOT(slotFinished()));
+}
+
+InstrumentLoader::~InstrumentLoader()
+{
+    cancel();
+}
+
+void InstrumentLoader::load(const QStringList& files)
+{
+    cancel();
+    m_files = files;
+    m_failed.clear();
+    m_instruments.clearAll();
+    m_watcher->setFuture(QtConcurrent::mapped(m_files, loadInstrumentFile));
+}
+
+void InstrumentLoader::cancel()
+{
+    if (m_watcher->isRunning()) {
+        m_watcher->cancel();
+        m_watcher->waitForFinished();
+    }
+}
+
+bool InstrumentLoader::isRunning() const
+{
+    return m_watcher->isRunning();
+}
+
+void InstrumentLoader::slotProgress(int value)
+{
+    emit progress(value, m_files.count());
+}
+
+void InstrumentLoader::slotFinished()
+{
+    if (m_watcher->isCanceled())
+        return;
+    QFuture<InstrumentList> future = m_watcher->future();
+    for (int i = 0; i < m_files.count(); ++i) {
+        if (future.isResultReadyAt(i)) {
+            const InstrumentList& list = future.resultAt(i);
+            if (!list.files().isEmpty()) {
+                m_instruments.merge(list);
+                m_instruments.appendFile(m_files[i]);
+                continue;
+            }
+        }
+        m_failed.append(m_files[i]);
+        qWarning("%s: Cannot load instrument definitions.",
+                 m_files[i].toUtf8().constData());
+    }
+    // Drop the per-file lists, now merged, on this thread.
+    m_watcher->setFuture(QFuture<InstrumentList>());
+    emit finished();
+}
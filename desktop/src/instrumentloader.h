@@ -0,0 +1,66 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INSTRUMENTLOADER_H
+#define INSTRUMENTLOADER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QFutureWatcher>
+#include "instrument.h"
+
+/**
+ * Loads a set of instrument definition files in the background.
+ *
+ * Every file is parsed on the global thread pool into its own
+ * InstrumentList. When all of them are done, the lists are merged in
+ * the given file order, so a later file always overrides the instrument
+ * definitions of an earlier one, regardless of which finished first.
+ */
+class InstrumentLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit InstrumentLoader(QObject *parent = 0);
+    virtual ~InstrumentLoader();
+
+    void load(const QStringList& files);
+    void cancel();
+    bool isRunning() const;
+
+    const QStringList& files() const { return m_files; }
+    const QStringList& failedFiles() const { return m_failed; }
+    const InstrumentList& instruments() const { return m_instruments; }
+
+signals:
+    void progress(int done, int total);
+    void finished();
+
+private slots:
+    void slotProgress(int value);
+    void slotFinished();
+
+private:
+    QFutureWatcher<InstrumentList> *m_watcher;
+    QStringList m_files;
+    QStringList m_failed;
+    InstrumentList m_instruments;
+};
+
+#endif // INSTRUMENTLOADER_H
@@ -131,6 +131,32 @@ void KeyboardMap::copyFrom(const KeyboardMap* other)
         insert(it.key(), it.value());
 }
 
+void KeyNoteTable::clear()
+{
+    for (int i = 0; i < 512; ++i)
+        m_notes[i] = -1;
+    m_map = NULL;
+    m_overflow = false;
+}
+
+void KeyNoteTable::build(const KeyboardMap* map)
+{
+    clear();
+    if (map == NULL)
+        return;
+    m_map = map;
+    KeyboardMap::ConstIterator it;
+    for(it = map->constBegin(); it != map->constEnd(); ++it) {
+        if (it.value() < 0 || it.value() > 127)
+            continue;
+        int idx = index(it.key());
+        if (idx >= 0)
+            m_notes[idx] = it.value();
+        else
+            m_overflow = true;
+    }
+}
+
 void KeyboardMap::reportError( const QString filename,
                                const QString title,
                                const QString err )
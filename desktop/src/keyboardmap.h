@@ -45,4 +45,44 @@ private:
     bool m_rawMode;
 };
 
+/**
+ * Dense key to note table compiled from a KeyboardMap, for the per
+ * keystroke lookups. Keys 0x00..0xff (native scan codes of a raw map,
+ * or the Latin-1 Qt key codes) are stored at 0..255, and the Qt function
+ * keys (Qt::Key_Escape and up, 0x01000000..0x010000ff) are folded into
+ * 256..511. The few mapped keys outside those ranges, if any, are still
+ * looked up in the map itself.
+ */
+class KeyNoteTable
+{
+public:
+    KeyNoteTable() : m_map(NULL), m_overflow(false) { clear(); }
+    void build(const KeyboardMap* map);
+    void clear();
+
+    int note(const int key) const
+    {
+        int idx = index(key);
+        if (idx >= 0)
+            return m_notes[idx];
+        if (m_overflow)
+            return m_map->value(key, -1);
+        return -1;
+    }
+
+private:
+    static int index(const int key)
+    {
+        if (key >= 0 && key < 0x100)
+            return key;
+        if (key >= Qt::Key_Escape && key <= (Qt::Key_Escape | 0xff))
+            return 0x100 + (key & 0xff);
+        return -1;
+    }
+
+    qint8 m_notes[512];
+    const KeyboardMap* m_map;
+    bool m_overflow;
+};
+
 #endif /* KEYBOARDMAP_H */
@@ -18,6 +18,7 @@
 
 #include "constants.h"
 #include "vpiano.h"
+#include "startupprofile.h"
 #if defined(RAWKBD_SUPPORT)
 #include "rawkeybdapp.h"
 #endif
@@ -32,6 +33,7 @@
 
 int main(int argc, char *argv[])
 {
+    StartupProfile::start(argc, argv);
     QCoreApplication::setOrganizationName(QSTR_DOMAIN);
     QCoreApplication::setOrganizationDomain(QSTR_DOMAIN);
     QCoreApplication::setApplicationName(QSTR_APPNAME);
@@ -52,6 +54,7 @@ int main(int argc, char *argv[])
         }
     );
 #endif //Q_OS_SYMBIAN
+    StartupProfile::phase("application");
     VPiano w;
     if (w.isInitialized()) {
 #if defined(SMALL_SCREEN)
@@ -0,0 +1,190 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QMutexLocker>
+#include <QDebug>
+#include "midiclock.h"
+#include "mididefs.h"
+#include "RtMidi.h"
+
+#if defined(Q_OS_LINUX)
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* the longest sleep, so a stop request is noticed promptly */
+const qint64 SLEEP_SLICE = 10000000;
+/* the final stretch before a deadline, waited for without slicing
+   (busy waited where there is no absolute time sleep) */
+const qint64 SPIN_TIME = 1000000;
+const qint64 NSECS_PER_SEC = Q_INT64_C(1000000000);
+
+MidiClock::MidiClock(QObject *parent) : QThread(parent),
+    m_out(0),
+    m_outMutex(0),
+    m_tempo(0),
+    m_stop(false),
+    m_resume(false),
+    m_clocks(0)
+{
+    setTempo(120.0);
+}
+
+MidiClock::~MidiClock()
+{
+    stop();
+}
+
+void MidiClock::setOutput(RtMidiOut *out, QMutex *outMutex)
+{
+    stop();
+    m_out = out;
+    m_outMutex = outMutex;
+}
+
+void MidiClock::setTempo(double bpm)
+{
+    m_tempo = qBound(20.0, bpm, 300.0);
+    m_period = int(60.0 * NSECS_PER_SEC / (m_tempo * 24.0));
+}
+
+void MidiClock::play()
+{
+    stop();
+    if (m_out == 0)
+        return;
+    m_clocks = 0;
+    m_resume = false;
+    m_stop = false;
+    start(QThread::TimeCriticalPriority);
+}
+
+void MidiClock::cont()
+{
+    if (isRunning() || m_out == 0)
+        return;
+    m_resume = true;
+    m_stop = false;
+    start(QThread::TimeCriticalPriority);
+}
+
+void MidiClock::stop()
+{
+    if (isRunning()) {
+        m_stop = true;
+        wait();
+    }
+}
+
+#if defined(Q_OS_LINUX)
+qint64 MidiClock::now() const
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * NSECS_PER_SEC + ts.tv_nsec;
+}
+
+void MidiClock::sleepUntil(qint64 deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / NSECS_PER_SEC;
+    ts.tv_nsec = deadline % NSECS_PER_SEC;
+    while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+        ;
+}
+#else
+qint64 MidiClock::now() const
+{
+    return m_clock.nsecsElapsed();
+}
+
+void MidiClock::sleepUntil(qint64 deadline)
+{
+    qint64 wait = deadline - now();
+    if (wait > SPIN_TIME)
+        QThread::usleep((wait - SPIN_TIME) / 1000);
+    while (now() < deadline)
+        ;
+}
+#endif
+
+void MidiClock::send(unsigned char status, int data1, int data2)
+{
+    std::vector<unsigned char> message;
+    message.push_back(status);
+    if (data1 >= 0)
+        message.push_back(data1 & MASK_SAFETY);
+    if (data2 >= 0)
+        message.push_back(data2 & MASK_SAFETY);
+    QMutexLocker locker(m_outMutex);
+    try {
+        m_out->sendMessage(&message);
+    } catch (RtError& err) {
+        qWarning() << QString::fromStdString(err.getMessage());
+    }
+}
+
+void MidiClock::run()
+{
+#if defined(Q_OS_LINUX)
+    // real time scheduling, when the user is allowed to; otherwise the
+    // thread keeps the priority given by QThread::start()
+    struct sched_param param;
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+    ::pthread_setschedparam(::pthread_self(), SCHED_FIFO, &param);
+#else
+    m_clock.start();
+#endif
+    if (m_resume) {
+        // resume on a MIDI beat (sixteenth note) boundary
+        int beats = qMin(m_clocks / 6, 0x3fff);
+        m_clocks = beats * 6;
+        send(STATUS_SONGPOS, CALC_LSB(beats), CALC_MSB(beats));
+        send(STATUS_CONTINUE);
+    } else {
+        send(STATUS_START);
+    }
+    qint64 next = now();
+    qint64 reported = next;
+    qint64 lateSum = 0, lateMax = 0;
+    int count = 0;
+    while (!m_stop) {
+        next += int(m_period);
+        // sleep in slices, then wait for the exact deadline
+        while (!m_stop && next - now() > SLEEP_SLICE + SPIN_TIME)
+            sleepUntil(now() + SLEEP_SLICE);
+        if (m_stop)
+            break;
+        sleepUntil(next);
+        send(STATUS_CLOCK);
+        qint64 late = now() - next;
+        m_clocks++;
+        lateSum += late;
+        lateMax = qMax(lateMax, late);
+        count++;
+        if (next - reported >= NSECS_PER_SEC) {
+            emit jitter(lateSum / 1e6 / count, lateMax / 1e6);
+            reported = next;
+            lateSum = lateMax = 0;
+            count = 0;
+        }
+    }
+    send(STATUS_STOP);
+}
@@ -0,0 +1,85 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MIDICLOCK_H
+#define MIDICLOCK_H
+
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+class RtMidiOut;
+
+/**
+ * MIDI clock master.
+ *
+ * A dedicated thread sends 24 Timing Clock messages per quarter note,
+ * preceded by Start, or by Song Position Pointer and Continue when the
+ * transport resumes, and followed by Stop. Every clock has an absolute
+ * deadline computed from the previous one, so sleeping and sending
+ * latencies never accumulate into tempo drift; tempo changes take effect
+ * from the next clock. The lateness of each clock against its deadline is
+ * measured and reported once per second.
+ *
+ * The output port is shared with the GUI thread; both serialize their
+ * sends with the mutex given to setOutput().
+ */
+class MidiClock : public QThread
+{
+    Q_OBJECT
+
+public:
+    MidiClock(QObject *parent = 0);
+    virtual ~MidiClock();
+
+    void setOutput(RtMidiOut *out, QMutex *outMutex);
+    double tempo() const { return m_tempo; }
+    int songPosition() const { return m_clocks / 6; }
+    bool isPlaying() const { return isRunning(); }
+
+public slots:
+    void setTempo(double bpm);
+    void play();
+    void stop();
+    void cont();
+
+signals:
+    void jitter(double meanMs, double maxMs);
+
+protected:
+    void run();
+
+private:
+    qint64 now() const;
+    void sleepUntil(qint64 deadline);
+    void send(unsigned char status, int data1 = -1, int data2 = -1);
+
+    RtMidiOut *m_out;
+    QMutex *m_outMutex;
+    double m_tempo;
+    QAtomicInt m_period;  // nanoseconds per clock
+    volatile bool m_stop;
+    bool m_resume;
+    int m_clocks;         // position, in clocks since the song start
+#if !defined(Q_OS_LINUX)
+    QElapsedTimer m_clock;
+#endif
+};
+
+#endif // MIDICLOCK_H
@@ -36,6 +36,11 @@
 #define STATUS_PROGRAM    0xC0
 #define STATUS_CHANAFT    0xD0
 #define STATUS_BENDER     0xE0
+#define STATUS_SONGPOS    0xF2
+#define STATUS_CLOCK      0xF8
+#define STATUS_START      0xFA
+#define STATUS_CONTINUE   0xFB
+#define STATUS_STOP       0xFC
 
 #define BENDER_MIN       -8192
 #define BENDER_MAX        8191
@@ -0,0 +1,192 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "midimerger.h"
+#include "mididefs.h"
+#include "RtMidi.h"
+
+/* the age a message must reach before it is delivered, so a message
+   stamped earlier on another port is published in time to go first */
+const qint64 REORDER_WINDOW = 1000000;
+/* the longest wait for new messages, so a stop request is noticed */
+const int IDLE_TIMEOUT = 100;
+
+static inline int loadAcquire(QAtomicInt &value)
+{
+    return value.fetchAndAddAcquire(0);
+}
+
+static inline void storeRelease(QAtomicInt &value, int newValue)
+{
+    value.fetchAndStoreRelease(newValue);
+}
+
+MidiMerger::MidiMerger(QObject *parent) : QThread(parent),
+    m_callback(0),
+    m_userData(0),
+    m_stop(false)
+{
+    m_clock.start();
+}
+
+MidiMerger::~MidiMerger()
+{
+    removePorts();
+}
+
+void MidiMerger::setCallback(MergeCallback callback, void *userData)
+{
+    m_callback = callback;
+    m_userData = userData;
+}
+
+/*
+ * The port takes over the callback of the input, which must not have one.
+ * Ports are added and removed while the merger is stopped.
+ */
+int MidiMerger::addPort(RtMidiIn *input, int channel)
+{
+    Port *port = new Port;
+    port->merger = this;
+    port->input = input;
+    port->id = m_ports.count();
+    port->channel = channel;
+    m_ports.append(port);
+    input->setCallback(&MidiMerger::inputCallback, port);
+    return port->id;
+}
+
+/*
+ * The driver thread of an input keeps calling back into its port until the
+ * input is deleted or given another callback, which the owner of the
+ * inputs must do before the ports are removed.
+ */
+void MidiMerger::removePorts()
+{
+    stopMerging();
+    qDeleteAll(m_ports);
+    m_ports.clear();
+}
+
+RtMidiIn *MidiMerger::port(int id) const
+{
+    return m_ports.value(id)->input;
+}
+
+int MidiMerger::channelMap(int id) const
+{
+    return m_ports.value(id)->channel;
+}
+
+MidiMerger::PortStatistics MidiMerger::statistics(int id) const
+{
+    PortStatistics stats;
+    Port *port = m_ports.value(id);
+    stats.received = port->received;
+    stats.dropped = port->dropped;
+    stats.maxDelay = int(port->maxDelay) / 1000.0;
+    return stats;
+}
+
+void MidiMerger::startMerging()
+{
+    stopMerging();
+    if (m_ports.isEmpty() || m_callback == 0)
+        return;
+    m_stop = false;
+    start(QThread::TimeCriticalPriority);
+}
+
+void MidiMerger::stopMerging()
+{
+    if (isRunning()) {
+        m_stop = true;
+        m_pending.release();
+        wait();
+    }
+}
+
+void MidiMerger::inputCallback(double /*deltatime*/,
+                               std::vector<unsigned char> *message,
+                               void *userData)
+{
+    Port *port = static_cast<Port*>(userData);
+    port->merger->push(port, message);
+}
+
+void MidiMerger::push(Port *port, const std::vector<unsigned char> *message)
+{
+    int head = port->head;
+    int next = (head + 1) % RING_SIZE;
+    port->received.fetchAndAddRelaxed(1);
+    if (message->empty() || message->size() > 3 ||
+        next == loadAcquire(port->tail)) {
+        port->dropped.fetchAndAddRelaxed(1);
+        return;
+    }
+    Event &ev = port->ring[head];
+    ev.time = m_clock.nsecsElapsed();
+    ev.size = message->size();
+    for (int i = 0; i < ev.size; ++i)
+        ev.data[i] = message->at(i);
+    storeRelease(port->head, next);
+    m_pending.release();
+}
+
+void MidiMerger::deliver(Port *port, const Event &ev)
+{
+    std::vector<unsigned char> message(ev.data, ev.data + ev.size);
+    unsigned char status = message[0];
+    if (port->channel >= 0 && status >= STATUS_NOTEOFF && status < 0xf0)
+        message[0] = (status & MASK_STATUS) | (port->channel & MASK_CHANNEL);
+    int delay = int((m_clock.nsecsElapsed() - ev.time) / 1000);
+    if (delay > port->maxDelay)
+        port->maxDelay = delay;
+    m_callback(port->id, &message, m_userData);
+}
+
+void MidiMerger::run()
+{
+    while (!m_stop) {
+        Port *oldest = 0;
+        qint64 oldestTime = 0;
+        foreach(Port *port, m_ports) {
+            int tail = port->tail;
+            if (tail == loadAcquire(port->head))
+                continue;
+            qint64 time = port->ring[tail].time;
+            if (oldest == 0 || time < oldestTime) {
+                oldest = port;
+                oldestTime = time;
+            }
+        }
+        if (oldest == 0) {
+            m_pending.tryAcquire(qMax(1, m_pending.available()), IDLE_TIMEOUT);
+            continue;
+        }
+        qint64 age = m_clock.nsecsElapsed() - oldestTime;
+        if (age < REORDER_WINDOW) {
+            usleep((REORDER_WINDOW - age) / 1000 + 1);
+            continue;
+        }
+        int tail = oldest->tail;
+        Event ev = oldest->ring[tail];
+        storeRelease(oldest->tail, (tail + 1) % RING_SIZE);
+        deliver(oldest, ev);
+    }
+}
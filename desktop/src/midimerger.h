@@ -0,0 +1,110 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MIDIMERGER_H
+#define MIDIMERGER_H
+
+#include <vector>
+#include <QThread>
+#include <QList>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QElapsedTimer>
+
+class RtMidiIn;
+
+/**
+ * Merges several MIDI input ports into one stream.
+ *
+ * Every port has its own lock-free ring, with the driver callback as the
+ * single producer, and every message is stamped on arrival with a clock
+ * shared by all the ports. The merger thread is the consumer of all the
+ * rings: it delivers the oldest head among them (a k-way merge), so the
+ * order of arrival is kept across ports. A head is delivered after a short
+ * reorder window, which covers a message already stamped on another port
+ * but not yet published in its ring.
+ *
+ * Each message is delivered tagged with the id of its port, after the
+ * optional channel mapping of that port. Channel and system messages are
+ * merged; System Exclusive is not.
+ */
+class MidiMerger : public QThread
+{
+    Q_OBJECT
+
+public:
+    typedef void (*MergeCallback)(int port, std::vector<unsigned char> *message, void *userData);
+
+    struct PortStatistics {
+        int received;
+        int dropped;
+        double maxDelay;  // milliseconds, from arrival to delivery
+    };
+
+    MidiMerger(QObject *parent = 0);
+    virtual ~MidiMerger();
+
+    void setCallback(MergeCallback callback, void *userData);
+    int addPort(RtMidiIn *input, int channel = -1);
+    void removePorts();
+    int portCount() const { return m_ports.count(); }
+    RtMidiIn *port(int id) const;
+    int channelMap(int id) const;
+    PortStatistics statistics(int id) const;
+
+    void startMerging();
+    void stopMerging();
+
+protected:
+    void run();
+
+private:
+    static const int RING_SIZE = 1024;
+
+    struct Event {
+        qint64 time;
+        int size;
+        unsigned char data[3];
+    };
+
+    struct Port {
+        MidiMerger *merger;
+        RtMidiIn *input;
+        int id;
+        int channel;
+        Event ring[RING_SIZE];
+        QAtomicInt head;      // written by the producer only
+        QAtomicInt tail;      // written by the consumer only
+        QAtomicInt received;
+        QAtomicInt dropped;
+        QAtomicInt maxDelay;  // microseconds
+    };
+
+    static void inputCallback(double deltatime, std::vector<unsigned char> *message, void *userData);
+    void push(Port *port, const std::vector<unsigned char> *message);
+    void deliver(Port *port, const Event &ev);
+
+    QList<Port*> m_ports;
+    MergeCallback m_callback;
+    void *m_userData;
+    QElapsedTimer m_clock;
+    QSemaphore m_pending;
+    volatile bool m_stop;
+};
+
+#endif // MIDIMERGER_H
@@ -16,7 +16,10 @@
     with this program; If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <QComboBox>
+#include <QTableWidgetItem>
 #include "midisetup.h"
+#include "constants.h"
 
 MidiSetup::MidiSetup(QWidget *parent) : QDialog(parent)
 {
@@ -179,6 +182,54 @@ QString MidiSetup::selectedOutputName() const
         return QString();
 }
 
+void MidiSetup::clearMergeInputs()
+{
+    ui.tableMerge->setRowCount(0);
+}
+
+void MidiSetup::addMergeInput(const QString& name, bool merged, int channel, const QString& statistics)
+{
+    int row = ui.tableMerge->rowCount();
+    ui.tableMerge->insertRow(row);
+    QTableWidgetItem *item = new QTableWidgetItem(name);
+    item->setFlags(Qt::ItemIsEnabled | Qt::ItemIsUserCheckable);
+    item->setCheckState(merged ? Qt::Checked : Qt::Unchecked);
+    ui.tableMerge->setItem(row, 0, item);
+    QComboBox *combo = new QComboBox(ui.tableMerge);
+    combo->addItem(tr("Unchanged"), -1);
+    for (int i = 0; i < MIDICHANNELS; ++i)
+        combo->addItem(QString::number(i + 1), i);
+    combo->setCurrentIndex(channel + 1);
+    ui.tableMerge->setCellWidget(row, 1, combo);
+    item = new QTableWidgetItem(statistics);
+    item->setFlags(Qt::ItemIsEnabled);
+    ui.tableMerge->setItem(row, 2, item);
+    ui.tableMerge->resizeColumnsToContents();
+}
+
+QStringList MidiSetup::mergeInputNames() const
+{
+    QStringList names;
+    for (int row = 0; row < ui.tableMerge->rowCount(); ++row) {
+        QTableWidgetItem *item = ui.tableMerge->item(row, 0);
+        if (item->checkState() == Qt::Checked)
+            names += item->text();
+    }
+    return names;
+}
+
+QList<int> MidiSetup::mergeInputChannels() const
+{
+    QList<int> channels;
+    for (int row = 0; row < ui.tableMerge->rowCount(); ++row) {
+        if (ui.tableMerge->item(row, 0)->checkState() == Qt::Checked) {
+            QComboBox *combo = static_cast<QComboBox*>(ui.tableMerge->cellWidget(row, 1));
+            channels += combo->itemData(combo->currentIndex()).toInt();
+        }
+    }
+    return channels;
+}
+
 void MidiSetup::retranslateUi()
 {
     ui.retranslateUi(this);
@@ -21,6 +21,7 @@
 
 #include "ui_midisetup.h"
 #include <QDialog>
+#include <QStringList>
 
 class MidiSetup : public QDialog
 {
@@ -46,6 +47,10 @@ public:
     int  selectedOutput();
     QString selectedInputName() const;
     QString selectedOutputName() const;
+    void clearMergeInputs();
+    void addMergeInput(const QString& name, bool merged, int channel, const QString& statistics);
+    QStringList mergeInputNames() const;
+    QList<int> mergeInputChannels() const;
     void retranslateUi();
 
 public slots:
@@ -0,0 +1,502 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ *  vmpk-netload: load generator and receiver for the network UDP driver.
+ *
+ *  The traffic goes through the driver under test: NetMidiOut sends it,
+ *  and NetMidiIn receives it, one MIDI message per datagram. Both ends
+ *  build the same deterministic message stream from the pattern and seed,
+ *  so the receiver can detect lost and reordered messages without any
+ *  extra header in the datagrams.
+ *
+ *  Usage: vmpk-netload [--send|--receive|--loopback] [options]
+ *    --pattern notes|cc14|sysex|chords   traffic pattern (notes)
+ *    --count N          number of messages (10000)
+ *    --rate N           messages per second, 0 = unpaced (1000)
+ *    --size N           SysEx message size in bytes (256)
+ *    --channel N        MIDI channel, 1..16 (1)
+ *    --seed N           pseudo-random seed (1)
+ *    --address A        destination address (127.0.0.1)
+ *    --port N           UDP port (21928)
+ *    --receivers N      receivers on consecutive ports from --port (1);
+ *                       the sender fans out to all of them
+ *    --timeout MS       receiver idle timeout (2000)
+ *
+ *  The default --loopback mode runs the sender in a thread and the
+ *  receiver in the main thread, so latency is measured against the
+ *  actual send times, and the cpu usage is the one of the receiver
+ *  thread alone. A standalone receiver reports latency relative to the
+ *  schedule of the first message (only when --rate > 0).
+ */
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QList>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QTextStream>
+
+#include <algorithm>
+#include <vector>
+
+#include "udpmidi.h"
+#include "netsettings.h"
+#include "mididefs.h"
+#include "constants.h"
+
+struct LoadOptions {
+    QString pattern;
+    int count;
+    int rate;
+    int size;
+    int channel;
+    uint seed;
+    QHostAddress address;
+    quint16 port;
+    int receivers;
+    int timeout;
+
+    LoadOptions() :
+        pattern("notes"), count(10000), rate(1000), size(256), channel(0),
+        seed(1), address(QHostAddress::LocalHost), port(NETWORKPORTNUMBER),
+        receivers(1), timeout(2000) {}
+};
+
+/* Small deterministic generator, identical on both ends */
+class Lcg
+{
+public:
+    Lcg(uint seed) : m_state(seed) {}
+    uint next(uint range)
+    {
+        m_state = m_state * 1103515245u + 12345u;
+        return (m_state >> 16) % range;
+    }
+private:
+    uint m_state;
+};
+
+static QVector<QByteArray> buildStream(const LoadOptions &opt)
+{
+    QVector<QByteArray> stream;
+    stream.reserve(opt.count);
+    Lcg rnd(opt.seed);
+    char chan = char(opt.channel);
+    int step = 0;
+    while (stream.size() < opt.count) {
+        if (opt.pattern == "cc14") {
+            // 14 bit controller sweep: MSB on 1..31, LSB on 33..63
+            int ctl = 1 + (step / 16384) % 31;
+            int value = step % 16384;
+            QByteArray msb, lsb;
+            msb.append(char(STATUS_CTLCHG | chan)).append(char(ctl)).append(char(CALC_MSB(value)));
+            lsb.append(char(STATUS_CTLCHG | chan)).append(char(ctl + 32)).append(char(CALC_LSB(value)));
+            stream << msb << lsb;
+        } else if (opt.pattern == "sysex") {
+            QByteArray sysex;
+            sysex.append(char(0xf0)).append(char(0x7d)); // non-commercial ID
+            sysex.append(char(step & 0x7f)).append(char((step >> 7) & 0x7f));
+            while (sysex.size() < opt.size - 1)
+                sysex.append(char(rnd.next(128)));
+            sysex.append(char(0xf7));
+            stream << sysex;
+        } else if (opt.pattern == "chords") {
+            int root = 36 + rnd.next(48);
+            int notes = 3 + rnd.next(4);
+            QVector<int> chord;
+            for (int i = 0; i < notes; ++i)
+                chord << (root + i * 3 + rnd.next(3)) % 128;
+            foreach(int n, chord)
+                stream << (QByteArray().append(char(STATUS_NOTEON | chan)).append(char(n)).append(char(1 + rnd.next(127))));
+            foreach(int n, chord)
+                stream << (QByteArray().append(char(STATUS_NOTEOFF | chan)).append(char(n)).append(char(0)));
+        } else {
+            int note = (step * 7) % 128;
+            stream << (QByteArray().append(char(STATUS_NOTEON | chan)).append(char(note)).append(char(1 + rnd.next(127))));
+            // the release velocity makes each message unique over 16384 steps
+            stream << (QByteArray().append(char(STATUS_NOTEOFF | chan)).append(char(note)).append(char((step / 128) % 128)));
+        }
+        step++;
+    }
+    stream.resize(opt.count);
+    return stream;
+}
+
+/* CPU time of the calling thread: the receiver runs alone in the main thread */
+static qint64 threadCpuMicroseconds()
+{
+    struct rusage usage;
+#if defined(RUSAGE_THREAD)
+    ::getrusage(RUSAGE_THREAD, &usage);
+#else
+    ::getrusage(RUSAGE_SELF, &usage);
+#endif
+    return qint64(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/* Peer list of the NetMidiOut sender, in the Preferences syntax */
+static QStringList destinations(const LoadOptions &opt)
+{
+    QStringList peers;
+    QString host = opt.address.toString();
+    if (opt.address.protocol() == QAbstractSocket::IPv6Protocol)
+        host = '[' + host + ']';
+    for (int i = 0; i < opt.receivers; ++i)
+        peers << host + ':' + QString::number(opt.port + i);
+    return peers;
+}
+
+class Sender : public QThread
+{
+public:
+    Sender(const LoadOptions &opt, const QVector<QByteArray> &stream,
+           const QElapsedTimer &clock, QVector<qint64> *sendTimes) :
+        m_opt(opt), m_stream(stream), m_clock(clock),
+        m_sendTimes(sendTimes), m_elapsed(0) {}
+
+    qint64 elapsed() const { return m_elapsed; }
+
+protected:
+    void run()
+    {
+        // the socket of the driver belongs to this thread
+        NetMidiOut output;
+        output.openPort();
+        std::vector<unsigned char> message;
+        qint64 start = m_clock.nsecsElapsed();
+        for (int i = 0; i < m_stream.size(); ++i) {
+            if (m_opt.rate > 0) {
+                // absolute deadlines, so the pacing error does not accumulate
+                qint64 deadline = start + qint64(i) * 1000000000 / m_opt.rate;
+                qint64 wait = deadline - m_clock.nsecsElapsed();
+                if (wait > 0)
+                    QThread::usleep(wait / 1000);
+            }
+            if (m_sendTimes != 0)
+                (*m_sendTimes)[i] = m_clock.nsecsElapsed();
+            const QByteArray &msg = m_stream.at(i);
+            message.assign(msg.constData(), msg.constData() + msg.size());
+            output.sendMessage(&message);
+        }
+        m_elapsed = m_clock.nsecsElapsed() - start;
+        output.closePort();
+    }
+
+private:
+    const LoadOptions &m_opt;
+    const QVector<QByteArray> &m_stream;
+    const QElapsedTimer &m_clock;
+    QVector<qint64> *m_sendTimes;
+    qint64 m_elapsed;
+};
+
+static const int MATCH_WINDOW = 4096;
+static const int IDLE_TICK = 50;
+
+/*
+ * Matches the messages delivered by a NetMidiIn port against the expected
+ * stream. The driver calls back from the event loop of the main thread.
+ */
+class Receiver
+{
+public:
+    Receiver(const LoadOptions &opt, const QVector<QByteArray> &stream,
+             const QElapsedTimer &clock, const QVector<qint64> *sendTimes) :
+        m_opt(opt), m_stream(stream), m_clock(clock), m_sendTimes(sendTimes),
+        m_seen(stream.size(), false), m_next(0), m_received(0), m_reordered(0),
+        m_unexpected(0), m_duplicates(0), m_bytes(0), m_first(-1), m_last(0),
+        m_firstIndex(0)
+    {
+        m_latencies.reserve(stream.size());
+    }
+
+    void open(quint16 port)
+    {
+        NetworkSettings::instance().setPort(port);
+        m_input.openPort();
+        m_input.ignoreTypes(false, false, false);
+        m_input.setCallback(&Receiver::callback, this);
+    }
+
+    void close()
+    {
+        m_input.cancelCallback();
+        m_input.closePort();
+    }
+
+    bool complete() const { return m_received >= m_stream.size(); }
+    int received() const { return m_received; }
+    int lost() const { return m_stream.size() - m_received; }
+    int reordered() const { return m_reordered; }
+    int unexpected() const { return m_unexpected; }
+    int duplicates() const { return m_duplicates; }
+    qint64 bytes() const { return m_bytes; }
+    qint64 first() const { return m_first; }
+    qint64 last() const { return m_last; }
+    const QVector<qint64>& latencies() const { return m_latencies; }
+
+private:
+    static void callback(double /*deltatime*/, std::vector<unsigned char> *message, void *userData)
+    {
+        static_cast<Receiver *>(userData)->process(*message);
+    }
+
+    void process(const std::vector<unsigned char> &message)
+    {
+        qint64 now = m_clock.nsecsElapsed();
+        if (message.empty())
+            return;
+        QByteArray datagram((const char *) &message[0], int(message.size()));
+        if (m_first < 0)
+            m_first = now;
+        m_last = now;
+        m_bytes += datagram.size();
+
+        // find the message in the expected stream: ahead means loss, behind means reordering
+        int index = -1;
+        for (int i = m_next; i < m_stream.size() && i < m_next + MATCH_WINDOW; ++i) {
+            if (!m_seen[i] && m_stream[i] == datagram) {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0) {
+            for (int i = m_next - 1; i >= 0 && i >= m_next - MATCH_WINDOW; --i) {
+                if (m_stream[i] == datagram) {
+                    index = i;
+                    break;
+                }
+            }
+            if (index < 0) {
+                m_unexpected++;
+                return;
+            }
+            if (m_seen[index]) {
+                m_duplicates++;
+                return;
+            }
+            m_reordered++;
+        } else {
+            m_next = index + 1;
+        }
+        if (m_received == 0)
+            m_firstIndex = index;
+        m_seen[index] = true;
+        m_received++;
+        if (m_sendTimes != 0) {
+            m_latencies << (now - m_sendTimes->at(index));
+        } else if (m_opt.rate > 0) {
+            qint64 scheduled = m_first + (index - m_firstIndex) * 1000000000 / m_opt.rate;
+            m_latencies << (now - scheduled);
+        }
+    }
+
+    const LoadOptions &m_opt;
+    const QVector<QByteArray> &m_stream;
+    const QElapsedTimer &m_clock;
+    const QVector<qint64> *m_sendTimes;
+    NetMidiIn m_input;
+    QVector<bool> m_seen;
+    QVector<qint64> m_latencies;
+    int m_next;
+    int m_received;
+    int m_reordered;
+    int m_unexpected;
+    int m_duplicates;
+    qint64 m_bytes;
+    qint64 m_first;
+    qint64 m_last;
+    qint64 m_firstIndex;
+};
+
+static int receive(const LoadOptions &opt, const QVector<QByteArray> &stream,
+                   const QElapsedTimer &clock, const QVector<qint64> *sendTimes,
+                   Sender *sender)
+{
+    QTextStream out(stdout);
+    QList<Receiver *> receivers;
+    for (int i = 0; i < opt.receivers; ++i) {
+        Receiver *receiver = new Receiver(opt, stream, clock, sendTimes);
+        receiver->open(opt.port + i);
+        receivers << receiver;
+    }
+    if (sender != 0)
+        sender->start();
+
+    // the timer bounds every wait for the driver's socket notifications
+    QTimer tick;
+    tick.start(IDLE_TICK);
+    QElapsedTimer idle;
+    idle.start();
+    int count = 0;
+    int expected = stream.size() * receivers.size();
+    qint64 cpuStart = threadCpuMicroseconds();
+    forever {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        int received = 0;
+        foreach(Receiver *receiver, receivers)
+            received += receiver->received();
+        if (received >= expected)
+            break;
+        bool senderDone = (sender == 0) || sender->isFinished();
+        if (received != count || !senderDone) {
+            count = received;
+            idle.restart();
+        } else if (idle.elapsed() > opt.timeout) {
+            break;
+        }
+    }
+    qint64 cpu = threadCpuMicroseconds() - cpuStart;
+    if (sender != 0)
+        sender->wait();
+
+    int received = 0, lost = 0, reordered = 0, duplicates = 0, unexpected = 0;
+    qint64 bytes = 0, first = -1, last = 0;
+    QVector<qint64> latencies;
+    for (int i = 0; i < receivers.size(); ++i) {
+        Receiver *receiver = receivers[i];
+        receiver->close();
+        received += receiver->received();
+        lost += receiver->lost();
+        reordered += receiver->reordered();
+        duplicates += receiver->duplicates();
+        unexpected += receiver->unexpected();
+        bytes += receiver->bytes();
+        if (receiver->first() >= 0 && (first < 0 || receiver->first() < first))
+            first = receiver->first();
+        last = qMax(last, receiver->last());
+        latencies << receiver->latencies();
+        if (receivers.size() > 1)
+            out << "port " << (opt.port + i) << ":  " << receiver->received()
+                << " received, " << receiver->lost() << " lost, "
+                << receiver->reordered() << " reordered" << endl;
+    }
+    qDeleteAll(receivers);
+
+    double seconds = (last > first) ? (last - first) / 1e9 : 0.0;
+    out << "pattern:     " << opt.pattern << endl;
+    out << "messages:    " << received << " / " << expected << " received" << endl;
+    out << "lost:        " << lost << " (" << (100.0 * lost / qMax(1, expected)) << "%)" << endl;
+    out << "reordered:   " << reordered << endl;
+    out << "duplicates:  " << duplicates << endl;
+    out << "unexpected:  " << unexpected << endl;
+    if (seconds > 0) {
+        out << "throughput:  " << qRound(received / seconds) << " msg/s, "
+            << qRound(bytes / seconds / 1024) << " KiB/s" << endl;
+        out << "cpu usage:   " << (100.0 * cpu / (seconds * 1e6)) << "% (receiver thread)" << endl;
+    }
+    if (!latencies.isEmpty()) {
+        std::sort(latencies.begin(), latencies.end());
+        int n = latencies.size();
+        out << (sendTimes != 0 ? "latency" : "relative latency")
+            << " (us): p50 " << latencies[n / 2] / 1000
+            << "  p90 " << latencies[n * 9 / 10] / 1000
+            << "  p99 " << latencies[qMin(n - 1, n * 99 / 100)] / 1000
+            << "  max " << latencies[n - 1] / 1000 << endl;
+    }
+    return lost == 0 && reordered == 0 ? 0 : 2;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    LoadOptions opt;
+    QString mode("--loopback");
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        QString arg = args[i];
+        QString value = (i + 1 < args.size()) ? args[i + 1] : QString();
+        if (arg == "--send" || arg == "--receive" || arg == "--loopback") {
+            mode = arg;
+            continue;
+        }
+        if (value.isEmpty()) {
+            out << "missing value for " << arg << endl;
+            return 1;
+        }
+        i++;
+        if (arg == "--pattern")
+            opt.pattern = value;
+        else if (arg == "--count")
+            opt.count = qMax(1, value.toInt());
+        else if (arg == "--rate")
+            opt.rate = qMax(0, value.toInt());
+        else if (arg == "--size")
+            opt.size = qBound(6, value.toInt(), 65000);
+        else if (arg == "--channel")
+            opt.channel = qBound(1, value.toInt(), MIDICHANNELS) - 1;
+        else if (arg == "--seed")
+            opt.seed = value.toUInt();
+        else if (arg == "--address")
+            opt.address = QHostAddress(value);
+        else if (arg == "--port")
+            opt.port = quint16(value.toUInt());
+        else if (arg == "--receivers")
+            opt.receivers = qBound(1, value.toInt(), 64);
+        else if (arg == "--timeout")
+            opt.timeout = value.toInt();
+        else {
+            out << "unknown option " << arg << endl;
+            return 1;
+        }
+    }
+    QStringList patterns;
+    patterns << "notes" << "cc14" << "sysex" << "chords";
+    if (!patterns.contains(opt.pattern) || opt.address.isNull()) {
+        out << "invalid pattern or address" << endl;
+        return 1;
+    }
+    if (opt.port + opt.receivers - 1 > 65535) {
+        out << "too many receivers for port " << opt.port << endl;
+        return 1;
+    }
+
+    QVector<QByteArray> stream = buildStream(opt);
+    NetworkSettings::instance().setPort(opt.port);
+    NetworkSettings::instance().setPeers(destinations(opt));
+    QElapsedTimer clock;
+    clock.start();
+
+    if (mode == "--send") {
+        Sender sender(opt, stream, clock, 0);
+        sender.start();
+        sender.wait();
+        double seconds = sender.elapsed() / 1e9;
+        out << "sent " << stream.size() << " messages in " << seconds << " s";
+        if (seconds > 0)
+            out << " (" << qRound(stream.size() / seconds) << " msg/s)";
+        out << endl;
+        return 0;
+    }
+    if (mode == "--receive")
+        return receive(opt, stream, clock, 0, 0);
+
+    QVector<qint64> sendTimes(stream.size(), 0);
+    Sender sender(opt, stream, clock, &sendTimes);
+    return receive(opt, stream, clock, &sendTimes, &sender);
+}
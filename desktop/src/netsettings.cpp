@@ -0,0 +1,81 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if defined(NETWORK_MIDI)
+
+#include <QDebug>
+
+#include "netsettings.h"
+#include "constants.h"
+
+bool NetworkPeer::isMulticast() const
+{
+    if (address.protocol() == QAbstractSocket::IPv4Protocol)
+        return (address.toIPv4Address() >> 28) == 0xe;
+    if (address.protocol() == QAbstractSocket::IPv6Protocol)
+        return address.toIPv6Address()[0] == 0xff;
+    return false;
+}
+
+/*
+ * Peer syntax: host[:port][/channels], where host may be a name, an IPv4
+ * address or a bracketed IPv6 address, and channels is a list of channel
+ * numbers or ranges joined by '+', for instance "10.0.0.2:21928/1-4+10".
+ * Host names are not resolved here: their address is left null.
+ */
+QList<NetworkPeer> NetworkSettings::parsePeers()
+{
+    QList<NetworkPeer> result;
+    foreach(const QString& entry, m_peers) {
+        NetworkPeer peer;
+        QString spec = entry.section('/', 0, 0).trimmed();
+        QString chans = entry.section('/', 1, 1).trimmed();
+        QString host = spec;
+        int port = m_port;
+        if (spec.startsWith('[')) {
+            int end = spec.indexOf(']');
+            host = spec.mid(1, end - 1);
+            if (spec.mid(end + 1).startsWith(':'))
+                port = spec.mid(end + 2).toInt();
+        } else if (spec.count(':') == 1) {
+            host = spec.section(':', 0, 0);
+            port = spec.section(':', 1, 1).toInt();
+        }
+        if (port <= 0 || port > 65535) {
+            qWarning() << "NetworkSettings: invalid port in peer" << entry;
+            continue;
+        }
+        peer.port = quint16(port);
+        peer.channels = 0xffff;
+        if (!chans.isEmpty()) {
+            peer.channels = 0;
+            foreach(const QString& range, chans.split('+', QString::SkipEmptyParts)) {
+                int first = range.section('-', 0, 0).toInt();
+                int last = range.contains('-') ? range.section('-', 1, 1).toInt() : first;
+                for (int ch = qMax(first, 1); ch <= qMin(last, MIDICHANNELS); ++ch)
+                    peer.channels |= (1 << (ch - 1));
+            }
+        }
+        peer.host = host;
+        peer.address = QHostAddress(host);
+        result << peer;
+    }
+    return result;
+}
+
+#endif // NETWORK_MIDI
@@ -20,6 +20,20 @@
 #define NETSETTINGS_H
 
 #include <QNetworkInterface>
+#include <QStringList>
+#include <QHostAddress>
+#include <QList>
+
+struct NetworkPeer
+{
+    QString host;
+    QHostAddress address;
+    quint16 port;
+    quint16 channels; // bit mask of accepted MIDI channels
+
+    bool isMulticast() const;
+    bool acceptsChannel(int channel) const { return channels & (1 << channel); }
+};
 
 class NetworkSettings
 {
@@ -36,6 +50,10 @@ public:
     QNetworkInterface& iface() { return m_iface; }
     void setIface(const QNetworkInterface& iface) { m_iface = iface; }
 
+    QStringList& peers() { return m_peers; }
+    void setPeers(const QStringList& peers) { m_peers = peers; }
+    QList<NetworkPeer> parsePeers();
+
 private:
     NetworkSettings() {}
     //NetworkSettings(const NetworkSettings& s);
@@ -45,6 +63,7 @@ private:
 
     int m_port;
     QNetworkInterface m_iface;
+    QStringList m_peers;
 };
 
 #endif // NETSETTINGS_H
@@ -0,0 +1,112 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "patchfinder.h"
+#include "patchindex.h"
+#include <QLineEdit>
+#include <QListView>
+#include <QVBoxLayout>
+#include <QKeyEvent>
+#include <QApplication>
+
+PatchFinder::PatchFinder(QWidget *parent)
+    : QFrame(parent, Qt::Popup),
+    m_index(0)
+{
+    setFrameStyle(QFrame::StyledPanel | QFrame::Plain);
+    m_edit = new QLineEdit(this);
+    m_list = new QListView(this);
+    m_list->setUniformItemSizes(true);
+    m_list->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_list->setFocusPolicy(Qt::NoFocus);
+    m_model = new PatchSearchModel(this);
+    m_list->setModel(m_model);
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setMargin(2);
+    layout->setSpacing(2);
+    layout->addWidget(m_edit);
+    layout->addWidget(m_list);
+    resize(360, 280);
+    m_edit->installEventFilter(this);
+    connect(m_edit, SIGNAL(textChanged(QString)), SLOT(slotTextChanged(QString)));
+    connect(m_list, SIGNAL(activated(QModelIndex)), SLOT(slotActivated(QModelIndex)));
+}
+
+void PatchFinder::setIndex(PatchIndex *index)
+{
+    m_index = index;
+    m_model->setIndex(index);
+}
+
+void PatchFinder::popup(const QPoint& pos)
+{
+    m_edit->clear();
+    move(pos);
+    show();
+    m_edit->setFocus();
+}
+
+void PatchFinder::slotTextChanged(const QString& text)
+{
+    if (m_index == 0)
+        return;
+    m_model->setResults(m_index->find(text));
+    if (m_model->rowCount() > 0)
+        m_list->setCurrentIndex(m_model->index(0));
+}
+
+void PatchFinder::slotActivated(const QModelIndex& index)
+{
+    int entry = m_model->entryAt(index.row());
+    if (m_index == 0 || entry < 0)
+        return;
+    const PatchIndex::Entry& e = m_index->entry(entry);
+    hide();
+    emit patchSelected(e.instrument, e.bank, e.program);
+}
+
+// The search field keeps the focus; the navigation keys drive the list.
+bool PatchFinder::eventFilter(QObject *obj, QEvent *event)
+{
+    if (obj == m_edit && event->type() == QEvent::KeyPress) {
+        QKeyEvent *ke = static_cast<QKeyEvent*>(event);
+        switch (ke->key()) {
+        case Qt::Key_Up:
+        case Qt::Key_Down:
+        case Qt::Key_PageUp:
+        case Qt::Key_PageDown:
+            QApplication::sendEvent(m_list, event);
+            return true;
+        case Qt::Key_Return:
+        case Qt::Key_Enter:
+            if (m_list->currentIndex().isValid())
+                slotActivated(m_list->currentIndex());
+            return true;
+        case Qt::Key_Escape:
+            hide();
+            return true;
+        }
+    }
+    return QFrame::eventFilter(obj, event);
+}
+
+void PatchFinder::hideEvent(QHideEvent *event)
+{
+    QFrame::hideEvent(event);
+    emit closed();
+}
@@ -0,0 +1,63 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PATCHFINDER_H
+#define PATCHFINDER_H
+
+#include <QFrame>
+
+class QLineEdit;
+class QListView;
+class QModelIndex;
+class PatchIndex;
+class PatchSearchModel;
+
+/**
+ * Quick-find popup: a search field over a PatchIndex, listing the
+ * matching patches of every loaded instrument as the user types.
+ */
+class PatchFinder : public QFrame
+{
+    Q_OBJECT
+
+public:
+    explicit PatchFinder(QWidget *parent = 0);
+
+    void setIndex(PatchIndex *index);
+    void popup(const QPoint& pos);
+
+signals:
+    void patchSelected(const QString& instrument, int bank, int program);
+    void closed();
+
+protected:
+    bool eventFilter(QObject *obj, QEvent *event);
+    void hideEvent(QHideEvent *event);
+
+private slots:
+    void slotTextChanged(const QString& text);
+    void slotActivated(const QModelIndex& index);
+
+private:
+    PatchIndex *m_index;
+    PatchSearchModel *m_model;
+    QLineEdit *m_edit;
+    QListView *m_list;
+};
+
+#endif // PATCHFINDER_H
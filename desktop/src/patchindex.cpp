@@ -0,0 +1,223 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "patchindex.h"
+#include <QtAlgorithms>
+#include <QBitArray>
+
+class PatchIndex::WordLess
+{
+public:
+    WordLess(const QVector<QString> *folded, const QString *query = 0)
+        : m_folded(folded), m_query(query) {}
+
+    // A negative entry stands for the query text
+    QStringRef text(const WordRef& w) const
+    {
+        if (w.entry < 0)
+            return QStringRef(m_query);
+        return m_folded->at(w.entry).midRef(w.pos);
+    }
+
+    bool operator()(const WordRef& a, const WordRef& b) const
+    {
+        return QStringRef::compare(text(a), text(b)) < 0;
+    }
+
+private:
+    const QVector<QString> *m_folded;
+    const QString *m_query;
+};
+
+void PatchIndex::clear()
+{
+    m_entries.clear();
+    m_folded.clear();
+    m_words.clear();
+    m_lastQuery.clear();
+    m_lastMatches.clear();
+}
+
+void PatchIndex::build(const InstrumentList& instruments)
+{
+    clear();
+    InstrumentList::ConstIterator it;
+    for (it = instruments.constBegin(); it != instruments.constEnd(); ++it) {
+        const InstrumentPatches& patches = it.value().patches();
+        InstrumentPatches::ConstIterator bit;
+        for (bit = patches.constBegin(); bit != patches.constEnd(); ++bit) {
+            const InstrumentData& patch = bit.value();
+            InstrumentData::ConstIterator pit;
+            for (pit = patch.constBegin(); pit != patch.constEnd(); ++pit) {
+                if (pit.value().isEmpty())
+                    continue;
+                Entry e;
+                e.instrument = it.key();
+                e.bank = bit.key();
+                e.program = pit.key();
+                e.name = pit.value();
+                m_entries.append(e);
+                m_folded.append(e.name.toCaseFolded());
+            }
+        }
+    }
+    for (int i = 0; i < m_folded.count(); ++i) {
+        const QString& name = m_folded[i];
+        for (int pos = 0; pos < name.length(); ++pos) {
+            if (name[pos].isLetterOrNumber() &&
+                (pos == 0 || !name[pos - 1].isLetterOrNumber())) {
+                WordRef w;
+                w.entry = i;
+                w.pos = pos;
+                m_words.append(w);
+            }
+        }
+    }
+    qSort(m_words.begin(), m_words.end(), WordLess(&m_folded));
+}
+
+QVector<int> PatchIndex::find(const QString& text)
+{
+    const QString query = text.simplified().toCaseFolded();
+    QVector<int> prefixed, worded, others;
+    if (query.isEmpty()) {
+        m_lastQuery.clear();
+        m_lastMatches.clear();
+        return others;
+    }
+
+    // Word starts, by binary search
+    QBitArray ranked(m_entries.count());
+    WordRef key;
+    key.entry = -1;
+    key.pos = 0;
+    WordLess less(&m_folded, &query);
+    QVector<WordRef>::ConstIterator w = qLowerBound(m_words.constBegin(), m_words.constEnd(), key, less);
+    for (; w != m_words.constEnd() && less.text(*w).startsWith(query); ++w) {
+        if (!ranked.testBit(w->entry)) {
+            ranked.setBit(w->entry);
+            if (w->pos == 0)
+                prefixed.append(w->entry);
+            else
+                worded.append(w->entry);
+        }
+    }
+    qSort(prefixed);
+    qSort(worded);
+
+    // Substrings, rescanning only the last matches when possible
+    QVector<int> matches;
+    if (!m_lastQuery.isEmpty() && query.startsWith(m_lastQuery)) {
+        foreach(int i, m_lastMatches) {
+            if (m_folded[i].contains(query))
+                matches.append(i);
+        }
+    } else {
+        for (int i = 0; i < m_folded.count(); ++i) {
+            if (m_folded[i].contains(query))
+                matches.append(i);
+        }
+    }
+    foreach(int i, matches) {
+        if (!ranked.testBit(i))
+            others.append(i);
+    }
+    m_lastQuery = query;
+    m_lastMatches = matches;
+
+    return prefixed + worded + others;
+}
+
+ProgramListModel::ProgramListModel(QObject *parent)
+    : QAbstractListModel(parent)
+{ }
+
+void ProgramListModel::setPatch(const InstrumentData& patch)
+{
+    beginResetModel();
+    m_patch = patch;
+    m_programs.clear();
+    m_programs.reserve(patch.count());
+    InstrumentData::ConstIterator it;
+    for (it = patch.constBegin(); it != patch.constEnd(); ++it)
+        m_programs.append(it.key());
+    endResetModel();
+}
+
+int ProgramListModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : m_programs.count();
+}
+
+QVariant ProgramListModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_programs.count())
+        return QVariant();
+    int program = m_programs[index.row()];
+    switch (role) {
+    case Qt::DisplayRole:
+    case Qt::EditRole:
+        return m_patch[program];
+    case Qt::UserRole:
+        return program;
+    default:
+        return QVariant();
+    }
+}
+
+PatchSearchModel::PatchSearchModel(QObject *parent)
+    : QAbstractListModel(parent),
+    m_index(0)
+{ }
+
+void PatchSearchModel::setIndex(const PatchIndex *index)
+{
+    beginResetModel();
+    m_index = index;
+    m_results.clear();
+    endResetModel();
+}
+
+void PatchSearchModel::setResults(const QVector<int>& results)
+{
+    beginResetModel();
+    m_results = results;
+    endResetModel();
+}
+
+int PatchSearchModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : m_results.count();
+}
+
+QVariant PatchSearchModel::data(const QModelIndex& index, int role) const
+{
+    if (m_index == 0 || !index.isValid() || index.row() >= m_results.count())
+        return QVariant();
+    const PatchIndex::Entry& e = m_index->entry(m_results[index.row()]);
+    switch (role) {
+    case Qt::DisplayRole:
+        return QString("%1  (%2, %3:%4)").arg(e.name, e.instrument,
+                e.bank < 0 ? QString("*") : QString::number(e.bank))
+                .arg(e.program);
+    case Qt::UserRole:
+        return m_results[index.row()];
+    default:
+        return QVariant();
+    }
+}
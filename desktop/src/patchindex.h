@@ -0,0 +1,109 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PATCHINDEX_H
+#define PATCHINDEX_H
+
+#include <QAbstractListModel>
+#include <QVector>
+#include <QString>
+#include "instrument.h"
+
+/**
+ * Search index over every bank, program and patch name of a set of
+ * instruments.
+ *
+ * Names are case folded once, when the index is built. A sorted table of
+ * word starts answers prefix queries with a binary search, and substring
+ * queries scan the folded names. While the user keeps typing (the new
+ * query extends the previous one) only the previous matches are rescanned.
+ */
+class PatchIndex
+{
+public:
+    struct Entry {
+        QString instrument;
+        int bank;
+        int program;
+        QString name;
+    };
+
+    void build(const InstrumentList& instruments);
+    void clear();
+
+    int count() const { return m_entries.count(); }
+    const Entry& entry(int i) const { return m_entries[i]; }
+
+    // Matching entries: names starting with the text first, then names
+    // with a word starting with it, then any other substring match.
+    QVector<int> find(const QString& text);
+
+private:
+    struct WordRef {
+        int entry;
+        int pos;
+    };
+    class WordLess;
+
+    QVector<Entry> m_entries;
+    QVector<QString> m_folded;
+    QVector<WordRef> m_words;
+    QString m_lastQuery;
+    QVector<int> m_lastMatches;
+};
+
+/**
+ * Program names of a single bank, for the programs combo box. Only the
+ * program numbers are copied; names are fetched when a row is shown.
+ */
+class ProgramListModel : public QAbstractListModel
+{
+public:
+    explicit ProgramListModel(QObject *parent = 0);
+
+    void setPatch(const InstrumentData& patch);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+
+private:
+    InstrumentData m_patch;
+    QVector<int> m_programs;
+};
+
+/**
+ * Search results of a PatchIndex; rows are built only when shown.
+ */
+class PatchSearchModel : public QAbstractListModel
+{
+public:
+    explicit PatchSearchModel(QObject *parent = 0);
+
+    void setIndex(const PatchIndex *index);
+    void setResults(const QVector<int>& results);
+    int entryAt(int row) const { return m_results.value(row, -1); }
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+
+private:
+    const PatchIndex *m_index;
+    QVector<int> m_results;
+};
+
+#endif // PATCHINDEX_H
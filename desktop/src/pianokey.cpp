@@ -21,6 +21,9 @@
 #include <QPainter>
 #include <QPalette>
 #include <QtSvg/QSvgRenderer>
+#include <QPixmap>
+#include <QHash>
+#include <QtCore/qmath.h>
 
 static const QBrush blackBrush = QBrush(Qt::black);
 static const QBrush whiteBrush = QBrush(Qt::white);
@@ -45,20 +48,42 @@ PianoKey::PianoKey(const QRectF &rect, const bool black, const int note)
     setAcceptedMouseButtons(Qt::NoButton);
 }
 
-void PianoKey::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
+/* Rasterised key images, keyed by the device size of the key, its colour
+   and the device pixel ratio. Every state of a key is painted only once
+   for a given zoom level, and then blitted. */
+struct KeyPixmapKey
+{
+    QSize size;
+    QRgb color;
+    bool black;
+    int dpr;
+    bool operator==(const KeyPixmapKey &other) const
+    {
+        return size == other.size && color == other.color &&
+               black == other.black && dpr == other.dpr;
+    }
+};
+
+static inline uint qHash(const KeyPixmapKey &k)
+{
+    return (uint(k.size.width()) << 20) ^ (uint(k.size.height()) << 8) ^
+           uint(k.color) ^ (uint(k.black) << 31) ^ uint(k.dpr);
+}
+
+static const int KEYPIXMAPCACHE_MAX = 512;
+static QHash<KeyPixmapKey, QPixmap> keyPixmapCache;
+
+void PianoKey::clearPixmapCache()
+{
+    keyPixmapCache.clear();
+}
+
+void PianoKey::paintKey(QPainter *painter, const QBrush &brush) const
 {
     static QSvgRenderer keyRenderer(QString(":/vpiano/blkey.svg"));
     static const QPen blackPen(Qt::black, 1);
     static const QPen grayPen(QBrush(Qt::gray), 1, Qt::SolidLine,  Qt::RoundCap, Qt::RoundJoin);
-    if (m_pressed) {
-        if (m_selectedBrush.style() != Qt::NoBrush) {
-            painter->setBrush(m_selectedBrush);
-        } else {
-            painter->setBrush(QApplication::palette().highlight());
-        }
-    } else {
-        painter->setBrush(m_brush);
-    }
+    painter->setBrush(brush);
     painter->setPen(blackPen);
     painter->drawRoundRect(rect(), 15, 15);
     if (m_black)
@@ -74,6 +99,53 @@ void PianoKey::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidge
     }
 }
 
+void PianoKey::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
+{
+    QBrush brush = m_brush;
+    if (m_pressed) {
+        if (m_selectedBrush.style() != Qt::NoBrush) {
+            brush = m_selectedBrush;
+        } else {
+            brush = QApplication::palette().highlight();
+        }
+    }
+    // only plain colours are cached; the transform may include the view
+    // rotation, so the scale factors are taken from the transformed axes
+    const QTransform &t = painter->worldTransform();
+    qreal sx = qSqrt(t.m11() * t.m11() + t.m12() * t.m12());
+    qreal sy = qSqrt(t.m21() * t.m21() + t.m22() * t.m22());
+    KeyPixmapKey key;
+    key.size = QSize(qRound(rect().width() * sx), qRound(rect().height() * sy));
+    key.color = brush.color().rgba();
+    key.black = m_black;
+    key.dpr = 1;
+#if QT_VERSION >= 0x050100
+    key.dpr = painter->device()->devicePixelRatio();
+#endif
+    if (brush.style() != Qt::SolidPattern || key.size.isEmpty()) {
+        paintKey(painter, brush);
+        return;
+    }
+    QHash<KeyPixmapKey, QPixmap>::ConstIterator it = keyPixmapCache.constFind(key);
+    if (it == keyPixmapCache.constEnd()) {
+        if (keyPixmapCache.count() >= KEYPIXMAPCACHE_MAX)
+            keyPixmapCache.clear();
+        QPixmap pixmap(key.size * key.dpr);
+        pixmap.fill(Qt::transparent);
+        QPainter p(&pixmap);
+        p.setRenderHints(painter->renderHints());
+        p.scale(pixmap.width() / rect().width(), pixmap.height() / rect().height());
+        p.translate(-rect().topLeft());
+        paintKey(&p, brush);
+        p.end();
+#if QT_VERSION >= 0x050100
+        pixmap.setDevicePixelRatio(key.dpr);
+#endif
+        it = keyPixmapCache.insert(key, pixmap);
+    }
+    painter->drawPixmap(rect(), it.value(), QRectF(QPointF(0, 0), it.value().size()));
+}
+
 void PianoKey::setPressed(bool p)
 {
     if (p != m_pressed) {
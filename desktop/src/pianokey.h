@@ -39,8 +39,11 @@ public:
     void setPressed(bool p);
     int getDegree() const { return m_note % 12; }
     int getType() const { return (m_black ? 1 : 0); }
+    static void clearPixmapCache();
 
 private:
+    void paintKey(QPainter *painter, const QBrush &brush) const;
+
     bool m_pressed;
     QBrush m_selectedBrush;
     QBrush m_brush;
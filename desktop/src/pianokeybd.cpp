@@ -72,6 +72,7 @@ void PianoKeybd::initialize()
 void PianoKeybd::resizeEvent(QResizeEvent *event)
 {
     QGraphicsView::resizeEvent(event);
+    PianoKey::clearPixmapCache();
     fitInView(m_scene->sceneRect(), Qt::KeepAspectRatio);
 }
 
@@ -235,6 +236,19 @@ void PianoKeybd::initDefaultMap()
     m_defaultRawMap.insert(30, 48);
 #endif
     m_rawMap = &m_defaultRawMap;
+    m_rawNotes.build(m_rawMap);
+}
+
+void PianoKeybd::setRawKeyboardMap(KeyboardMap* m)
+{
+    m_rawMap = m;
+    m_rawNotes.build(m_rawMap);
+}
+
+void PianoKeybd::resetRawKeyboardMap()
+{
+    m_rawMap = &m_defaultRawMap;
+    m_rawNotes.build(m_rawMap);
 }
 
 void PianoKeybd::setNumOctaves(const int numOctaves)
@@ -264,6 +278,7 @@ void PianoKeybd::setRotation(int r)
         m_rotation = r;
         resetTransform();
         rotate(m_rotation);
+        PianoKey::clearPixmapCache();
         fitInView(m_scene->sceneRect(), Qt::KeepAspectRatio);
     }
 }
@@ -276,8 +291,9 @@ QSize PianoKeybd::sizeHint() const
 #if defined(RAWKBD_SUPPORT)
 bool PianoKeybd::handleKeyPressed(int keycode)
 {
-    if (m_scene->isKeyboardEnabled() && m_rawMap != NULL && m_rawMap->contains(keycode)) {
-        m_scene->keyOn(m_rawMap->value(keycode));
+    int note = m_rawNotes.note(keycode);
+    if (note >= 0 && m_scene->isKeyboardEnabled()) {
+        m_scene->keyOn(note);
         return true;
     }
     return false;
@@ -285,8 +301,9 @@ bool PianoKeybd::handleKeyPressed(int keycode)
 
 bool PianoKeybd::handleKeyReleased(int keycode)
 {
-    if (m_scene->isKeyboardEnabled() && m_rawMap != NULL && m_rawMap->contains(keycode)) {
-        m_scene->keyOff(m_rawMap->value(keycode));
+    int note = m_rawNotes.note(keycode);
+    if (note >= 0 && m_scene->isKeyboardEnabled()) {
+        m_scene->keyOff(note);
         return true;
     }
     return false;
@@ -71,9 +71,9 @@ public:
 
     QSize sizeHint() const;
     PianoScene* getPianoScene() { return m_scene; }
-    void setRawKeyboardMap(KeyboardMap* m) { m_rawMap = m; }
+    void setRawKeyboardMap(KeyboardMap* m);
     KeyboardMap* getRawKeyboardMap() { return m_rawMap; }
-    void resetRawKeyboardMap() { m_rawMap = &m_defaultRawMap; }
+    void resetRawKeyboardMap();
     void resetKeyboardMap() { m_scene->setKeyboardMap(&m_defaultMap); }
 
 #if defined(RAWKBD_SUPPORT)
@@ -98,6 +98,7 @@ private:
     KeyboardMap *m_rawMap;
     KeyboardMap m_defaultMap;
     KeyboardMap m_defaultRawMap;
+    KeyNoteTable m_rawNotes;
 };
 
 #endif // PIANOKEYBD_H
@@ -36,14 +36,17 @@ PianoPalette::setColor(int n, QString s, QColor c)
     if (n < m_colors.size()) {
         m_colors[n] = c;
         m_names[n] = s;
+        m_brushes.clear();
     }
 }
 
 void
 PianoPalette::setColor(int n, QColor c)
 {
-    if (n < m_colors.size())
+    if (n < m_colors.size()) {
         m_colors[n] = c;
+        m_brushes.clear();
+    }
 }
 
 void
@@ -69,6 +72,32 @@ PianoPalette::getColorName(int i)
     return QString();
 }
 
+/* Pressed key brush for a colour and a note velocity: the colour is made
+   lighter for softer notes. The whole table (colours by 128 velocities)
+   is computed at once, after any colour change. */
+const QBrush&
+PianoPalette::getBrush(int i, int vel)
+{
+    static const QBrush noBrush;
+    if (i < 0 || i >= m_colors.size())
+        return noBrush;
+    if (m_brushes.isEmpty())
+        updateBrushes();
+    return m_brushes[i * 128 + qBound(0, vel, 127)];
+}
+
+void
+PianoPalette::updateBrushes()
+{
+    m_brushes.resize(m_colors.size() * 128);
+    for(int i=0; i<m_colors.size(); ++i) {
+        for(int vel=0; vel<128; ++vel) {
+            QColor c = m_colors[i];
+            m_brushes[i * 128 + vel] = c.isValid() ? QBrush(c.lighter(200 - vel)) : QBrush();
+        }
+    }
+}
+
 int
 PianoPalette::getNumColors()
 {
@@ -21,7 +21,9 @@
 
 #include <QSettings>
 #include <QColor>
+#include <QBrush>
 #include <QList>
+#include <QVector>
 
 class PianoPalette
 {
@@ -42,6 +44,8 @@ public:
     void setColorName(int n, QString s);
     QColor getColor(int i);
     QString getColorName(int i);
+    const QBrush& getBrush(int i, int vel);
+    void updateBrushes();
 
     int getNumColors();
     void saveColors();
@@ -51,6 +55,7 @@ protected:
     int m_paletteId;
     QList<QColor> m_colors;
     QList<QString> m_names;
+    QVector<QBrush> m_brushes;
     QString m_paletteName;
     QString m_paletteText;
 };
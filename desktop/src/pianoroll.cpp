@@ -0,0 +1,256 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pianoroll.h"
+#include "pianokeybd.h"
+#include <QPainter>
+#include <QTimer>
+#include <cstring>
+
+static const int TICKINTERVAL = 33;
+static const int BLACKKEYS = 0x54a; // degrees 1, 3, 6, 8, 10
+
+PianoRoll::PianoRoll(PianoKeybd *keyboard, QWidget *parent)
+    : QWidget(parent),
+    m_keyboard(keyboard),
+    m_seconds(10),
+    m_ring(RingCapacity),
+    m_written(0),
+    m_scene(0),
+    m_baseOctave(0),
+    m_transpose(0),
+    m_scrolled(0),
+    m_lastTick(0)
+{
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Preferred);
+    m_timer = new QTimer(this);
+    m_timer->setInterval(TICKINTERVAL);
+    connect(m_timer, SIGNAL(timeout()), SLOT(tick()));
+    m_clock.start();
+    for (int s = 0; s < 2; ++s)
+        for (int c = 0; c < 16; ++c)
+            for (int n = 0; n < 128; ++n)
+                m_open[s][c][n] = -1;
+    for (int n = 0; n < 128; ++n) {
+        m_sounding[n] = 0;
+        m_keyColor[n] = 0;
+        m_keyLeft[n] = m_keyRight[n] = 0;
+    }
+    for (int w = 0; w < 4; ++w)
+        m_touched[w] = 0;
+}
+
+QSize PianoRoll::sizeHint() const
+{
+    return QSize(m_keyboard->sizeHint().width(), 100);
+}
+
+void PianoRoll::setHistorySeconds(int seconds)
+{
+    if (seconds > 0 && seconds != m_seconds) {
+        m_seconds = seconds;
+        redraw();
+        update();
+    }
+}
+
+QRgb PianoRoll::spanColor(int channel, int source, int velocity) const
+{
+    if (source == Output)
+        return palette().highlight().color().rgb();
+    return QColor::fromHsv(channel * 360 / 16, 200, 128 + velocity).rgb();
+}
+
+void PianoRoll::noteOn(int channel, int note, int velocity, Source source)
+{
+    if ((note & 0x7f) != note || (channel & 0x0f) != channel)
+        return;
+    if (m_open[source][channel][note] >= 0)
+        noteOff(channel, note, source);
+    NoteSpan &span = m_ring[int(m_written & (RingCapacity - 1))];
+    span.start = now();
+    span.end = OpenSpan;
+    span.note = note;
+    span.channel = channel;
+    span.source = source;
+    span.velocity = velocity & 0x7f;
+    m_open[source][channel][note] = m_written++;
+    m_sounding[note]++;
+    m_touched[note >> 5] |= 1U << (note & 31);
+    m_keyColor[note] = spanColor(channel, source, span.velocity);
+}
+
+void PianoRoll::noteOff(int channel, int note, Source source)
+{
+    if ((note & 0x7f) != note || (channel & 0x0f) != channel)
+        return;
+    qint64 &open = m_open[source][channel][note];
+    if (open < 0)
+        return;
+    // the span may have been overwritten already by newer ones
+    if (open >= m_written - RingCapacity)
+        m_ring[int(open & (RingCapacity - 1))].end = now();
+    open = -1;
+    if (m_sounding[note] > 0)
+        m_sounding[note]--;
+}
+
+void PianoRoll::allNotesOff()
+{
+    for (int s = 0; s < 2; ++s)
+        for (int c = 0; c < 16; ++c)
+            for (int n = 0; n < 128; ++n)
+                noteOff(c, n, Source(s));
+}
+
+bool PianoRoll::layoutChanged() const
+{
+    QWidget *viewport = m_keyboard->viewport();
+    return m_image.size() != size() ||
+           m_scene != m_keyboard->getPianoScene() ||
+           m_transform != m_keyboard->viewportTransform() ||
+           m_origin != mapFromGlobal(viewport->mapToGlobal(QPoint(0, 0))) ||
+           m_baseOctave != m_scene->baseOctave() ||
+           m_transpose != m_scene->getTranspose();
+}
+
+void PianoRoll::updateLayout()
+{
+    QWidget *viewport = m_keyboard->viewport();
+    m_scene = m_keyboard->getPianoScene();
+    m_transform = m_keyboard->viewportTransform();
+    m_origin = mapFromGlobal(viewport->mapToGlobal(QPoint(0, 0)));
+    m_baseOctave = m_scene->baseOctave();
+    m_transpose = m_scene->getTranspose();
+    for (int n = 0; n < 128; ++n) {
+        QRectF r = m_scene->getNoteRect(n);
+        if (r.isNull()) {
+            m_keyLeft[n] = m_keyRight[n] = 0;
+        } else {
+            QRect v = m_keyboard->mapFromScene(r).boundingRect();
+            m_keyLeft[n] = m_origin.x() + v.left();
+            m_keyRight[n] = m_origin.x() + v.right();
+        }
+    }
+    if (m_image.size() != size())
+        m_image = QImage(size(), QImage::Format_RGB32);
+}
+
+void PianoRoll::drawSpan(QPainter &painter, int note, QRgb color, int top, int bottom)
+{
+    if (m_keyRight[note] > m_keyLeft[note] && bottom > top)
+        painter.fillRect(m_keyLeft[note], top, m_keyRight[note] - m_keyLeft[note],
+                         bottom - top, QColor(color));
+}
+
+/* Repaints the whole image from the ring: white keys first, black keys on
+   top of them, as on the keyboard */
+void PianoRoll::redraw()
+{
+    if (m_image.isNull())
+        return;
+    int height = m_image.height();
+    double pixelsPerMs = height / (m_seconds * 1000.0);
+    quint32 t = now();
+    m_image.fill(palette().base().color().rgb());
+    QPainter painter(&m_image);
+    qint64 first = qMax(qint64(0), m_written - RingCapacity);
+    for (int black = 0; black < 2; ++black) {
+        for (qint64 i = first; i < m_written; ++i) {
+            const NoteSpan &span = m_ring[int(i & (RingCapacity - 1))];
+            if (((BLACKKEYS >> (span.note % 12)) & 1) != black)
+                continue;
+            quint32 end = (span.end == OpenSpan) ? t : span.end;
+            int top = height - qRound((t - span.start) * pixelsPerMs);
+            int bottom = height - qRound((t - end) * pixelsPerMs);
+            if (bottom < 0)
+                continue;
+            drawSpan(painter, span.note, spanColor(span.channel, span.source, span.velocity),
+                     top, qMax(bottom, top + 1));
+        }
+    }
+    m_scrolled = 0;
+    m_lastTick = t;
+}
+
+/* Scrolls the image up by the time elapsed since the last tick, and paints
+   the new rows with the keys sounding now or touched since then, so notes
+   shorter than a tick still leave a mark */
+void PianoRoll::tick()
+{
+    if (layoutChanged()) {
+        updateLayout();
+        redraw();
+        update();
+        return;
+    }
+    int height = m_image.height();
+    if (height == 0)
+        return;
+    quint32 t = now();
+    m_scrolled += (t - m_lastTick) * height / (m_seconds * 1000.0);
+    m_lastTick = t;
+    int rows = int(m_scrolled);
+    if (rows <= 0)
+        return;
+    m_scrolled -= rows;
+    rows = qMin(rows, height);
+    int bpl = m_image.bytesPerLine();
+    uchar *bits = m_image.bits();
+    std::memmove(bits, bits + rows * bpl, (height - rows) * bpl);
+    QPainter painter(&m_image);
+    painter.fillRect(0, height - rows, m_image.width(), rows, palette().base());
+    for (int black = 0; black < 2; ++black) {
+        for (int n = 0; n < 128; ++n) {
+            bool touched = (m_touched[n >> 5] >> (n & 31)) & 1;
+            if ((m_sounding[n] > 0 || touched) && ((BLACKKEYS >> (n % 12)) & 1) == black)
+                drawSpan(painter, n, m_keyColor[n], height - rows, height);
+        }
+    }
+    for (int w = 0; w < 4; ++w)
+        m_touched[w] = 0;
+    update();
+}
+
+void PianoRoll::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.drawImage(0, 0, m_image);
+}
+
+void PianoRoll::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    updateLayout();
+    redraw();
+}
+
+void PianoRoll::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+    updateLayout();
+    redraw();
+    m_timer->start();
+}
+
+void PianoRoll::hideEvent(QHideEvent *event)
+{
+    QWidget::hideEvent(event);
+    m_timer->stop();
+}
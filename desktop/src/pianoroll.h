@@ -0,0 +1,116 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PIANOROLL_H
+#define PIANOROLL_H
+
+#include <QWidget>
+#include <QImage>
+#include <QVector>
+#include <QTransform>
+#include <QElapsedTimer>
+
+class QTimer;
+class PianoKeybd;
+class PianoScene;
+
+/**
+ * Scrolling history of the notes played and received, drawn as a strip
+ * above the keyboard and aligned with its keys.
+ *
+ * Notes are recorded as spans in a fixed capacity ring, so the memory
+ * used does not grow with the session length; the oldest spans are
+ * overwritten. The strip is an image scrolled upwards on every tick,
+ * where only the new rows at the bottom are painted. The ring is used
+ * to repaint the whole image when the keyboard layout changes.
+ */
+class PianoRoll : public QWidget
+{
+    Q_OBJECT
+
+public:
+    enum Source { Input = 0, Output = 1 };
+
+    explicit PianoRoll(PianoKeybd *keyboard, QWidget *parent = 0);
+
+    void noteOn(int channel, int note, int velocity, Source source);
+    void noteOff(int channel, int note, Source source);
+    void allNotesOff();
+
+    int historySeconds() const { return m_seconds; }
+    void setHistorySeconds(int seconds);
+
+    QSize sizeHint() const;
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+    void showEvent(QShowEvent *event);
+    void hideEvent(QHideEvent *event);
+
+private slots:
+    void tick();
+
+private:
+    struct NoteSpan {
+        quint32 start;
+        quint32 end;
+        quint8 note;
+        quint8 channel;
+        quint8 source;
+        quint8 velocity;
+    };
+
+    enum { RingCapacity = 65536, OpenSpan = 0xffffffff };
+
+    bool layoutChanged() const;
+    void updateLayout();
+    void redraw();
+    void drawSpan(QPainter &painter, int note, QRgb color, int top, int bottom);
+    QRgb spanColor(int channel, int source, int velocity) const;
+    quint32 now() const { return quint32(m_clock.elapsed()); }
+
+    PianoKeybd *m_keyboard;
+    QTimer *m_timer;
+    QElapsedTimer m_clock;
+    int m_seconds;
+
+    QVector<NoteSpan> m_ring;
+    qint64 m_written;
+    qint64 m_open[2][16][128];
+
+    // incremental drawing state, per key
+    quint16 m_sounding[128];
+    quint32 m_touched[4];
+    QRgb m_keyColor[128];
+
+    // key layout, in widget coordinates
+    int m_keyLeft[128];
+    int m_keyRight[128];
+    PianoScene *m_scene;
+    QTransform m_transform;
+    QPoint m_origin;
+    int m_baseOctave;
+    int m_transpose;
+
+    QImage m_image;
+    double m_scrolled;
+    quint32 m_lastTick;
+};
+
+#endif // PIANOROLL_H
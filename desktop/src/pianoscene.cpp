@@ -24,10 +24,14 @@
 #include <QPalette>
 #include <QGraphicsSceneMouseEvent>
 #include <QKeyEvent>
+#include <QTimer>
+#include <QtCore/qmath.h>
 #include <QDebug>
 
 #define KEYWIDTH  18
 #define KEYHEIGHT 72
+#define FRAMEINTERVAL 16
+#define TOUCHSTEP 4
 
 PianoScene::PianoScene ( const int baseOctave, 
                          const int numOctaves, 
@@ -54,6 +58,18 @@ PianoScene::PianoScene ( const int baseOctave,
     m_palette( 0 ),
     m_scalePalette( 0 )
 {
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(FRAMEINTERVAL);
+    connect(m_flushTimer, SIGNAL(timeout()), SLOT(flushKeyStates()));
+    for (int w = 0; w < 4; ++w)
+        m_pendingOn[w] = m_pendingOff[w] = 0;
+    for (int t = 0; t < MaxTouchPoints; ++t) {
+        m_touches[t].id = -1;
+        m_touches[t].key = NULL;
+    }
+    for (int k = 0; k < 128; ++k)
+        m_touchHolds[k] = 0;
     QBrush hilightBrush(m_keyPressedColor.isValid() ? m_keyPressedColor : QApplication::palette().highlight());
     QFont lblFont(QApplication::font());
     int i, numkeys = m_numOctaves * 12;
@@ -88,10 +104,29 @@ PianoScene::PianoScene ( const int baseOctave,
         lbl->setFont(lblFont);
         m_labels.insert(i, lbl);
     }
+    buildKeyLookup();
     hideOrShowKeys();
     retranslate();
 }
 
+/* Key geometry is fixed in scene coordinates (rotation and zoom belong to
+   the view, and the number of octaves is set by creating a new scene), so
+   the keys found under every scene column are computed only once. All the
+   key edges fall on integer coordinates. */
+void PianoScene::buildKeyLookup()
+{
+    int width = KEYWIDTH * m_numOctaves * 7;
+    m_whiteKeyAt.fill(0, width);
+    m_blackKeyAt.fill(0, width);
+    foreach(PianoKey* key, m_keys) {
+        QVector<PianoKey*>& column = (key->getType() == 1 ? m_blackKeyAt : m_whiteKeyAt);
+        int left = qMax(0, qFloor(key->rect().left()));
+        int right = qMin(width, qCeil(key->rect().right()));
+        for (int x = left; x < right; ++x)
+            column[x] = key;
+    }
+}
+
 QSize PianoScene::sizeHint() const
 {
     return QSize(KEYWIDTH * m_numOctaves * 7, KEYHEIGHT);
@@ -103,6 +138,7 @@ void PianoScene::showKeyOn( PianoKey* key, QColor color, int vel )
         QBrush hilightBrush(color.lighter(200 - vel));
         key->setPressedBrush(hilightBrush);
     }
+    clearKeyState(key->getNote());
     key->setPressed(true);
 }
 
@@ -116,36 +152,123 @@ void PianoScene::showKeyOn( PianoKey* key, int vel )
             setColorFromPolicy(key, vel);
         }
     }
+    clearKeyState(key->getNote());
     key->setPressed(true);
 }
 
 void PianoScene::showKeyOff( PianoKey* key, int )
 {
+    clearKeyState(key->getNote());
     key->setPressed(false);
 }
 
+/* Notes shown from the MIDI input only change the colour of the keys right
+   away; their pressed state is collected in two bit masks and applied once
+   per frame. A key pressed and released within the same frame is shown
+   pressed for one frame, and released at the next one. */
 void PianoScene::showNoteOn( const int note, QColor color, int vel )
 {
     int n = note - m_baseOctave*12 - m_transpose;
     if ((note >= m_minNote) && (note <= m_maxNote) &&
-        (n >= 0) && (n < m_keys.size()) && color.isValid())
-        showKeyOn(m_keys[n], color, vel);
+        (n >= 0) && (n < m_keys.size()) && color.isValid()) {
+        if (vel >= 0)
+            m_keys[n]->setPressedBrush(QBrush(color.lighter(200 - vel)));
+        queueKeyState(n, true);
+    }
 }
 
 void PianoScene::showNoteOn( const int note, int vel )
+{
+    int n = note - m_baseOctave*12 - m_transpose;
+    if ((note >= m_minNote) && (note <= m_maxNote) &&
+        (n >= 0) && (n < m_keys.size())) {
+        if (vel >= 0) {
+            if (m_palette == 0 && m_keyPressedColor.isValid())
+                m_keys[n]->setPressedBrush(QBrush(m_keyPressedColor.lighter(200 - vel)));
+            else
+                setColorFromPolicy(m_keys[n], vel);
+        }
+        queueKeyState(n, true);
+    }
+}
+
+void PianoScene::showNoteOn( const int note, const QBrush& brush )
+{
+    int n = note - m_baseOctave*12 - m_transpose;
+    if ((note >= m_minNote) && (note <= m_maxNote) &&
+        (n >= 0) && (n < m_keys.size()) && brush.style() != Qt::NoBrush) {
+        m_keys[n]->setPressedBrush(brush);
+        queueKeyState(n, true);
+    }
+}
+
+void PianoScene::showNoteOff( const int note, int )
 {
     int n = note - m_baseOctave*12 - m_transpose;
     if ((note >= m_minNote) && (note <= m_maxNote) &&
         (n >= 0) && (n < m_keys.size()))
-        showKeyOn(m_keys[n], vel);
+        queueKeyState(n, false);
 }
 
-void PianoScene::showNoteOff( const int note, int vel )
+void PianoScene::queueKeyState( const int n, const bool pressed )
+{
+    quint32 bit = 1U << (n & 31);
+    if (pressed) {
+        m_pendingOn[n >> 5] |= bit;
+        m_pendingOff[n >> 5] &= ~bit;
+    } else {
+        m_pendingOff[n >> 5] |= bit;
+    }
+    if (!m_flushTimer->isActive())
+        m_flushTimer->start();
+}
+
+void PianoScene::clearKeyState( const int n )
+{
+    if (n >= 0 && n < 128) {
+        quint32 bit = 1U << (n & 31);
+        m_pendingOn[n >> 5] &= ~bit;
+        m_pendingOff[n >> 5] &= ~bit;
+    }
+}
+
+void PianoScene::flushKeyStates()
+{
+    bool deferred = false;
+    for (int w = 0; w < 4; ++w) {
+        quint32 on = m_pendingOn[w];
+        quint32 off = m_pendingOff[w];
+        quint32 dirty = on | off;
+        m_pendingOn[w] = 0;
+        // releases following a press in this frame wait for the next one
+        m_pendingOff[w] = on & off;
+        deferred |= (m_pendingOff[w] != 0);
+        for (int b = 0; dirty != 0; ++b, dirty >>= 1) {
+            int n = (w << 5) + b;
+            if ((dirty & 1) == 0 || n >= m_keys.size())
+                continue;
+            PianoKey* key = m_keys[n];
+            if (on & (1U << b)) {
+                if (key->isPressed())
+                    key->update();  // new colour
+                else
+                    key->setPressed(true);
+            } else {
+                key->setPressed(false);
+            }
+        }
+    }
+    if (deferred)
+        m_flushTimer->start();
+}
+
+QRectF PianoScene::getNoteRect( const int note ) const
 {
     int n = note - m_baseOctave*12 - m_transpose;
     if ((note >= m_minNote) && (note <= m_maxNote) &&
         (n >= 0) && (n < m_keys.size()))
-        showKeyOff(m_keys[n], vel);
+        return m_keys[n]->rect();
+    return QRectF();
 }
 
 void PianoScene::triggerNoteOn( const int note, const int vel )
@@ -174,24 +297,23 @@ void PianoScene::triggerNoteOff( const int note, const int vel )
 
 void PianoScene::setColorFromPolicy(PianoKey* key, int vel)
 {
-    QColor c;
+    int i = 0;
     switch (m_palette->paletteId()) {
     case PAL_SINGLE:
-        c = m_palette->getColor(0);
+        i = 0;
         break;
     case PAL_DOUBLE:
-        c = m_palette->getColor(key->getType());
+        i = key->getType();
         break;
     case PAL_CHANNELS:
-        c = m_palette->getColor(m_channel);
+        i = m_channel;
         break;
     case PAL_SCALE:
-        c = m_palette->getColor(key->getDegree());
+        i = key->getDegree();
     }
-    if (c.isValid()) {
-        QBrush h(c.lighter(200 - vel));
+    const QBrush& h = m_palette->getBrush(i, vel);
+    if (h.style() != Qt::NoBrush)
         key->setPressedBrush(h);
-    }
 }
 
 void PianoScene::keyOn( PianoKey* key )
@@ -238,25 +360,106 @@ void PianoScene::keyOff(const int note)
 
 PianoKey* PianoScene::getKeyForPos( const QPointF& p ) const
 {
-    /*
-    QGraphicsItem *itm = itemAt(p);
-    while (itm != NULL && itm->parentItem() != NULL)
-        itm = itm->parentItem();
-    if (itm != NULL) {
-        PianoKey* key = dynamic_cast<PianoKey*>(itm);
+    if (p.x() < 0 || p.y() < 0 || p.y() > KEYHEIGHT)
+        return NULL;
+    int x = qFloor(p.x());
+    if (x >= m_whiteKeyAt.size())
+        return NULL;
+    // black keys are on top; hidden keys are transparent to the pointer
+    if (p.y() <= KEYHEIGHT * 6/10) {
+        PianoKey* key = m_blackKeyAt[x];
+        if (key != NULL && key->isVisible())
+            return key;
+    }
+    PianoKey* key = m_whiteKeyAt[x];
+    if (key != NULL && key->isVisible())
         return key;
-    }
     return NULL;
-    */
+}
+
+/* Touch points are tracked by id, along with the key each one holds, so a
+   move costs a single key lookup unless the point enters another key. Keys
+   held by several fingers sound until the last one leaves them. */
+PianoScene::TouchSlot* PianoScene::findTouch( const int id )
+{
+    for (int t = 0; t < MaxTouchPoints; ++t)
+        if (m_touches[t].id == id)
+            return &m_touches[t];
+    return NULL;
+}
+
+void PianoScene::holdKey( PianoKey* key, const qreal pressure )
+{
+    int n = key->getNote();
+    if (m_touchHolds[n]++ == 0 && !key->isPressed())
+        keyOn(key, pressure);
+}
+
+void PianoScene::releaseKey( PianoKey* key, const qreal pressure )
+{
+    int n = key->getNote();
+    if (m_touchHolds[n] > 0 && --m_touchHolds[n] == 0 && key->isPressed())
+        keyOff(key, pressure);
+}
 
-    PianoKey* key = 0;
-    QList<QGraphicsItem *> ptitems = this->items(p, Qt::IntersectsItemShape, Qt::DescendingOrder);
-    foreach(QGraphicsItem *itm, ptitems) {
-        key = dynamic_cast<PianoKey*>(itm);
-        if (key != 0)
-            break;
+void PianoScene::touchPointPressed( const int id, const QPointF& pos, const qreal pressure )
+{
+    TouchSlot* slot = findTouch(id);
+    if (slot == NULL)
+        slot = findTouch(-1);
+    if (slot == NULL)
+        return;
+    if (slot->key != NULL)
+        releaseKey(slot->key, pressure);
+    slot->id = id;
+    slot->pos = pos;
+    slot->key = getKeyForPos(pos);
+    if (slot->key != NULL) {
+        holdKey(slot->key, pressure);
+        slot->key->ensureVisible();
     }
-    return key;
+}
+
+void PianoScene::touchPointMoved( const int id, const QPointF& pos, const qreal pressure )
+{
+    TouchSlot* slot = findTouch(id);
+    if (slot == NULL) {
+        touchPointPressed(id, pos, pressure);
+        return;
+    }
+    PianoKey* key = getKeyForPos(pos);
+    if (key != slot->key) {
+        // keys skipped between two samples of a fast glissando are played too
+        QPointF delta = pos - slot->pos;
+        int steps = int(qMax(qAbs(delta.x()), qAbs(delta.y())) / TOUCHSTEP);
+        PianoKey* current = slot->key;
+        for (int i = 1; i < steps; ++i) {
+            PianoKey* crossed = getKeyForPos(slot->pos + delta * i / steps);
+            if (crossed != NULL && crossed != current && crossed != key) {
+                if (current != NULL)
+                    releaseKey(current, pressure);
+                holdKey(crossed, pressure);
+                current = crossed;
+            }
+        }
+        if (current != NULL)
+            releaseKey(current, pressure);
+        if (key != NULL)
+            holdKey(key, pressure);
+        slot->key = key;
+    }
+    slot->pos = pos;
+}
+
+void PianoScene::touchPointReleased( const int id, const qreal pressure )
+{
+    TouchSlot* slot = findTouch(id);
+    if (slot == NULL)
+        return;
+    if (slot->key != NULL)
+        releaseKey(slot->key, pressure);
+    slot->id = -1;
+    slot->key = NULL;
 }
 
 void PianoScene::mouseMoveEvent ( QGraphicsSceneMouseEvent * mouseEvent )
@@ -306,16 +509,15 @@ void PianoScene::mouseReleaseEvent ( QGraphicsSceneMouseEvent * mouseEvent )
     //mouseEvent->ignore();
 }
 
+void PianoScene::setKeyboardMap( KeyboardMap* map )
+{
+    m_keybdMap = map;
+    m_keyNotes.build(map);
+}
+
 int PianoScene::getNoteFromKey( const int key ) const
 {
-    if (m_keybdMap != NULL) {
-        KeyboardMap::ConstIterator it = m_keybdMap->constFind(key);
-        if ((it != m_keybdMap->constEnd()) && (it.key() == key)) {
-            int note = it.value();
-            return note;
-        }
-    }
-    return -1;
+    return m_keyNotes.note(key);
 }
 
 PianoKey* PianoScene::getPianoKey( const int key ) const
@@ -369,37 +571,26 @@ bool PianoScene::event(QEvent *event)
                 //case Qt::TouchPointPrimary:
                 case Qt::TouchPointStationary:
                     continue;
-                case Qt::TouchPointReleased: {
-                        PianoKey* key = getKeyForPos(touchPoint.scenePos());
-                        if (key != NULL && key->isPressed()) {
-                            keyOff(key, touchPoint.pressure());
-                        }
-                        break;
-                    }
-                case Qt::TouchPointPressed: {
-                        PianoKey* key = getKeyForPos(touchPoint.scenePos());
-                        if (key != NULL && !key->isPressed()) {
-                            keyOn(key, touchPoint.pressure());
-                            key->ensureVisible();
-                        }
-                        break;
-                    }
-                case Qt::TouchPointMoved: {
-                        PianoKey* key = getKeyForPos(touchPoint.scenePos());
-                        PianoKey* lastkey = getKeyForPos(touchPoint.lastScenePos());
-                        if ((lastkey != NULL) && (lastkey != key) && lastkey->isPressed()) {
-                            keyOff(lastkey, touchPoint.pressure());
-                        }
-                        if ((key != NULL) && !key->isPressed()) {
-                            keyOn(key, touchPoint.pressure());
-                        }
-                        break;
-                    }
+                case Qt::TouchPointReleased:
+                    touchPointReleased(touchPoint.id(), touchPoint.pressure());
+                    break;
+                case Qt::TouchPointPressed:
+                    touchPointPressed(touchPoint.id(), touchPoint.scenePos(), touchPoint.pressure());
+                    break;
+                case Qt::TouchPointMoved:
+                    touchPointMoved(touchPoint.id(), touchPoint.scenePos(), touchPoint.pressure());
+                    break;
                 default:
                     //qDebug() << "TouchPoint state: " << touchPoint.state();
                     break;
                 }
             }
+            // no touch point survives the end of the sequence
+            if (event->type() == QEvent::TouchEnd) {
+                for (int t = 0; t < MaxTouchPoints; ++t)
+                    if (m_touches[t].id != -1)
+                        touchPointReleased(m_touches[t].id, 0);
+            }
             //qDebug() << "accepted event: " << event;
             event->accept();
             return true;
@@ -415,6 +606,11 @@ bool PianoScene::event(QEvent *event)
 
 void PianoScene::allKeysOff()
 {
+    for (int w = 0; w < 4; ++w)
+        m_pendingOn[w] = m_pendingOff[w] = 0;
+    // touches still down press their keys again only when they move
+    for (int k = 0; k < 128; ++k)
+        m_touchHolds[k] = 0;
     QList<PianoKey*>::ConstIterator it; 
     for(it = m_keys.constBegin(); it != m_keys.constEnd(); ++it) {
         (*it)->setPressed(false);
@@ -425,6 +621,7 @@ void PianoScene::setKeyPressedColor(const QColor& color)
 {
     if (color.isValid() && (color != m_keyPressedColor)) {
         m_keyPressedColor = color;
+        PianoKey::clearPixmapCache();
         QBrush hilightBrush(m_keyPressedColor);
         foreach(PianoKey* key, m_keys) {
             key->setPressedBrush(hilightBrush);
@@ -551,6 +748,7 @@ void PianoScene::setRawKeyboardMode(bool b)
 {
     if (m_rawkbd != b) {
         m_rawkbd = b;
+        m_keyNotes.build(m_keybdMap);
 #if defined(RAWKBD_SUPPORT)
         RawKeybdApp* rapp = dynamic_cast<RawKeybdApp*>(qApp);
         if (rapp != NULL) rapp->setRawKbdEnable(m_rawkbd);
@@ -635,5 +833,6 @@ void PianoScene::setPianoPalette(PianoPalette *p)
 {
     //qDebug() << Q_FUNC_INFO;
     resetKeyPressedColor();
+    PianoKey::clearPixmapCache();
     m_palette = p;
 }
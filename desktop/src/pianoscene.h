@@ -26,6 +26,9 @@
 
 #include <QGraphicsScene>
 #include <QHash>
+#include <QVector>
+
+class QTimer;
 
 class PianoHandler
 {
@@ -46,7 +49,7 @@ public:
                  QObject * parent = 0 );
     
     QSize sizeHint() const;
-    void setKeyboardMap( KeyboardMap* map ) { m_keybdMap = map; }
+    void setKeyboardMap( KeyboardMap* map );
     KeyboardMap* getKeyboardMap() const { return m_keybdMap; }
     PianoHandler* getPianoHandler() const { return m_handler; }
     void setPianoHandler(PianoHandler* handler) { m_handler = handler; }
@@ -78,10 +81,12 @@ public:
 
     void showNoteOn( const int note, QColor color, int vel = -1 );
     void showNoteOn( const int note, int vel = -1 );
+    void showNoteOn( const int note, const QBrush& brush );
     void showNoteOff( const int note, int vel = -1 );
     int baseOctave() const { return m_baseOctave; }
     void setBaseOctave( const int base );
     int numOctaves() const { return m_numOctaves; }
+    QRectF getNoteRect( const int note ) const;
     void allKeysOff();
     void keyOn( const int note );
     void keyOff( const int note );
@@ -99,6 +104,9 @@ signals:
     void noteOn(int n, int v);
     void noteOff(int n, int v);
 
+private slots:
+    void flushKeyStates();
+
 protected:
     void showKeyOn( PianoKey* key, QColor color, int vel );
     void showKeyOn( PianoKey* key, int vel );
@@ -119,6 +127,16 @@ protected:
 
 private:
     void hideOrShowKeys();
+    void buildKeyLookup();
+    void queueKeyState( const int n, const bool pressed );
+    struct TouchSlot;
+    TouchSlot* findTouch( const int id );
+    void touchPointPressed( const int id, const QPointF& pos, const qreal pressure );
+    void touchPointMoved( const int id, const QPointF& pos, const qreal pressure );
+    void touchPointReleased( const int id, const qreal pressure );
+    void holdKey( PianoKey* key, const qreal pressure );
+    void releaseKey( PianoKey* key, const qreal pressure );
+    void clearKeyState( const int n );
     void refreshLabels();
     void refreshKeys();
     void triggerNoteOn( const int note, const int vel );
@@ -144,8 +162,24 @@ private:
     bool m_showColorScale;
     PianoHandler* m_handler;
     KeyboardMap* m_keybdMap;
+    KeyNoteTable m_keyNotes;
     QList<PianoKey*> m_keys;
     QList<KeyLabel*> m_labels;
+    QVector<PianoKey*> m_whiteKeyAt;
+    QVector<PianoKey*> m_blackKeyAt;
+    QTimer* m_flushTimer;
+    quint32 m_pendingOn[4];
+    quint32 m_pendingOff[4];
+
+    // active touch points, and the number of them holding each key
+    enum { MaxTouchPoints = 10 };
+    struct TouchSlot {
+        int id;
+        PianoKey* key;
+        QPointF pos;
+    };
+    TouchSlot m_touches[MaxTouchPoints];
+    quint8 m_touchHolds[128];
     QStringList m_noteNames;
     QStringList m_names_s;
     QStringList m_names_f;
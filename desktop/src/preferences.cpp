@@ -48,6 +48,12 @@ Preferences::Preferences(QWidget *parent)
     m_colorDialog(0)
 {
     ui.setupUi( this );
+    m_insPendingIndex = -1;
+    m_insLoading = false;
+    m_insSavedLoading = false;
+    m_insLoader = new InstrumentLoader(this);
+    connect(m_insLoader, SIGNAL(progress(int,int)), SLOT(slotInstrumentsProgress(int,int)));
+    connect(m_insLoader, SIGNAL(finished()), SLOT(slotInstrumentsLoaded()));
     ui.txtFileInstrument->setText(QSTR_DEFAULT);
     ui.txtFileKmap->setText(QSTR_DEFAULT);
     ui.txtFileRawKmap->setText(QSTR_DEFAULT);
@@ -58,6 +64,7 @@ Preferences::Preferences(QWidget *parent)
     connect(ui.btnColor, SIGNAL(clicked()), SLOT(slotSelectColor()));
     connect(ui.btnKmap, SIGNAL(clicked()), SLOT(slotOpenKeymapFile()));
     connect(ui.btnRawKmap, SIGNAL(clicked()), SLOT(slotOpenRawKeymapFile()));
+    connect(ui.btnSoundFont, SIGNAL(clicked()), SLOT(slotOpenSoundFontFile()));
     QPushButton *btnDefaults = ui.buttonBox->button(QDialogButtonBox::RestoreDefaults);
     connect(btnDefaults, SIGNAL(clicked()), SLOT(slotRestoreDefaults()));
 
@@ -79,6 +86,10 @@ Preferences::Preferences(QWidget *parent)
 #endif
 #if defined(NETWORK_MIDI)
     ui.cboMIDIDriver->addItem(QSTR_DRIVERNAMENET);
+    ui.cboMIDIDriver->addItem(QSTR_DRIVERNAMERTP);
+#endif
+#if defined(FLUIDSYNTH_SUPPORT)
+    ui.cboMIDIDriver->addItem(QSTR_DRIVERNAMESYNTH);
 #endif
 
 #if !defined(RAWKBD_SUPPORT)
@@ -87,11 +98,18 @@ Preferences::Preferences(QWidget *parent)
     ui.txtFileRawKmap->setVisible(false);
     ui.btnRawKmap->setVisible(false);
 #endif
+#if !defined(FLUIDSYNTH_SUPPORT)
+    ui.lblSoundFont->setVisible(false);
+    ui.txtFileSoundFont->setVisible(false);
+    ui.btnSoundFont->setVisible(false);
+#endif
 #if !defined(NETWORK_MIDI)
     ui.lblNetworkPort->setVisible(false);
     ui.txtNetworkPort->setVisible(false);
     ui.lblNetworkIface->setVisible(false);
     ui.cboNetworkIface->setVisible(false);
+    ui.lblNetworkPeers->setVisible(false);
+    ui.txtNetworkPeers->setVisible(false);
 #else
     ui.cboNetworkIface->clear();
     ui.cboNetworkIface->addItem(QString());
@@ -135,7 +153,13 @@ void Preferences::showEvent ( QShowEvent *event )
         ui.chkEnableMouse->setChecked( m_enableMouse );
         ui.chkEnableTouch->setChecked( m_enableTouch );
         ui.txtNetworkPort->setText( QString::number( m_networkPort ));
+        ui.txtFileSoundFont->setText( QFileInfo( m_soundFont ).fileName() );
         ui.cboColorPolicy->setCurrentIndex(m_colorDialog->currentPalette()->paletteId());
+        // restored if the dialog is cancelled
+        m_insSavedFileNames = m_insFileNames;
+        m_insSavedName = getInstrumentName();
+        m_insSavedLoading = m_insLoading;
+        m_insSavedFileIns = m_fileIns;
     }
 }
 
@@ -157,9 +181,11 @@ void Preferences::apply()
     if ( ui.txtFileKmap->text().isEmpty() ||
          ui.txtFileKmap->text() == QSTR_DEFAULT)
         m_keymap.setFileName(QSTR_DEFAULT);
+    if ( ui.txtFileSoundFont->text().isEmpty() )
+        m_soundFont.clear();
     if ( ui.txtFileInstrument->text().isEmpty() ||
          ui.txtFileInstrument->text() == QSTR_DEFAULT )
-        m_insFileName = QSTR_DEFAULT;
+        m_insFileNames = QStringList(QSTR_DEFAULT);
     m_drumsChannel = ui.cboDrumsChannel->currentIndex() - 1;
     m_networkPort = ui.txtNetworkPort->text().toInt();
     m_colorDialog->loadPalette(ui.cboColorPolicy->currentIndex());
@@ -168,17 +194,44 @@ void Preferences::apply()
 void Preferences::accept()
 {
     apply();
+    m_insSavedFileIns.clearAll();
     QDialog::accept();
 }
 
+// Instrument definitions opened since the dialog was shown are discarded,
+// whether still loading or not.
+void Preferences::reject()
+{
+    if (m_insFileNames != m_insSavedFileNames) {
+        if (m_insSavedLoading) {
+            // the load in progress when shown was replaced: start it again
+            setInstrumentsFileNames(m_insSavedFileNames);
+            setInstrumentName(m_insSavedName);
+        } else {
+            m_insLoader->cancel();
+            m_insLoading = false;
+            m_insFileNames = m_insSavedFileNames;
+            m_fileIns = m_insSavedFileIns;
+            mergeInstruments();
+            ui.cboInstrument->setEnabled(true);
+            updateInstrumentsFileText();
+            populateInstruments();
+            ui.cboInstrument->setCurrentIndex(ui.cboInstrument->findText(m_insSavedName));
+            emit instrumentsLoaded();
+        }
+    }
+    m_insSavedFileIns.clearAll();
+    QDialog::reject();
+}
+
 void Preferences::slotOpenInstrumentFile()
 {
-    QString fileName = QFileDialog::getOpenFileName(this,
+    QStringList fileNames = QFileDialog::getOpenFileNames(this,
                                 tr("Open instruments definition"),
                                 VPiano::dataDirectory(),
                                 tr("Instrument definitions (*.ins)"));
-    if (!fileName.isEmpty()) {
-        setInstrumentsFileName(fileName);
+    if (!fileNames.isEmpty()) {
+        setInstrumentsFileNames(fileNames);
     }
 }
 
@@ -215,41 +268,134 @@ Instrument* Preferences::getDrumsInstrument()
 
 void Preferences::setInstrumentsFileName( const QString fileName )
 {
-    QFileInfo f(fileName);
-    if (f.isReadable()) {
-        m_ins.clear();
-        ui.cboInstrument->clear();
-        if (m_ins.load(fileName)) {
-            ui.txtFileInstrument->setText(f.fileName());
-            InstrumentList::ConstIterator it;
-            for(it = m_ins.constBegin(); it != m_ins.constEnd(); ++it) {
-                if(!it.key().endsWith(QLatin1String("Drums"), Qt::CaseInsensitive))
-                    ui.cboInstrument->addItem(it.key());
-            }
-            ui.cboInstrument->setCurrentIndex(-1);
-            m_insFileName = fileName;
-        } else {
-            m_insFileName.clear();
-            ui.txtFileInstrument->setText(m_insFileName);
-        }
-    } else {
-        qDebug() << "file" << fileName << "not readable.";
+    setInstrumentsFileNames(QStringList(fileName));
+}
+
+// The files are parsed in the background; until the loader finishes, the
+// instrument combo box is disabled and any requested selection is pending.
+// The current instruments are kept meanwhile, as their Instrument pointers
+// may still be in use.
+void Preferences::setInstrumentsFileNames( const QStringList& fileNames )
+{
+    QStringList files;
+    foreach(const QString& fileName, fileNames) {
+        QFileInfo f(fileName);
+        if (f.isReadable())
+            files.append(fileName);
+        else
+            qDebug() << "file" << fileName << "not readable.";
     }
+    if (files.isEmpty())
+        return;
+    m_insFileNames = files;
+    m_insPendingName.clear();
+    m_insPendingIndex = -1;
+    m_insLoading = true;
+    ui.cboInstrument->clear();
+    ui.cboInstrument->setEnabled(false);
+    ui.txtFileInstrument->setText(tr("Loading..."));
+    m_insLoader->load(files);
 }
 
 QString Preferences::getInstrumentsFileName()
 {
-    return m_insFileName;
+    return m_insFileNames.value(0);
+}
+
+void Preferences::slotInstrumentsProgress(int done, int total)
+{
+    ui.txtFileInstrument->setText(tr("Loading... %1/%2").arg(done).arg(total));
+    emit instrumentsProgress(done, total);
+}
+
+void Preferences::slotInstrumentsLoaded()
+{
+    m_insLoading = false;
+    m_fileIns = m_insLoader->instruments();
+    m_insFileNames = m_fileIns.files();
+    mergeInstruments();
+    ui.cboInstrument->setEnabled(true);
+    updateInstrumentsFileText();
+    populateInstruments();
+    if (m_insPendingName.isEmpty())
+        ui.cboInstrument->setCurrentIndex(m_insPendingIndex);
+    else
+        ui.cboInstrument->setCurrentIndex(ui.cboInstrument->findText(m_insPendingName));
+    m_insPendingName.clear();
+    m_insPendingIndex = -1;
+    emit instrumentsLoaded();
+}
+
+// Instruments built from other sources (the SoundFont catalogue) are
+// merged with the definition files ones; while these are still being
+// loaded, the merge is left to slotInstrumentsLoaded().
+void Preferences::setExtraInstruments( const InstrumentList& instruments )
+{
+    m_extraIns = instruments;
+    if (m_insLoading)
+        return;
+    QString current = ui.cboInstrument->currentText();
+    mergeInstruments();
+    populateInstruments();
+    ui.cboInstrument->setCurrentIndex(ui.cboInstrument->findText(current));
+    emit instrumentsLoaded();
+}
+
+// Replaces the instruments at once: the previous Instrument pointers are
+// invalid from now on, so instrumentsLoaded() must follow. The extra
+// instruments never replace those of the definition files: one already
+// defined there, or its drums counterpart, is left out.
+void Preferences::mergeInstruments()
+{
+    InstrumentList extra = m_extraIns;
+    InstrumentList::ConstIterator it;
+    for (it = m_extraIns.constBegin(); it != m_extraIns.constEnd(); ++it) {
+        QString name = it.key();
+        if (name.endsWith(QLatin1String(" Drums")))
+            name.chop(6);
+        if (m_fileIns.contains(name) || m_fileIns.contains(name + " Drums"))
+            extra.remove(it.key());
+    }
+    m_ins = m_fileIns;
+    m_ins.merge(extra);
+}
+
+void Preferences::updateInstrumentsFileText()
+{
+    if (m_insFileNames.isEmpty()) {
+        ui.txtFileInstrument->clear();
+    } else {
+        QString text = QFileInfo(m_insFileNames.first()).fileName();
+        if (m_insFileNames.count() > 1)
+            text = tr("%1 (+%2 more)").arg(text).arg(m_insFileNames.count() - 1);
+        ui.txtFileInstrument->setText(text);
+    }
+}
+
+void Preferences::populateInstruments()
+{
+    ui.cboInstrument->clear();
+    InstrumentList::ConstIterator it;
+    for(it = m_ins.constBegin(); it != m_ins.constEnd(); ++it) {
+        if(!it.key().endsWith(QLatin1String("Drums"), Qt::CaseInsensitive))
+            ui.cboInstrument->addItem(it.key());
+    }
 }
 
 void Preferences::setInstrumentName( const QString name )
 {
+    if (m_insLoading) {
+        m_insPendingName = name;
+        return;
+    }
     int index = ui.cboInstrument->findText( name );
     ui.cboInstrument->setCurrentIndex( index );
 }
 
 QString Preferences::getInstrumentName()
 {
+    if (m_insLoading)
+        return m_insPendingName;
     return ui.cboInstrument->currentText();
 }
 
@@ -264,6 +410,21 @@ QString Preferences::getNetworkInterfaceName()
     return ui.cboNetworkIface->currentText();
 }
 
+void Preferences::setNetworkPeers(const QStringList& peers)
+{
+    ui.txtNetworkPeers->setText( peers.join(", ") );
+}
+
+QStringList Preferences::getNetworkPeers()
+{
+    QStringList peers;
+    foreach(const QString& peer, ui.txtNetworkPeers->text().split(',', QString::SkipEmptyParts)) {
+        if (!peer.trimmed().isEmpty())
+            peers << peer.trimmed();
+    }
+    return peers;
+}
+
 #ifdef NETWORK_MIDI
 QNetworkInterface Preferences::getNetworkInterface()
 {
@@ -295,6 +456,29 @@ void Preferences::slotOpenRawKeymapFile()
     }
 }
 
+void Preferences::slotOpenSoundFontFile()
+{
+    QString fileName = QFileDialog::getOpenFileName(0,
+                                tr("Open SoundFont"),
+                                QFileInfo(m_soundFont).absolutePath(),
+                                tr("SoundFonts (*.sf2 *.SF2)"));
+    if (!fileName.isEmpty()) {
+        setSoundFontFileName(fileName);
+    }
+}
+
+void Preferences::setSoundFontFileName( const QString fileName )
+{
+    QFileInfo f(fileName);
+    if (f.isReadable()) {
+        m_soundFont = f.absoluteFilePath();
+        ui.txtFileSoundFont->setText(f.fileName());
+    } else {
+        m_soundFont.clear();
+        ui.txtFileSoundFont->clear();
+    }
+}
+
 void Preferences::setRawKeyMapFileName( const QString fileName )
 {
     QFileInfo f(fileName);
@@ -328,14 +512,19 @@ void Preferences::restoreDefaults()
     ui.spinNumOctaves->setValue(DEFAULTNUMBEROFOCTAVES);
     ui.txtFileKmap->setText(QSTR_DEFAULT);
     ui.txtFileRawKmap->setText(QSTR_DEFAULT);
+    ui.txtFileSoundFont->clear();
     ui.chkVelocityColor->setChecked(true);
     ui.chkEnforceChannelState->setChecked(false);
     ui.chkEnableKeyboard->setChecked(true);
     ui.chkEnableMouse->setChecked(true);
     ui.chkEnableTouch->setChecked(true);
     setInstrumentsFileName(VPiano::dataDirectory() + QSTR_DEFAULTINS);
-    ui.cboInstrument->setCurrentIndex(0);
+    if (m_insLoading)
+        m_insPendingIndex = 0;
+    else
+        ui.cboInstrument->setCurrentIndex(0);
     ui.txtNetworkPort->setText(QString::number(NETWORKPORTNUMBER));
+    ui.txtNetworkPeers->clear();
     ui.cboColorPolicy->setCurrentIndex(PAL_SINGLE);
 }
 
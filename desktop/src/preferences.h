@@ -22,6 +22,7 @@
 #include "ui_preferences.h"
 #include "instrument.h"
 #include "keyboardmap.h"
+#include "instrumentloader.h"
 #include <QDialog>
 #ifdef NETWORK_MIDI
 #include <QNetworkInterface>
@@ -50,6 +51,9 @@ public:
 
     void setInstrumentsFileName( const QString fileName );
     QString getInstrumentsFileName();
+    void setInstrumentsFileNames( const QStringList& fileNames );
+    QStringList getInstrumentsFileNames() const { return m_insFileNames; }
+    bool isLoadingInstruments() const { return m_insLoading; }
     void setInstrumentName( const QString name );
     QString getInstrumentName();
 #ifdef NETWORK_MIDI
@@ -57,12 +61,18 @@ public:
 #endif
     QString getNetworkInterfaceName();
     void setNetworkIfaceName(const QString iface);
+    QStringList getNetworkPeers();
+    void setNetworkPeers(const QStringList& peers);
     QString getDriver();
     void apply();
     Instrument* getInstrument();
     Instrument* getDrumsInstrument();
+    const InstrumentList& getInstruments() const { return m_ins; }
+    void setExtraInstruments( const InstrumentList& instruments );
     void setRawKeyMapFileName( const QString fileName );
     void setKeyMapFileName( const QString fileName );
+    void setSoundFontFileName( const QString fileName );
+    QString getSoundFontFileName() const { return m_soundFont; }
     KeyboardMap* getKeyboardMap() { return &m_keymap; }
     KeyboardMap* getRawKeyboardMap() { return &m_rawmap; }
     void retranslateUi();
@@ -86,17 +96,40 @@ public slots:
     void slotSelectColor();
     void slotOpenKeymapFile();
     void slotOpenRawKeymapFile();
+    void slotOpenSoundFontFile();
     void slotRestoreDefaults();
     void accept();
+    void reject();
+
+signals:
+    void instrumentsProgress(int done, int total);
+    void instrumentsLoaded();
+
+private slots:
+    void slotInstrumentsProgress(int done, int total);
+    void slotInstrumentsLoaded();
 
 protected:
     void showEvent ( QShowEvent *event );
     void restoreDefaults();
+    void populateInstruments();
+    void mergeInstruments();
+    void updateInstrumentsFileText();
 
 private:
     Ui::PreferencesClass ui;
-    QString m_insFileName;
+    QStringList m_insFileNames;
+    QString m_insPendingName;
+    int m_insPendingIndex;
+    bool m_insLoading;
+    InstrumentLoader *m_insLoader;
     InstrumentList m_ins;
+    InstrumentList m_fileIns;
+    InstrumentList m_extraIns;
+    QStringList m_insSavedFileNames;
+    QString m_insSavedName;
+    bool m_insSavedLoading;
+    InstrumentList m_insSavedFileIns;
     int m_numOctaves;
     int m_drumsChannel;
     int m_networkPort;
@@ -111,6 +144,7 @@ private:
     bool m_enableTouch;
     KeyboardMap m_keymap;
     KeyboardMap m_rawmap;
+    QString m_soundFont;
     ColorDialog* m_colorDialog;
 };
 
@@ -23,6 +23,7 @@
 #if defined(Q_WS_X11)
 #include <QX11Info>
 #include <X11/Xlib.h>
+#include <X11/XKBlib.h>
 struct qt_auto_repeat_data
 {
     // match the window and keycode with timestamp delta of 10 ms
@@ -72,30 +73,59 @@ static Bool qt_keypress_scanner(Display *, XEvent *event, XPointer arg)
 }
 #endif
 
+/* With XKB detectable auto-repeat, a key held down produces repeated
+   presses and a single release, so a press of a key already down is an
+   auto-repeat and the event queue needs no look ahead. The setting is per
+   client, and Qt's own key events rely on the synthetic releases, so it is
+   only active while the raw keyboard mode is enabled. */
+void RawKeybdApp::setRawKbdEnable(bool b)
+{
+    m_enabled = b;
+    Bool supported = False;
+    if (XkbSetDetectableAutoRepeat(QX11Info::display(), b, &supported) && supported)
+        m_detectableAutoRepeat = b;
+    else
+        m_detectableAutoRepeat = false;
+    for (int i = 0; i < 256; ++i)
+        m_keyDown[i] = false;
+}
+
 bool RawKeybdApp::x11EventFilter ( XEvent * event )
 {
+    if ( m_enabled && event->type == FocusOut ) {
+        // releases are not delivered to other windows
+        for (int i = 0; i < 256; ++i)
+            m_keyDown[i] = false;
+        return false;
+    }
     if ( m_enabled && m_handler != NULL && (event->type == KeyPress || event->type == KeyRelease )) {
         bool autorepeat = false;
-        Display *dpy =  QX11Info::display();
-        // was this the last auto-repeater?
-        qt_auto_repeat_data auto_repeat_data;
-        auto_repeat_data.window = event->xkey.window;
-        auto_repeat_data.keycode = event->xkey.keycode;
-        auto_repeat_data.timestamp = event->xkey.time;
-        static uint curr_autorep = 0;
-        if (event->type == KeyPress) {
-            if (curr_autorep == event->xkey.keycode) {
-                autorepeat = true;
-                curr_autorep = 0;
-            }
+        if (m_detectableAutoRepeat) {
+            bool &down = m_keyDown[event->xkey.keycode & 0xff];
+            autorepeat = (event->type == KeyPress) && down;
+            down = (event->type == KeyPress);
         } else {
-            // look ahead for auto-repeat
-            XEvent nextpress;
-            auto_repeat_data.release = true;
-            auto_repeat_data.error = false;
-            autorepeat = XCheckIfEvent( dpy, &nextpress, &qt_keypress_scanner,
-                                        (XPointer) &auto_repeat_data );
-            curr_autorep = autorepeat ? event->xkey.keycode : 0;
+            Display *dpy =  QX11Info::display();
+            // was this the last auto-repeater?
+            qt_auto_repeat_data auto_repeat_data;
+            auto_repeat_data.window = event->xkey.window;
+            auto_repeat_data.keycode = event->xkey.keycode;
+            auto_repeat_data.timestamp = event->xkey.time;
+            static uint curr_autorep = 0;
+            if (event->type == KeyPress) {
+                if (curr_autorep == event->xkey.keycode) {
+                    autorepeat = true;
+                    curr_autorep = 0;
+                }
+            } else {
+                // look ahead for auto-repeat
+                XEvent nextpress;
+                auto_repeat_data.release = true;
+                auto_repeat_data.error = false;
+                autorepeat = XCheckIfEvent( dpy, &nextpress, &qt_keypress_scanner,
+                                            (XPointer) &auto_repeat_data );
+                curr_autorep = autorepeat ? event->xkey.keycode : 0;
+            }
         }
         if (!autorepeat) {
             if (event->type == KeyPress)
@@ -33,16 +33,22 @@ class VPIANO_EXPORT RawKeybdApp : public QApplication
 {
 public:
     RawKeybdApp( int & argc, char ** argv ) : QApplication(argc, argv),
-        m_enabled(false), m_handler(NULL) {}
+        m_enabled(false), m_handler(NULL), m_detectableAutoRepeat(false)
+    {
+        for (int i = 0; i < 256; ++i)
+            m_keyDown[i] = false;
+    }
     virtual ~RawKeybdApp() {}
 
     RawKbdHandler *getRawKbdHandler() { return m_handler; }
     void setRawKbdHandler(RawKbdHandler* h) { m_handler = h; }
     bool getRawKbdEnable() { return m_enabled; }
-    void setRawKbdEnable(bool b) { m_enabled = b; }
 
 #if defined(Q_WS_X11)
+    void setRawKbdEnable(bool b);
     bool x11EventFilter ( XEvent * event );
+#else
+    void setRawKbdEnable(bool b) { m_enabled = b; }
 #endif
 
 #if defined(Q_WS_MAC)
@@ -56,6 +62,9 @@ public:
 private:
     bool m_enabled;
     RawKbdHandler *m_handler;
+    // X11: the server reports auto-repeat as presses only (no releases)
+    bool m_detectableAutoRepeat;
+    bool m_keyDown[256];
 };
 
 #endif // RAWKEYBDAPP_H
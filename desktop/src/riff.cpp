@@ -17,12 +17,16 @@
 */
 
 #include <QFile>
+#include <QtEndian>
 #include <QDebug>
 
 #include "riff.h"
 
 Riff::Riff(QObject* parent) :
-    QObject(parent)
+    QObject(parent),
+    m_IOStream(0),
+    m_map(0),
+    m_mapSize(0)
 {}
 
 Riff::~Riff()
@@ -40,8 +44,16 @@ void Riff::readFromFile(QString fileName)
 {
     QFile file(m_fileName = fileName);
     file.open(QIODevice::ReadOnly);
-    QDataStream ds(&file);
-    readFromStream(&ds);
+    // The file is mapped (it may not fit in a 32 bit address space, though)
+    // only to jump over the chunks: sample data pages are never touched.
+    uchar *data = (file.size() > 0) ? file.map(0, file.size()) : 0;
+    if (data != 0) {
+        readFromMemory(data, file.size());
+        file.unmap(data);
+    } else {
+        QDataStream ds(&file);
+        readFromStream(&ds);
+    }
     file.close();
 }
 
@@ -359,3 +371,197 @@ void Riff::read()
         }
     }
 }
+
+/* Memory mapped chunk walker: same traversal and signals as above, with
+   every chunk reached through its offset and clamped to its parent. */
+
+void Riff::readFromMemory(const uchar* data, quint64 size)
+{
+    m_map = data;
+    m_mapSize = size;
+    if (size >= 12 && map32bit(0) == CKID_RIFF) {
+        quint64 length = qMin<quint64>(map32bit(4), size - 8);
+        if (length >= 4) {
+            switch(map32bit(8)) {
+            case CKID_DLS:
+                mapDLS(12, length - 4);
+                break;
+            case CKID_SFBK:
+                mapSF(12, length - 4);
+                break;
+            default:
+                qWarning() << "Unsupported format";
+            }
+        }
+    }
+    m_map = 0;
+    m_mapSize = 0;
+}
+
+quint16 Riff::map16bit(quint64 pos) const
+{
+    return qFromLittleEndian<quint16>(m_map + pos);
+}
+
+quint32 Riff::map32bit(quint64 pos) const
+{
+    return qFromLittleEndian<quint32>(m_map + pos);
+}
+
+QString Riff::mapstr(quint64 pos, quint64 size) const
+{
+    return QString(QByteArray((const char *) m_map + pos, int(size))).trimmed();
+}
+
+bool Riff::mapChunk(quint64& pos, quint64 end, quint32& ckid, quint64& ckpos, quint64& cklen)
+{
+    if (end > m_mapSize)
+        end = m_mapSize;
+    if (pos + 8 > end)
+        return false;
+    ckid = map32bit(pos);
+    cklen = map32bit(pos + 4);
+    ckpos = pos + 8;
+    if (cklen > end - ckpos)
+        cklen = end - ckpos;
+    pos = ckpos + cklen + (cklen & 1);
+    return true;
+}
+
+void Riff::mapINFO(quint64 pos, quint64 size)
+{
+    quint32 chunkID;
+    quint64 ck, length, end = pos + size;
+    while (mapChunk(pos, end, chunkID, ck, length)) {
+        switch (chunkID) {
+        case CKID_IFIL:
+            if (length >= 4)
+                m_version = QString("%1.%2").arg(map16bit(ck)).arg(map16bit(ck + 2));
+            break;
+        case CKID_INAM:
+            m_name = mapstr(ck, length);
+            break;
+        case CKID_ICOP:
+            m_copyright = mapstr(ck, length);
+            break;
+        }
+    }
+}
+
+void Riff::mapPHDR(quint64 pos, quint64 size)
+{
+    int npresets = int(size / 38) - 1;
+    for (int i = 0; i < npresets; ++i, pos += 38) {
+        QString name = QString(QByteArray((const char *) m_map + pos, 20));
+        int pc = map16bit(pos + 20);
+        int bank = map16bit(pos + 22);
+        if (bank < 128)
+            emit signalInstrument(bank, pc, name);
+        else
+            emit signalPercussion(bank, pc, name);
+    }
+}
+
+void Riff::mapPDTA(quint64 pos, quint64 size)
+{
+    quint32 chunkID;
+    quint64 ck, length, end = pos + size;
+    while (mapChunk(pos, end, chunkID, ck, length)) {
+        if (chunkID == CKID_PHDR)
+            mapPHDR(ck, length);
+    }
+}
+
+void Riff::mapSF(quint64 pos, quint64 size)
+{
+    quint32 chunkID;
+    quint64 ck, length, end = pos + size;
+    while (mapChunk(pos, end, chunkID, ck, length)) {
+        if (chunkID == CKID_LIST && length >= 4) {
+            switch (map32bit(ck)) {
+            case CKID_INFO:
+                mapINFO(ck + 4, length - 4);
+                break;
+            case CKID_PDTA:
+                mapPDTA(ck + 4, length - 4);
+                break;
+            }
+        }
+    }
+    emit signalSoundFont(m_name, m_version, m_copyright);
+}
+
+void Riff::mapINS(quint64 pos, quint64 size)
+{
+    bool perc = false;
+    quint32 bank = 0, pc = 0;
+    quint32 chunkID;
+    quint64 ck, length, end = pos + size;
+    while (mapChunk(pos, end, chunkID, ck, length)) {
+        switch (chunkID) {
+        case CKID_INSH:
+            if (length >= 12) {
+                bank = map32bit(ck + 4);
+                pc = map32bit(ck + 8);
+                perc = (bank & 0x80000000) != 0;
+                bank &= 0x3FFF;
+            }
+            break;
+        case CKID_LIST:
+            mapDLSList(ck, length);
+            break;
+        }
+    }
+    if (perc)
+        emit signalPercussion(bank, pc, m_name);
+    else
+        emit signalInstrument(bank, pc, m_name);
+    m_name.clear();
+    m_copyright.clear();
+}
+
+void Riff::mapLINS(quint64 pos, quint64 size)
+{
+    quint32 chunkID;
+    quint64 ck, length, end = pos + size;
+    while (mapChunk(pos, end, chunkID, ck, length)) {
+        if (chunkID == CKID_LIST)
+            mapDLSList(ck, length);
+    }
+}
+
+void Riff::mapDLSList(quint64 pos, quint64 size)
+{
+    if (size < 4)
+        return;
+    switch (map32bit(pos)) {
+    case CKID_INFO:
+        mapINFO(pos + 4, size - 4);
+        break;
+    case CKID_LINS:
+        mapLINS(pos + 4, size - 4);
+        break;
+    case CKID_INS:
+        mapINS(pos + 4, size - 4);
+        break;
+    }
+}
+
+void Riff::mapDLS(quint64 pos, quint64 size)
+{
+    quint32 chunkID;
+    quint64 ck, length, end = pos + size;
+    while (mapChunk(pos, end, chunkID, ck, length)) {
+        switch (chunkID) {
+        case CKID_VERS:
+            if (length >= 8)
+                m_version = QString("%1.%2.%3.%4").arg(map16bit(ck))
+                        .arg(map16bit(ck + 2)).arg(map16bit(ck + 4)).arg(map16bit(ck + 6));
+            break;
+        case CKID_LIST:
+            mapDLSList(ck, length);
+            break;
+        }
+    }
+    emit signalDLS(m_name, m_version, m_copyright);
+}
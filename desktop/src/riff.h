@@ -49,6 +49,7 @@ public:
     virtual ~Riff();
     void readFromFile(QString fileName);
     void readFromStream(QDataStream* ds);
+    void readFromMemory(const uchar* data, quint64 size);
 
 signals:
     void signalSoundFont(QString name, QString version, QString copyright);
@@ -80,8 +81,23 @@ private:
     quint32 read32bit();
     QString readstr(int size);
     void skip(int size);
+    /* memory mapped chunk walker */
+    bool mapChunk(quint64& pos, quint64 end, quint32& ckid, quint64& ckpos, quint64& cklen);
+    quint16 map16bit(quint64 pos) const;
+    quint32 map32bit(quint64 pos) const;
+    QString mapstr(quint64 pos, quint64 size) const;
+    void mapSF(quint64 pos, quint64 size);
+    void mapPDTA(quint64 pos, quint64 size);
+    void mapPHDR(quint64 pos, quint64 size);
+    void mapDLS(quint64 pos, quint64 size);
+    void mapDLSList(quint64 pos, quint64 size);
+    void mapLINS(quint64 pos, quint64 size);
+    void mapINS(quint64 pos, quint64 size);
+    void mapINFO(quint64 pos, quint64 size);
 
     QDataStream *m_IOStream;
+    const uchar *m_map;
+    quint64 m_mapSize;
     QString m_fileName;
     QString m_name;
     QString m_copyright;
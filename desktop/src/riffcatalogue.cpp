@@ -0,0 +1,322 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtConcurrentRun>
+#include <QtConcurrentMap>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QFile>
+#include <QDir>
+#include <QDesktopServices>
+
+#include "riffcatalogue.h"
+#include "riff.h"
+#include "instrument.h"
+
+static const quint32 CATALOGUE_MAGIC = 0x564d5243; // VMRC
+static const quint32 CATALOGUE_VERSION = 1;
+
+static QDataStream& operator<<(QDataStream& ds, const RiffPreset& p)
+{
+    return ds << qint32(p.bank) << qint32(p.program) << p.percussion << p.name;
+}
+
+static QDataStream& operator>>(QDataStream& ds, RiffPreset& p)
+{
+    qint32 bank, program;
+    ds >> bank >> program >> p.percussion >> p.name;
+    p.bank = bank;
+    p.program = program;
+    return ds;
+}
+
+static QDataStream& operator<<(QDataStream& ds, const RiffCatalogueEntry& e)
+{
+    return ds << e.path << e.size << e.modified << e.name
+              << e.version << e.copyright << e.presets;
+}
+
+static QDataStream& operator>>(QDataStream& ds, RiffCatalogueEntry& e)
+{
+    return ds >> e.path >> e.size >> e.modified >> e.name
+              >> e.version >> e.copyright >> e.presets;
+}
+
+/* Worker thread: every SoundFont/DLS file below the given directories,
+   with its size and modification time but no presets yet */
+static QList<RiffCatalogueEntry> listRiffFiles(const QStringList& dirs)
+{
+    QList<RiffCatalogueEntry> files;
+    QStringList filters;
+    filters << "*.sf2" << "*.sbk" << "*.dls";
+    foreach(const QString& dir, dirs) {
+        QDirIterator it(dir, filters, QDir::Files | QDir::Readable,
+                        QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
+        while (it.hasNext()) {
+            it.next();
+            QFileInfo info = it.fileInfo();
+            RiffCatalogueEntry e;
+            e.path = info.absoluteFilePath();
+            e.size = info.size();
+            e.modified = info.lastModified().toMSecsSinceEpoch();
+            files.append(e);
+        }
+    }
+    return files;
+}
+
+/* Worker thread: read the preset headers of a single file */
+static RiffCatalogueEntry importRiffFile(const RiffCatalogueEntry& file)
+{
+    RiffCatalogueEntry e(file);
+    Riff riff;
+    RiffCollector collector(&e);
+    QObject::connect(&riff, SIGNAL(signalInstrument(int,int,QString)),
+                     &collector, SLOT(slotInstrument(int,int,QString)));
+    QObject::connect(&riff, SIGNAL(signalPercussion(int,int,QString)),
+                     &collector, SLOT(slotPercussion(int,int,QString)));
+    QObject::connect(&riff, SIGNAL(signalSoundFont(QString,QString,QString)),
+                     &collector, SLOT(slotCompleted(QString,QString,QString)));
+    QObject::connect(&riff, SIGNAL(signalDLS(QString,QString,QString)),
+                     &collector, SLOT(slotCompleted(QString,QString,QString)));
+    riff.readFromFile(e.path);
+    return e;
+}
+
+void RiffCollector::slotInstrument(int bank, int pc, QString name)
+{
+    RiffPreset p;
+    p.bank = bank;
+    p.program = pc;
+    p.percussion = false;
+    p.name = name;
+    m_entry->presets.append(p);
+}
+
+void RiffCollector::slotPercussion(int bank, int pc, QString name)
+{
+    RiffPreset p;
+    p.bank = bank;
+    p.program = pc;
+    p.percussion = true;
+    p.name = name;
+    m_entry->presets.append(p);
+}
+
+void RiffCollector::slotCompleted(QString name, QString version, QString copyright)
+{
+    m_entry->name = name;
+    m_entry->version = version;
+    m_entry->copyright = copyright;
+}
+
+RiffCatalogue::RiffCatalogue(QObject *parent)
+    : QObject(parent),
+    m_scanning(false)
+{
+    m_lister = new QFutureWatcher<QList<RiffCatalogueEntry> >(this);
+    m_importer = new QFutureWatcher<RiffCatalogueEntry>(this);
+    connect(m_lister, SIGNAL(finished()), SLOT(slotListed()));
+    connect(m_importer, SIGNAL(progressValueChanged(int)), SLOT(slotProgress(int)));
+    connect(m_importer, SIGNAL(finished()), SLOT(slotImported()));
+}
+
+RiffCatalogue::~RiffCatalogue()
+{
+    cancel();
+}
+
+QString RiffCatalogue::fileName()
+{
+    QDir dir(QDesktopServices::storageLocation(QDesktopServices::DataLocation));
+    return dir.absoluteFilePath("soundfonts.catalogue");
+}
+
+bool RiffCatalogue::load()
+{
+    QFile file(fileName());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream ds(&file);
+    ds.setVersion(QDataStream::Qt_4_0);
+    quint32 magic, version;
+    ds >> magic >> version;
+    if (magic != CATALOGUE_MAGIC || version != CATALOGUE_VERSION)
+        return false;
+    QList<RiffCatalogueEntry> entries;
+    ds >> entries;
+    if (ds.status() != QDataStream::Ok)
+        return false;
+    m_entries.clear();
+    foreach(const RiffCatalogueEntry& e, entries)
+        m_entries.insert(e.path, e);
+    return true;
+}
+
+bool RiffCatalogue::save() const
+{
+    QFileInfo info(fileName());
+    if (!QDir().mkpath(info.absolutePath()))
+        return false;
+    QFile file(info.absoluteFilePath());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    QDataStream ds(&file);
+    ds.setVersion(QDataStream::Qt_4_0);
+    ds << CATALOGUE_MAGIC << CATALOGUE_VERSION << m_entries.values();
+    return (ds.status() == QDataStream::Ok);
+}
+
+void RiffCatalogue::scan(const QStringList& dirs)
+{
+    cancel();
+    m_scanning = true;
+    m_lister->setFuture(QtConcurrent::run(listRiffFiles, dirs));
+}
+
+void RiffCatalogue::cancel()
+{
+    if (m_lister->isRunning())
+        m_lister->waitForFinished();
+    if (m_importer->isRunning()) {
+        m_importer->cancel();
+        m_importer->waitForFinished();
+    }
+    m_scanning = false;
+}
+
+/* Unchanged files keep their catalogue entry, files no longer found are
+   dropped, and only new or modified files are read */
+void RiffCatalogue::slotListed()
+{
+    if (!m_scanning)
+        return;
+    QList<RiffCatalogueEntry> files = m_lister->result();
+    m_next.clear();
+    m_changed.clear();
+    foreach(const RiffCatalogueEntry& f, files) {
+        QMap<QString, RiffCatalogueEntry>::ConstIterator it = m_entries.constFind(f.path);
+        if (it != m_entries.constEnd() && it->size == f.size && it->modified == f.modified)
+            m_next.insert(f.path, it.value());
+        else
+            m_changed.append(f);
+    }
+    if (m_changed.isEmpty()) {
+        m_scanning = false;
+        if (m_next.count() != m_entries.count()) {
+            m_entries = m_next;
+            save();
+        }
+        m_next.clear();
+        emit finished();
+    } else {
+        emit progress(0, m_changed.count());
+        m_importer->setFuture(QtConcurrent::mapped(m_changed, importRiffFile));
+    }
+}
+
+void RiffCatalogue::slotProgress(int value)
+{
+    emit progress(value, m_changed.count());
+}
+
+void RiffCatalogue::slotImported()
+{
+    if (!m_scanning || m_importer->isCanceled())
+        return;
+    QFuture<RiffCatalogueEntry> future = m_importer->future();
+    for (int i = 0; i < m_changed.count(); ++i) {
+        if (future.isResultReadyAt(i)) {
+            const RiffCatalogueEntry& e = future.resultAt(i);
+            m_next.insert(e.path, e);
+        }
+    }
+    m_importer->setFuture(QFuture<RiffCatalogueEntry>());
+    m_entries = m_next;
+    m_next.clear();
+    m_changed.clear();
+    m_scanning = false;
+    save();
+    emit finished();
+}
+
+/* One instrument per file, named after the SoundFont, plus a "Drums"
+   instrument for the percussion presets; SoundFont percussion banks
+   (128 and above) are selected as banks 0 and above on the drums channel */
+void RiffCatalogue::buildInstruments(InstrumentList& list) const
+{
+    static const struct { int number; const char *name; } controllers[] = {
+        { 1, "1-Modulation" }, { 2, "2-Breath" }, { 4, "4-Foot controller" },
+        { 5, "5-Portamento time" }, { 7, "7-Volume" }, { 8, "8-Balance" },
+        { 10, "10-Pan" }, { 11, "11-Expression" }, { 64, "64-Pedal (sustain)" },
+        { 65, "65-Portamento" }, { 66, "66-Pedal (sostenuto)" },
+        { 67, "67-Pedal (soft)" }, { 69, "69-Hold 2" },
+        { 91, "91-External Effects depth" }, { 92, "92-Tremolo depth" },
+        { 93, "93-Chorus depth" }, { 94, "94-Celeste (detune) depth" },
+        { 95, "95-Phaser depth" }
+    };
+    const QString controlName("SoundFont Standard");
+    InstrumentData& control = list.controller(controlName);
+    control.setName(controlName);
+    for (unsigned int i = 0; i < sizeof(controllers) / sizeof(controllers[0]); ++i)
+        control.setValue(controllers[i].number, QString::fromLatin1(controllers[i].name));
+
+    foreach(const RiffCatalogueEntry& e, m_entries) {
+        if (e.presets.isEmpty())
+            continue;
+        QString name = e.name.simplified();
+        if (name.isEmpty())
+            name = QFileInfo(e.path).completeBaseName();
+        if (list.contains(name) || list.contains(name + " Drums"))
+            name = QString("%1 (%2)").arg(name, QFileInfo(e.path).fileName());
+        const QString drumsName = name + " Drums";
+        QMap<int, QString> melodicBanks, drumBanks;
+        foreach(const RiffPreset& p, e.presets) {
+            int bank = p.bank;
+            QString patchName;
+            if (p.percussion) {
+                if (bank >= 128)
+                    bank -= 128;
+                patchName = QString("%1 Bank%2").arg(drumsName).arg(bank);
+                drumBanks.insert(bank, patchName);
+                list[drumsName].setDrum(bank, p.program, true);
+            } else {
+                patchName = QString("%1 Bank%2").arg(name).arg(bank);
+                melodicBanks.insert(bank, patchName);
+            }
+            InstrumentData& patch = list.patch(patchName);
+            patch.setName(patchName);
+            patch.setValue(p.program, p.name);
+        }
+        Instrument& instr = list[name];
+        instr.setInstrumentName(name);
+        instr.setControl(control);
+        QMap<int, QString>::ConstIterator it;
+        for (it = melodicBanks.constBegin(); it != melodicBanks.constEnd(); ++it)
+            instr.setPatch(it.key(), list.patch(it.value()));
+        if (!drumBanks.isEmpty()) {
+            Instrument& drums = list[drumsName];
+            drums.setInstrumentName(drumsName);
+            drums.setControl(control);
+            for (it = drumBanks.constBegin(); it != drumBanks.constEnd(); ++it)
+                drums.setPatch(it.key(), list.patch(it.value()));
+        }
+    }
+}
@@ -0,0 +1,112 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RIFFCATALOGUE_H
+#define RIFFCATALOGUE_H
+
+#include <QObject>
+#include <QStringList>
+#include <QList>
+#include <QMap>
+#include <QFutureWatcher>
+
+class InstrumentList;
+
+struct RiffPreset
+{
+    int bank;
+    int program;
+    bool percussion;
+    QString name;
+};
+
+struct RiffCatalogueEntry
+{
+    QString path;
+    qint64 size;
+    qint64 modified;
+    QString name;
+    QString version;
+    QString copyright;
+    QList<RiffPreset> presets;
+};
+
+/**
+ * Persistent catalogue of the preset names found in directories of
+ * SoundFont (.sf2, .sbk) and DLS files.
+ *
+ * Directories are scanned and files parsed on worker threads. Every file
+ * is recorded along with its size and modification time, so unchanged
+ * files are never read again. The catalogue is saved in the application
+ * data location, and it can be turned into instrument definitions.
+ */
+class RiffCatalogue : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit RiffCatalogue(QObject *parent = 0);
+    virtual ~RiffCatalogue();
+
+    bool load();
+    bool save() const;
+    void scan(const QStringList& dirs);
+    void cancel();
+    bool isScanning() const { return m_scanning; }
+
+    const QMap<QString, RiffCatalogueEntry>& entries() const { return m_entries; }
+    void buildInstruments(InstrumentList& list) const;
+
+signals:
+    void progress(int done, int total);
+    void finished();
+
+private slots:
+    void slotListed();
+    void slotProgress(int value);
+    void slotImported();
+
+private:
+    static QString fileName();
+
+    QFutureWatcher<QList<RiffCatalogueEntry> > *m_lister;
+    QFutureWatcher<RiffCatalogueEntry> *m_importer;
+    QMap<QString, RiffCatalogueEntry> m_entries;
+    QMap<QString, RiffCatalogueEntry> m_next;
+    QList<RiffCatalogueEntry> m_changed;
+    bool m_scanning;
+};
+
+/* Collects the signals of a Riff parser running on a worker thread */
+class RiffCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit RiffCollector(RiffCatalogueEntry *entry) : m_entry(entry) {}
+
+public slots:
+    void slotInstrument(int bank, int pc, QString name);
+    void slotPercussion(int bank, int pc, QString name);
+    void slotCompleted(QString name, QString version, QString copyright);
+
+private:
+    RiffCatalogueEntry *m_entry;
+};
+
+#endif // RIFFCATALOGUE_H
@@ -0,0 +1,1152 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ *  RTP-MIDI transport: RFC 6295 payload format (delta time command lists
+ *  and recovery journal) over the AppleMIDI session initiation protocol.
+ */
+
+#if defined(NETWORK_MIDI)
+
+#include <sstream>
+#include <cstring>
+
+#include <QTimer>
+#include <QUdpSocket>
+#include <QNetworkInterface>
+#include <QMutexLocker>
+#include <QDateTime>
+#include <QDebug>
+
+#include "rtpmidi.h"
+#include "netsettings.h"
+#include "mididefs.h"
+#include "constants.h"
+
+/* AppleMIDI session protocol */
+static const quint16 APPLEMIDI_SIGNATURE = 0xffff;
+static const quint32 APPLEMIDI_VERSION = 2;
+/* dynamic RTP payload type conventionally used for MIDI */
+static const quint8 RTPMIDI_PAYLOAD_TYPE = 0x61;
+/* RTP clock: 10 kHz, as used by the AppleMIDI implementations */
+static const quint64 RTPMIDI_CLOCK_RATE = 10000;
+/* keep packets well under a typical MTU */
+static const int RTPMIDI_MAX_COMMANDS = 1024;
+static const int RTPMIDI_MAX_SYSEX_SEGMENT = 512;
+static const int RTPMIDI_INVITE_RETRIES = 12;
+static const int RTPMIDI_TIMER_INTERVAL = 1000;
+static const int RTPMIDI_PORT_ATTEMPTS = 8;
+
+static void putUInt16(QByteArray &buf, quint16 v)
+{
+    buf.append(char(v >> 8));
+    buf.append(char(v & 0xff));
+}
+
+static void putUInt32(QByteArray &buf, quint32 v)
+{
+    putUInt16(buf, quint16(v >> 16));
+    putUInt16(buf, quint16(v & 0xffff));
+}
+
+static void putUInt64(QByteArray &buf, quint64 v)
+{
+    putUInt32(buf, quint32(v >> 32));
+    putUInt32(buf, quint32(v & 0xffffffff));
+}
+
+static quint16 getUInt16(const quint8 *p)
+{
+    return (quint16(p[0]) << 8) | p[1];
+}
+
+static quint32 getUInt32(const quint8 *p)
+{
+    return (quint32(getUInt16(p)) << 16) | getUInt16(p + 2);
+}
+
+static quint64 getUInt64(const quint8 *p)
+{
+    return (quint64(getUInt32(p)) << 32) | getUInt32(p + 4);
+}
+
+/* Length of a MIDI command, given its status byte. Zero means variable (sysex). */
+static int commandLength(quint8 status)
+{
+    switch (status & MASK_STATUS) {
+    case STATUS_NOTEOFF:
+    case STATUS_NOTEON:
+    case STATUS_POLYAFT:
+    case STATUS_CTLCHG:
+    case STATUS_BENDER:
+        return 3;
+    case STATUS_PROGRAM:
+    case STATUS_CHANAFT:
+        return 2;
+    }
+    switch (status) {
+    case 0xf0:
+        return 0;
+    case 0xf1:
+    case 0xf3:
+        return 2;
+    case 0xf2:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+/* RtpMidiSession */
+
+RtpMidiSession *RtpMidiSession::s_instance = 0;
+int RtpMidiSession::s_refCount = 0;
+
+RtpMidiSession *RtpMidiSession::acquire()
+{
+    if (s_instance == 0)
+        s_instance = new RtpMidiSession;
+    s_refCount++;
+    return s_instance;
+}
+
+void RtpMidiSession::release()
+{
+    if (--s_refCount == 0) {
+        delete s_instance;
+        s_instance = 0;
+    }
+}
+
+void RtpMidiSession::ChannelState::reset()
+{
+    ::memset(velocity, 0, sizeof(velocity));
+    ::memset(noteDirty, 0, sizeof(noteDirty));
+    ::memset(control, -1, sizeof(control));
+    ::memset(ctlDirty, 0, sizeof(ctlDirty));
+    ::memset(noteSeq, 0, sizeof(noteSeq));
+    ::memset(ctlSeq, 0, sizeof(ctlSeq));
+    dirty = false;
+}
+
+RtpMidiSession::RtpMidiSession() : QObject(0),
+    m_control(0),
+    m_data(0),
+    m_controlPort(0),
+    m_seq(0),
+    m_openCount(0),
+    m_input(0),
+    m_commandCount(0),
+    m_packetTime(0),
+    m_lastCommandTime(0),
+    m_flushPending(false),
+    m_checkpoint(0)
+{
+    qsrand(QDateTime::currentDateTime().toTime_t() ^ quintptr(this));
+    m_ssrc = (quint32(qrand()) << 16) ^ quint32(qrand());
+    m_seq = quint16(qrand());
+    m_checkpoint = quint16(m_seq - 1);
+    m_clock.start();
+    m_timer = new QTimer(this);
+    m_timer->setInterval(RTPMIDI_TIMER_INTERVAL);
+    connect(m_timer, SIGNAL(timeout()), SLOT(slotTimeout()));
+}
+
+RtpMidiSession::~RtpMidiSession()
+{
+    m_openCount = 1;
+    close();
+}
+
+quint64 RtpMidiSession::now() const
+{
+    return quint64(m_clock.nsecsElapsed()) / (1000000000 / RTPMIDI_CLOCK_RATE);
+}
+
+int RtpMidiSession::participants() const
+{
+    int count = 0;
+    foreach(const Participant *p, m_participants)
+        if (p->state == Participant::Connected)
+            count++;
+    return count;
+}
+
+void RtpMidiSession::setInput(RtpMidiIn *input)
+{
+    m_input = input;
+}
+
+void RtpMidiSession::open()
+{
+    if (m_openCount++ > 0)
+        return;
+
+    int basePort = NetworkSettings::instance().port();
+    m_control = new QUdpSocket(this);
+    m_data = new QUdpSocket(this);
+    // a second instance on the same host picks the next free pair of ports
+    for (int i = 0; i < RTPMIDI_PORT_ATTEMPTS; ++i) {
+        quint16 port = quint16(basePort + 2 * i);
+        if (m_control->bind(port, QUdpSocket::DontShareAddress)) {
+            if (m_data->bind(port + 1, QUdpSocket::DontShareAddress)) {
+                m_controlPort = port;
+                break;
+            }
+            m_control->close();
+        }
+    }
+    if (m_controlPort == 0) {
+        qWarning() << "RtpMidiSession: cannot bind any UDP port pair from" << basePort;
+        delete m_control;
+        delete m_data;
+        m_control = m_data = 0;
+        m_openCount = 0;
+        return;
+    }
+    connect(m_control, SIGNAL(readyRead()), SLOT(readControl()));
+    connect(m_data, SIGNAL(readyRead()), SLOT(readData()));
+
+    // host names are resolved asynchronously, not to block the GUI thread
+    foreach(const NetworkPeer& peer, NetworkSettings::instance().parsePeers()) {
+        if (peer.address.isNull()) {
+            int id = QHostInfo::lookupHost(peer.host, this, SLOT(slotHostFound(QHostInfo)));
+            m_lookups.insert(id, peer);
+        } else {
+            addParticipant(peer);
+        }
+    }
+    invitePeers();
+    m_timer->start();
+}
+
+void RtpMidiSession::slotHostFound(const QHostInfo &info)
+{
+    if (!m_lookups.contains(info.lookupId()))
+        return;
+    NetworkPeer peer = m_lookups.take(info.lookupId());
+    if (info.error() != QHostInfo::NoError || info.addresses().isEmpty()) {
+        qWarning() << "RtpMidiSession: cannot resolve peer" << peer.host;
+        return;
+    }
+    peer.address = info.addresses().first();
+    addParticipant(peer);
+    invitePeers();
+}
+
+void RtpMidiSession::addParticipant(const NetworkPeer &peer)
+{
+    // multicast groups are meaningless for a RTP-MIDI session
+    if (peer.isMulticast())
+        return;
+    QHostAddress address = peer.address;
+    quint16 port = peer.port;
+    bool local = (address == QHostAddress::LocalHost) ||
+                 QNetworkInterface::allAddresses().contains(address);
+    if (local && port == m_controlPort)
+        return;
+    if (findParticipant(address, port, false) != 0)
+        return;
+    Participant *p = new Participant;
+    p->address = address;
+    p->port = port;
+    p->ssrc = 0;
+    p->token = (quint32(qrand()) << 16) ^ quint32(qrand());
+    p->state = Participant::InviteControl;
+    p->retries = 0;
+    p->configured = true;
+    p->seqValid = false;
+    p->ackValid = false;
+    p->lastSeq = p->feedbackSeq = p->ackedSeq = 0;
+    p->lastTimestamp = 0;
+    m_participants.append(p);
+}
+
+void RtpMidiSession::close()
+{
+    if (m_openCount == 0 || --m_openCount > 0)
+        return;
+    m_timer->stop();
+    foreach(int id, m_lookups.keys())
+        QHostInfo::abortHostLookup(id);
+    m_lookups.clear();
+    foreach(Participant *p, m_participants) {
+        if (p->state == Participant::Connected && m_control != 0)
+            sendExchange(m_control, "BY", p, false);
+        delete p;
+    }
+    m_participants.clear();
+    delete m_control;
+    delete m_data;
+    m_control = m_data = 0;
+    m_controlPort = 0;
+    QMutexLocker locker(&m_mutex);
+    m_commands.clear();
+    m_commandCount = 0;
+    m_packets.clear();
+    m_sysex.clear();
+    for (int i = 0; i < 16; ++i)
+        m_journal[i].reset();
+}
+
+RtpMidiSession::Participant *
+RtpMidiSession::findParticipant(const QHostAddress &address, quint16 port, bool dataPort)
+{
+    if (dataPort)
+        port--;
+    foreach(Participant *p, m_participants)
+        if (p->address == address && p->port == port)
+            return p;
+    return 0;
+}
+
+void RtpMidiSession::sendExchange(QUdpSocket *socket, const char *cmd, const Participant *p, bool withName)
+{
+    QByteArray buf;
+    putUInt16(buf, APPLEMIDI_SIGNATURE);
+    buf.append(cmd, 2);
+    putUInt32(buf, APPLEMIDI_VERSION);
+    putUInt32(buf, p->token);
+    putUInt32(buf, m_ssrc);
+    if (withName) {
+        buf.append(QSTR_VMPK.toUtf8());
+        buf.append('\0');
+    }
+    quint16 port = (socket == m_data) ? p->port + 1 : p->port;
+    socket->writeDatagram(buf, p->address, port);
+}
+
+void RtpMidiSession::sendClockSync(Participant *p, quint8 count, quint64 ts1, quint64 ts2, quint64 ts3)
+{
+    QByteArray buf;
+    putUInt16(buf, APPLEMIDI_SIGNATURE);
+    buf.append("CK", 2);
+    putUInt32(buf, m_ssrc);
+    buf.append(char(count));
+    buf.append(QByteArray(3, '\0'));
+    putUInt64(buf, ts1);
+    putUInt64(buf, ts2);
+    putUInt64(buf, ts3);
+    m_data->writeDatagram(buf, p->address, p->port + 1);
+}
+
+void RtpMidiSession::sendFeedback(Participant *p)
+{
+    QByteArray buf;
+    putUInt16(buf, APPLEMIDI_SIGNATURE);
+    buf.append("RS", 2);
+    putUInt32(buf, m_ssrc);
+    putUInt16(buf, p->lastSeq);
+    putUInt16(buf, 0);
+    m_control->writeDatagram(buf, p->address, p->port);
+}
+
+void RtpMidiSession::invitePeers()
+{
+    foreach(Participant *p, m_participants) {
+        if (!p->configured || p->state == Participant::Connected)
+            continue;
+        if (p->retries >= RTPMIDI_INVITE_RETRIES) {
+            // slow down, but keep trying: the peer may be started later
+            if (p->retries++ % RTPMIDI_INVITE_RETRIES != 0)
+                continue;
+        } else {
+            p->retries++;
+        }
+        if (p->state == Participant::InviteControl)
+            sendExchange(m_control, "IN", p, true);
+        else
+            sendExchange(m_data, "IN", p, true);
+    }
+}
+
+void RtpMidiSession::slotTimeout()
+{
+    invitePeers();
+    foreach(Participant *p, m_participants) {
+        if (p->state != Participant::Connected)
+            continue;
+        if (p->seqValid && p->feedbackSeq != p->lastSeq) {
+            sendFeedback(p);
+            p->feedbackSeq = p->lastSeq;
+        }
+    }
+}
+
+void RtpMidiSession::readControl()
+{
+    while (m_control != 0 && m_control->hasPendingDatagrams()) {
+        QByteArray datagram;
+        QHostAddress sender;
+        quint16 port;
+        datagram.resize(m_control->pendingDatagramSize());
+        m_control->readDatagram(datagram.data(), datagram.size(), &sender, &port);
+        processExchange(m_control, datagram, sender, port);
+    }
+}
+
+void RtpMidiSession::readData()
+{
+    while (m_data != 0 && m_data->hasPendingDatagrams()) {
+        QByteArray datagram;
+        QHostAddress sender;
+        quint16 port;
+        datagram.resize(m_data->pendingDatagramSize());
+        m_data->readDatagram(datagram.data(), datagram.size(), &sender, &port);
+        if (datagram.size() >= 4 && getUInt16((const quint8 *) datagram.constData()) == APPLEMIDI_SIGNATURE)
+            processExchange(m_data, datagram, sender, port);
+        else
+            processRtp(datagram, sender, port);
+    }
+}
+
+void RtpMidiSession::processExchange(QUdpSocket *socket, const QByteArray &datagram, const QHostAddress &sender, quint16 port)
+{
+    const quint8 *d = (const quint8 *) datagram.constData();
+    int len = datagram.size();
+    if (len < 8 || getUInt16(d) != APPLEMIDI_SIGNATURE)
+        return;
+    QByteArray cmd = datagram.mid(2, 2);
+    bool dataPort = (socket == m_data);
+    Participant *p = findParticipant(sender, port, dataPort);
+
+    if (cmd == "CK") {
+        if (p == 0 || len < 36)
+            return;
+        quint8 count = d[8];
+        quint64 ts1 = getUInt64(d + 12);
+        quint64 ts2 = getUInt64(d + 20);
+        if (count == 0)
+            sendClockSync(p, 1, ts1, now(), 0);
+        else if (count == 1)
+            sendClockSync(p, 2, ts1, ts2, now());
+        return;
+    }
+    if (cmd == "RS") {
+        if (p == 0 || len < 12)
+            return;
+        p->ackedSeq = getUInt16(d + 8);
+        p->ackValid = true;
+        trimJournal();
+        return;
+    }
+    if (len < 16)
+        return;
+    quint32 token = getUInt32(d + 8);
+    quint32 ssrc = getUInt32(d + 12);
+
+    if (cmd == "IN") {
+        if (p == 0) {
+            if (dataPort)
+                return; // the control port invitation comes first
+            p = new Participant;
+            p->address = sender;
+            p->port = port;
+            p->configured = false;
+            p->retries = 0;
+            p->seqValid = false;
+            p->ackValid = false;
+            p->lastSeq = p->feedbackSeq = p->ackedSeq = 0;
+            p->lastTimestamp = 0;
+            m_participants.append(p);
+        }
+        // accepting an invitation also resolves simultaneous mutual invitations
+        p->token = token;
+        p->ssrc = ssrc;
+        p->state = dataPort ? Participant::Connected : Participant::InviteData;
+        sendExchange(socket, "OK", p, true);
+    } else if (cmd == "OK") {
+        if (p == 0 || p->token != token)
+            return;
+        p->ssrc = ssrc;
+        if (!dataPort && p->state == Participant::InviteControl) {
+            p->state = Participant::InviteData;
+            sendExchange(m_data, "IN", p, true);
+        } else if (dataPort && p->state == Participant::InviteData) {
+            p->state = Participant::Connected;
+            p->retries = 0;
+            sendClockSync(p, 0, now(), 0, 0);
+        }
+    } else if (cmd == "NO") {
+        if (p != 0 && p->token == token)
+            qWarning() << "RtpMidiSession: invitation rejected by" << sender.toString() << port;
+    } else if (cmd == "BY") {
+        if (p == 0)
+            return;
+        if (p->configured) {
+            p->state = Participant::InviteControl;
+            p->retries = RTPMIDI_INVITE_RETRIES;
+            p->seqValid = false;
+            p->ackValid = false;
+            for (int i = 0; i < 16; ++i)
+                p->channels[i].reset();
+        } else {
+            m_participants.removeAll(p);
+            delete p;
+        }
+    }
+}
+
+void RtpMidiSession::processRtp(const QByteArray &datagram, const QHostAddress &sender, quint16 port)
+{
+    const quint8 *d = (const quint8 *) datagram.constData();
+    int len = datagram.size();
+    Participant *p = findParticipant(sender, port, true);
+    if (p == 0 || p->state != Participant::Connected || len < 13)
+        return;
+    if ((d[0] & 0xc0) != 0x80 || (d[1] & 0x7f) != RTPMIDI_PAYLOAD_TYPE)
+        return;
+    quint16 seq = getUInt16(d + 2);
+    quint32 timestamp = getUInt32(d + 4);
+    int pos = 12 + (d[0] & 0x0f) * 4;
+    if (pos >= len)
+        return;
+
+    // MIDI command section header
+    bool bigHeader = d[pos] & 0x80;
+    bool journal = d[pos] & 0x40;
+    bool firstDelta = d[pos] & 0x20;
+    int listLen = d[pos] & 0x0f;
+    pos++;
+    if (bigHeader) {
+        if (pos >= len)
+            return;
+        listLen = (listLen << 8) | d[pos++];
+    }
+    int listEnd = pos + listLen;
+    if (listEnd > len)
+        return;
+
+    bool lost = p->seqValid && seq != quint16(p->lastSeq + 1);
+    if (p->seqValid && qint16(seq - p->lastSeq) <= 0)
+        return; // duplicated or reordered packet
+    if (lost && journal)
+        processJournal(p, d + listEnd, len - listEnd);
+    p->seqValid = true;
+    p->lastSeq = seq;
+
+    // command list
+    quint32 time = timestamp;
+    quint8 running = 0;
+    bool first = true;
+    std::vector<unsigned char> message;
+    while (pos < listEnd) {
+        if (!first || firstDelta) {
+            quint32 delta = 0;
+            for (int i = 0; i < 4 && pos < listEnd; ++i) {
+                quint8 b = d[pos++];
+                delta = (delta << 7) | (b & 0x7f);
+                if ((b & 0x80) == 0)
+                    break;
+            }
+            time += delta;
+        }
+        if (pos >= listEnd)
+            break;
+        quint8 status = d[pos];
+        if (status & 0x80) {
+            pos++;
+            if (status < 0xf0)
+                running = status;
+            else if (status < 0xf8)
+                running = 0;
+        } else if (running != 0) {
+            status = running;
+        } else {
+            break; // no running status available: malformed list
+        }
+        first = false;
+
+        if (status == 0xf0 || status == 0xf7) {
+            // sysex, possibly segmented: F0..F0 first, F7..F0 middle, F7..F7 last
+            QByteArray segment;
+            while (pos < listEnd && d[pos] < 0x80)
+                segment.append(char(d[pos++]));
+            quint8 end = (pos < listEnd) ? d[pos++] : 0xf7;
+            if (status == 0xf0)
+                m_sysex = QByteArray(1, char(0xf0));
+            m_sysex.append(segment);
+            if (end == 0xf7) {
+                m_sysex.append(char(0xf7));
+                message.assign(m_sysex.constData(), m_sysex.constData() + m_sysex.size());
+                m_sysex.clear();
+                deliver(p, time, message);
+            } else if (end == 0xf4) {
+                m_sysex.clear(); // cancelled
+            }
+            continue;
+        }
+
+        int clen = commandLength(status);
+        message.clear();
+        message.push_back(status);
+        for (int i = 1; i < clen && pos < listEnd && d[pos] < 0x80; ++i)
+            message.push_back(d[pos++]);
+        if (int(message.size()) != clen)
+            break; // truncated command, or a status byte in place of data
+
+        // keep the receiver state, used to apply the recovery journal
+        quint8 chan = status & MASK_CHANNEL;
+        ChannelState &cs = p->channels[chan];
+        switch (status & MASK_STATUS) {
+        case STATUS_NOTEON:
+            cs.velocity[message[1]] = message[2];
+            break;
+        case STATUS_NOTEOFF:
+            cs.velocity[message[1]] = 0;
+            break;
+        case STATUS_CTLCHG:
+            cs.control[message[1]] = message[2];
+            break;
+        }
+        deliver(p, time, message);
+    }
+}
+
+void RtpMidiSession::processJournal(Participant *p, const quint8 *data, int len)
+{
+    // recovery journal header: S Y A H TOTCHAN(4) | checkpoint seqnum(16)
+    if (len < 3)
+        return;
+    bool system = data[0] & 0x40;
+    bool channels = data[0] & 0x20;
+    int totchan = (data[0] & 0x0f) + 1;
+    int pos = 3;
+    if (system) {
+        if (pos + 2 > len)
+            return;
+        pos += getUInt16(data + pos) & 0x03ff;
+    }
+    if (!channels)
+        return;
+    std::vector<unsigned char> message;
+    quint32 time = p->lastTimestamp;
+    for (int c = 0; c < totchan && pos + 3 <= len; ++c) {
+        quint8 chan = (data[pos] >> 3) & 0x0f;
+        int clen = ((data[pos] & 0x03) << 8) | data[pos + 1];
+        quint8 toc = data[pos + 2];
+        int cend = pos + clen;
+        if (clen < 3 || cend > len)
+            return;
+        ChannelState &cs = p->channels[chan];
+        int q = pos + 3;
+        if (toc & 0x80) // chapter P: program change
+            q += 3;
+        if ((toc & 0x40) && q < cend) { // chapter C: controllers
+            int logs = (data[q] & 0x7f) + 1;
+            q++;
+            for (int i = 0; i < logs && q + 2 <= cend; ++i, q += 2) {
+                quint8 number = data[q] & 0x7f;
+                quint8 value = data[q + 1] & 0x7f;
+                if ((data[q + 1] & 0x80) == 0 && cs.control[number] != qint8(value)) {
+                    cs.control[number] = value;
+                    message.clear();
+                    message.push_back(STATUS_CTLCHG | chan);
+                    message.push_back(number);
+                    message.push_back(value);
+                    deliver(p, time, message);
+                }
+            }
+        }
+        // chapter M has a variable layout that we don't decode; N follows it
+        if (toc & 0x20) {
+            pos = cend;
+            continue;
+        }
+        if (toc & 0x10) // chapter W: pitch wheel
+            q += 2;
+        if ((toc & 0x08) && q + 2 <= cend) { // chapter N: notes
+            int logs = data[q] & 0x7f;
+            int low = data[q + 1] >> 4;
+            int high = data[q + 1] & 0x0f;
+            if (logs == 127 && low == 15 && high == 0)
+                logs = 128;
+            q += 2;
+            for (int i = 0; i < logs && q + 2 <= cend; ++i, q += 2) {
+                quint8 note = data[q] & 0x7f;
+                quint8 vel = data[q + 1] & 0x7f;
+                if ((data[q + 1] & 0x80) && vel > 0 && cs.velocity[note] == 0) {
+                    cs.velocity[note] = vel;
+                    message.clear();
+                    message.push_back(STATUS_NOTEON | chan);
+                    message.push_back(note);
+                    message.push_back(vel);
+                    deliver(p, time, message);
+                }
+            }
+            for (int o = low; o <= high && q < cend; ++o, ++q) {
+                for (int bit = 0; bit < 8; ++bit) {
+                    if ((data[q] & (0x80 >> bit)) == 0)
+                        continue;
+                    quint8 note = quint8(o * 8 + bit);
+                    if (cs.velocity[note] != 0) {
+                        cs.velocity[note] = 0;
+                        message.clear();
+                        message.push_back(STATUS_NOTEOFF | chan);
+                        message.push_back(note);
+                        message.push_back(0);
+                        deliver(p, time, message);
+                    }
+                }
+            }
+        }
+        pos = cend;
+    }
+}
+
+void RtpMidiSession::deliver(Participant *p, quint32 timestamp, const std::vector<unsigned char> &message)
+{
+    double delta = (p->lastTimestamp == 0) ? 0.0 :
+        double(qint32(timestamp - p->lastTimestamp)) / RTPMIDI_CLOCK_RATE;
+    p->lastTimestamp = timestamp;
+    if (m_input != 0)
+        m_input->deliverMessage(delta, message);
+}
+
+/* Called with the mutex locked; the command goes in the packet numbered m_seq. */
+void RtpMidiSession::trackSent(const std::vector<unsigned char> &message)
+{
+    quint8 status = message[0] & MASK_STATUS;
+    if (status != STATUS_NOTEON && status != STATUS_NOTEOFF && status != STATUS_CTLCHG)
+        return;
+    if (message.size() < 3 || (message[1] & 0x80) || (message[2] & 0x80))
+        return;
+    ChannelState &cs = m_journal[message[0] & MASK_CHANNEL];
+    switch (status) {
+    case STATUS_NOTEON:
+        cs.velocity[message[1]] = message[2];
+        cs.noteDirty[message[1]] = true;
+        cs.noteSeq[message[1]] = m_seq;
+        break;
+    case STATUS_NOTEOFF:
+        cs.velocity[message[1]] = 0;
+        cs.noteDirty[message[1]] = true;
+        cs.noteSeq[message[1]] = m_seq;
+        break;
+    case STATUS_CTLCHG:
+        cs.control[message[1]] = message[2];
+        cs.ctlDirty[message[1]] = true;
+        cs.ctlSeq[message[1]] = m_seq;
+        break;
+    }
+    cs.dirty = true;
+}
+
+/*
+ * Drops from the journal the changes carried by packets that every
+ * receiver has acknowledged. Changes still queued, or sent in a later
+ * packet, are kept: that packet may be lost, too.
+ */
+void RtpMidiSession::trimJournal()
+{
+    QMutexLocker locker(&m_mutex);
+    quint16 last = quint16(m_seq - 1);
+    int behind = -1;
+    foreach(const Participant *q, m_participants) {
+        if (q->state != Participant::Connected)
+            continue;
+        if (!q->ackValid)
+            return;
+        quint16 d = quint16(last - q->ackedSeq);
+        if (d > 0x7fff)
+            d = 0; // acknowledged beyond the last packet sent: bogus
+        behind = qMax(behind, int(d));
+    }
+    if (behind < 0)
+        return;
+    quint16 acked = quint16(last - behind);
+    if (qint16(acked - m_checkpoint) <= 0)
+        return;
+    m_checkpoint = acked;
+    for (int c = 0; c < 16; ++c) {
+        ChannelState &cs = m_journal[c];
+        if (!cs.dirty)
+            continue;
+        cs.dirty = false;
+        for (int n = 0; n < 128; ++n) {
+            if (cs.noteDirty[n] && qint16(cs.noteSeq[n] - acked) <= 0)
+                cs.noteDirty[n] = false;
+            if (cs.ctlDirty[n] && qint16(cs.ctlSeq[n] - acked) <= 0)
+                cs.ctlDirty[n] = false;
+            cs.dirty = cs.dirty || cs.noteDirty[n] || cs.ctlDirty[n];
+        }
+    }
+}
+
+void RtpMidiSession::appendCommand(const unsigned char *data, int len)
+{
+    quint32 t = quint32(now());
+    if (m_commandCount == 0) {
+        m_packetTime = t; // the first command has no delta time (Z = 0)
+    } else {
+        quint32 delta = t - m_lastCommandTime;
+        if (delta >= (1 << 21))
+            m_commands.append(char(0x80 | ((delta >> 21) & 0x7f)));
+        if (delta >= (1 << 14))
+            m_commands.append(char(0x80 | ((delta >> 14) & 0x7f)));
+        if (delta >= (1 << 7))
+            m_commands.append(char(0x80 | ((delta >> 7) & 0x7f)));
+        m_commands.append(char(delta & 0x7f));
+    }
+    m_lastCommandTime = t;
+    m_commands.append((const char *) data, len);
+    m_commandCount++;
+}
+
+void RtpMidiSession::enqueue(const std::vector<unsigned char> *message)
+{
+    if (message->empty())
+        return;
+    QMutexLocker locker(&m_mutex);
+    const unsigned char *data = &(*message)[0];
+    int len = int(message->size());
+    if (data[0] == 0xf0 && len > RTPMIDI_MAX_SYSEX_SEGMENT) {
+        // long sysex: F0..F0, F7..F0 (middle segments), F7..F7
+        for (int pos = 0; pos < len; pos += RTPMIDI_MAX_SYSEX_SEGMENT) {
+            int seglen = qMin(RTPMIDI_MAX_SYSEX_SEGMENT, len - pos);
+            QByteArray segment;
+            if (pos > 0)
+                segment.append(char(0xf7));
+            segment.append((const char *) data + pos, seglen);
+            if (pos + seglen < len)
+                segment.append(char(0xf0));
+            if (m_commands.size() + segment.size() > RTPMIDI_MAX_COMMANDS)
+                flushPacket();
+            appendCommand((const unsigned char *) segment.constData(), segment.size());
+        }
+    } else {
+        int clen = commandLength(data[0]);
+        bool valid = (data[0] & 0x80) && (clen == 0 || len == clen);
+        for (int i = 1; i < len && valid; ++i)
+            valid = (data[i] < 0x80) || (data[0] == 0xf0 && i == len - 1 && data[i] == 0xf7);
+        if (!valid) {
+            qWarning() << "RtpMidiSession: malformed MIDI message not sent";
+            return;
+        }
+        if (m_commands.size() + len + 4 > RTPMIDI_MAX_COMMANDS)
+            flushPacket();
+        appendCommand(data, len);
+        trackSent(*message);
+    }
+    if (!m_flushPending) {
+        m_flushPending = true;
+        QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+    }
+}
+
+void RtpMidiSession::flush()
+{
+    QList<QByteArray> packets;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_flushPending = false;
+        flushPacket();
+        packets.swap(m_packets);
+    }
+    if (m_data == 0)
+        return;
+    foreach(const QByteArray& packet, packets)
+        foreach(const Participant *p, m_participants)
+            if (p->state == Participant::Connected)
+                m_data->writeDatagram(packet, p->address, p->port + 1);
+}
+
+void RtpMidiSession::appendJournal(QByteArray &packet)
+{
+    QByteArray chans;
+    int totchan = 0;
+    for (int c = 0; c < 16; ++c) {
+        ChannelState &cs = m_journal[c];
+        if (!cs.dirty)
+            continue;
+        QByteArray chapters;
+        quint8 toc = 0;
+
+        // chapter C
+        QByteArray logs;
+        int nlogs = 0;
+        for (int n = 0; n < 128; ++n) {
+            if (cs.ctlDirty[n] && cs.control[n] >= 0) {
+                logs.append(char(n));
+                logs.append(char(cs.control[n]));
+                nlogs++;
+            }
+        }
+        if (nlogs > 0) {
+            toc |= 0x40;
+            chapters.append(char(nlogs - 1));
+            chapters.append(logs);
+        }
+
+        // chapter N: logs for notes played, offbits for notes released
+        logs.clear();
+        nlogs = 0;
+        quint8 offbits[16];
+        ::memset(offbits, 0, sizeof(offbits));
+        int low = 16, high = -1;
+        for (int n = 0; n < 128; ++n) {
+            if (!cs.noteDirty[n])
+                continue;
+            if (cs.velocity[n] > 0) {
+                logs.append(char(n));
+                logs.append(char(0x80 | cs.velocity[n]));
+                nlogs++;
+            } else if (cs.velocity[n] == 0) {
+                offbits[n / 8] |= (0x80 >> (n % 8));
+                low = qMin(low, n / 8);
+                high = qMax(high, n / 8);
+            }
+        }
+        if (nlogs > 0 || high >= 0) {
+            toc |= 0x08;
+            if (nlogs == 128) {
+                // LEN = 127 with LOW = 15 and HIGH = 0 codes 128 logs
+                nlogs = 127;
+                low = 15;
+                high = 0;
+            } else if (high < 0) {
+                low = 1;
+                high = 0;
+            }
+            chapters.append(char(nlogs));
+            chapters.append(char((low << 4) | high));
+            chapters.append(logs);
+            for (int o = low; o <= high; ++o)
+                chapters.append(char(offbits[o]));
+        }
+
+        if (toc == 0)
+            continue;
+        int clen = chapters.size() + 3;
+        chans.append(char((c << 3) | ((clen >> 8) & 0x03)));
+        chans.append(char(clen & 0xff));
+        chans.append(char(toc));
+        chans.append(chapters);
+        totchan++;
+    }
+    if (totchan == 0)
+        return;
+    packet.append(char(0x20 | (totchan - 1)));
+    putUInt16(packet, m_checkpoint);
+    packet.append(chans);
+}
+
+/*
+ * Builds a packet with the queued commands, called with the mutex locked.
+ * It is written to the participants later, by flush().
+ */
+void RtpMidiSession::flushPacket()
+{
+    if (m_commandCount == 0)
+        return;
+    QByteArray packet;
+    packet.reserve(RTPMIDI_MAX_COMMANDS * 2);
+    packet.append(char(0x80));
+    packet.append(char(RTPMIDI_PAYLOAD_TYPE));
+    putUInt16(packet, m_seq);
+    putUInt32(packet, m_packetTime);
+    putUInt32(packet, m_ssrc);
+
+    QByteArray journal;
+    appendJournal(journal);
+    int len = m_commands.size();
+    quint8 flags = journal.isEmpty() ? 0 : 0x40;
+    if (len > 0x0f) {
+        packet.append(char(0x80 | flags | (len >> 8)));
+        packet.append(char(len & 0xff));
+    } else {
+        packet.append(char(flags | len));
+    }
+    packet.append(m_commands);
+    packet.append(journal);
+    m_packets.append(packet);
+    m_seq++;
+    m_commands.clear();
+    m_commandCount = 0;
+}
+
+/* RtpMidiIn */
+
+RtpMidiIn :: RtpMidiIn( const std::string clientName, unsigned int queueSizeLimit ) :
+    RtMidiIn(queueSizeLimit)
+{
+    initialize( clientName );
+}
+
+void RtpMidiIn ::initialize( const std::string& /*clientName*/ )
+{
+    RtpMidiSession *session = RtpMidiSession::acquire();
+    apiData_ = (void *) session;
+    inputData_.apiData = (void *) session;
+}
+
+RtpMidiIn :: ~RtpMidiIn()
+{
+    // Close a connection if it exists.
+    closePort();
+    RtpMidiSession::release();
+}
+
+void RtpMidiIn ::openPort( unsigned int /*portNumber*/, const std::string /*portName*/ )
+{
+    RtpMidiSession *session = static_cast<RtpMidiSession *> (apiData_);
+    if ( connected_ ) {
+        errorString_ = "RtpMidiIn::openPort: a valid connection already exists!";
+        error( RtError::WARNING );
+        return;
+    }
+    session->open();
+    if ( !session->isOpen() ) {
+        errorString_ = "RtpMidiIn::openPort: error binding the RTP-MIDI session ports.";
+        error( RtError::DRIVER_ERROR );
+    }
+    session->setInput(this);
+    inputData_.doInput = true;
+    connected_ = true;
+}
+
+void RtpMidiIn ::openVirtualPort( const std::string /*portName*/ )
+{
+    errorString_ = "RtpMidiIn::openVirtualPort: cannot be implemented in RTP-MIDI!";
+    error( RtError::WARNING );
+}
+
+unsigned int RtpMidiIn ::getPortCount()
+{
+    return 1;
+}
+
+std::string RtpMidiIn ::getPortName( unsigned int /*portNumber*/ )
+{
+    std::ostringstream ost;
+    ost << "RTP/" << NetworkSettings::instance().port();
+    return ost.str();
+}
+
+void RtpMidiIn ::closePort()
+{
+    if ( connected_ ) {
+        RtpMidiSession *session = static_cast<RtpMidiSession *> (apiData_);
+        inputData_.doInput = false;
+        session->setInput(0);
+        session->close();
+        connected_ = false;
+    }
+}
+
+void RtpMidiIn ::deliverMessage( double timeStamp, const std::vector<unsigned char> &bytes )
+{
+    if ( !inputData_.doInput || bytes.empty() )
+        return;
+    unsigned char status = bytes[0];
+    if ( ( status == 0xF0 && ( inputData_.ignoreFlags & 0x01 ) ) ||
+         ( ( status == 0xF1 || status == 0xF8 ) && ( inputData_.ignoreFlags & 0x02 ) ) ||
+         ( status == 0xFE && ( inputData_.ignoreFlags & 0x04 ) ) ||
+         !inputData_.filter.accepts( &bytes[0], bytes.size() ) )
+        return;
+    RtMidiIn::MidiMessage message;
+    message.timeStamp = timeStamp;
+    message.bytes = bytes;
+    if ( inputData_.usingCallback ) {
+        RtMidiIn::RtMidiCallback callback =
+                (RtMidiIn::RtMidiCallback) inputData_.userCallback;
+        callback(message.timeStamp, &message.bytes, inputData_.userData);
+    } else {
+        if ( inputData_.queue.size < inputData_.queue.ringSize ) {
+          inputData_.queue.ring[inputData_.queue.back++] = message;
+          if ( inputData_.queue.back == inputData_.queue.ringSize )
+            inputData_.queue.back = 0;
+          inputData_.queue.size++;
+        } else {
+          qWarning() << "RtpMidiIn: message queue limit reached!!\n\n";
+        }
+    }
+}
+
+/* RtpMidiOut */
+
+RtpMidiOut :: RtpMidiOut( const std::string clientName ) : RtMidiOut()
+{
+    initialize(clientName);
+}
+
+void RtpMidiOut ::initialize( const std::string& /*clientName*/ )
+{
+    apiData_ = (void *) RtpMidiSession::acquire();
+}
+
+RtpMidiOut :: ~RtpMidiOut()
+{
+    // Close a connection if it exists.
+    closePort();
+    RtpMidiSession::release();
+}
+
+void RtpMidiOut ::openPort( unsigned int /*portNumber*/, const std::string /*portName*/ )
+{
+    RtpMidiSession *session = static_cast<RtpMidiSession *> (apiData_);
+    if ( connected_ ) {
+        errorString_ = "RtpMidiOut::openPort: a valid connection already exists!";
+        error( RtError::WARNING );
+        return;
+    }
+    session->open();
+    if ( !session->isOpen() ) {
+        errorString_ = "RtpMidiOut::openPort: error binding the RTP-MIDI session ports.";
+        error( RtError::DRIVER_ERROR );
+    }
+    connected_ = true;
+}
+
+void RtpMidiOut ::openVirtualPort( const std::string /*portName*/ )
+{
+    errorString_ = "RtpMidiOut::openVirtualPort: cannot be implemented in RTP-MIDI!";
+    error( RtError::WARNING );
+}
+
+unsigned int RtpMidiOut ::getPortCount()
+{
+    return 1;
+}
+
+std::string RtpMidiOut ::getPortName( unsigned int /*portNumber*/ )
+{
+    std::ostringstream ost;
+    ost << "RTP/" << NetworkSettings::instance().port();
+    return ost.str();
+}
+
+void RtpMidiOut ::closePort()
+{
+    if ( connected_ ) {
+        RtpMidiSession *session = static_cast<RtpMidiSession *> (apiData_);
+        session->flush();
+        session->close();
+        connected_ = false;
+    }
+}
+
+void RtpMidiOut ::sendMessage( std::vector<unsigned char> *message )
+{
+    RtpMidiSession *session = static_cast<RtpMidiSession *> (apiData_);
+    if ( !connected_ )
+        return;
+    session->enqueue(message);
+}
+
+#endif
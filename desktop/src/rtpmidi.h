@@ -0,0 +1,232 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RTPMIDI_H
+#define RTPMIDI_H
+
+#if defined(NETWORK_MIDI)
+
+#include <QObject>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QByteArray>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QElapsedTimer>
+#include <RtMidi.h>
+#include "netsettings.h"
+
+class QUdpSocket;
+class QTimer;
+class RtpMidiIn;
+
+/**
+ * RTP-MIDI (RFC 6295) session, using the AppleMIDI session protocol.
+ *
+ * The session owns two consecutive UDP ports (control and data), invites
+ * the configured peers and accepts invitations from any other participant.
+ * Outgoing MIDI commands are packed with delta times into a single RTP
+ * packet per event loop iteration, and each packet carries a recovery
+ * journal (chapters N and C) covering the note and controller changes not
+ * yet acknowledged by the receivers.
+ *
+ * enqueue() may be called from any thread, but the sockets belong to the
+ * thread of the session: packets are only built there, and written from
+ * flush(), which is always invoked through the event loop.
+ *
+ * One session is shared by the RtpMidiIn and RtpMidiOut objects.
+ */
+class RtpMidiSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    static RtpMidiSession *acquire();
+    static void release();
+
+    void open();
+    void close();
+    bool isOpen() const { return m_control != 0; }
+    quint16 controlPort() const { return m_controlPort; }
+    int participants() const;
+
+    void setInput(RtpMidiIn *input);
+    void enqueue(const std::vector<unsigned char> *message);
+
+public slots:
+    void flush();
+
+private slots:
+    void readControl();
+    void readData();
+    void slotTimeout();
+    void slotHostFound(const QHostInfo &info);
+
+private:
+    struct ChannelState {
+        quint8 velocity[128];
+        bool noteDirty[128];
+        qint8 control[128];
+        bool ctlDirty[128];
+        quint16 noteSeq[128]; // packet that carried the last change
+        quint16 ctlSeq[128];
+        bool dirty;
+        ChannelState() { reset(); }
+        void reset();
+    };
+
+    struct Participant {
+        enum State { InviteControl, InviteData, Connected };
+        QHostAddress address;
+        quint16 port;
+        quint32 ssrc;
+        quint32 token;
+        State state;
+        int retries;
+        bool configured;
+        bool seqValid;
+        bool ackValid;
+        quint16 lastSeq;
+        quint16 feedbackSeq;
+        quint16 ackedSeq;
+        quint32 lastTimestamp;
+        ChannelState channels[16];
+    };
+
+    RtpMidiSession();
+    ~RtpMidiSession();
+
+    void addParticipant(const NetworkPeer &peer);
+    void invitePeers();
+    void sendExchange(QUdpSocket *socket, const char *cmd, const Participant *p, bool withName);
+    void sendClockSync(Participant *p, quint8 count, quint64 ts1, quint64 ts2, quint64 ts3);
+    void sendFeedback(Participant *p);
+    void processExchange(QUdpSocket *socket, const QByteArray &datagram, const QHostAddress &sender, quint16 port);
+    void processRtp(const QByteArray &datagram, const QHostAddress &sender, quint16 port);
+    void processJournal(Participant *p, const quint8 *data, int len);
+    void deliver(Participant *p, quint32 timestamp, const std::vector<unsigned char> &message);
+    void trackSent(const std::vector<unsigned char> &message);
+    void trimJournal();
+    void appendJournal(QByteArray &packet);
+    void appendCommand(const unsigned char *data, int len);
+    void flushPacket();
+    Participant *findParticipant(const QHostAddress &address, quint16 port, bool dataPort);
+    quint64 now() const;
+
+    static RtpMidiSession *s_instance;
+    static int s_refCount;
+
+    QUdpSocket *m_control;
+    QUdpSocket *m_data;
+    QTimer *m_timer;
+    quint16 m_controlPort;
+    quint32 m_ssrc;
+    quint16 m_seq;
+    int m_openCount;
+    QElapsedTimer m_clock;
+    QList<Participant*> m_participants;
+    QMap<int, NetworkPeer> m_lookups; // pending host name lookups
+    RtpMidiIn *m_input;
+
+    QMutex m_mutex;
+    QByteArray m_commands;
+    QList<QByteArray> m_packets; // built, waiting for flush()
+    int m_commandCount;
+    quint32 m_packetTime;
+    quint32 m_lastCommandTime;
+    bool m_flushPending;
+    ChannelState m_journal[16];
+    quint16 m_checkpoint;
+    QByteArray m_sysex;
+};
+
+class RtpMidiIn : public RtMidiIn
+{
+public:
+
+  //! Default constructor that allows an optional client name.
+  /*!
+      An exception will be thrown if a MIDI system initialization error occurs.
+  */
+  RtpMidiIn( const std::string clientName = std::string( "RTP-MIDI Input Client"), unsigned int queueSizeLimit = 100 );
+
+  //! If a MIDI connection is still open, it will be closed by the destructor.
+  ~RtpMidiIn();
+
+  //! Open the RTP-MIDI session for input.
+  void openPort( unsigned int portNumber = 0, const std::string Portname = std::string( "RTP-MIDI Input" ) );
+
+  //! Virtual ports are not available for RTP-MIDI.
+  void openVirtualPort( const std::string portName = std::string( "RTP-MIDI Input" ) );
+
+  //! Close an open MIDI connection (if one exists).
+  void closePort( void );
+
+  //! Return the number of available MIDI input ports.
+  unsigned int getPortCount();
+
+  //! Return a string identifier for the specified MIDI input port number.
+  std::string getPortName( unsigned int portNumber = 0 );
+
+  //! Called by the session for each received (or recovered) MIDI message.
+  void deliverMessage( double timeStamp, const std::vector<unsigned char> &bytes );
+
+private:
+
+  void initialize( const std::string& clientName );
+
+};
+
+class RtpMidiOut : public RtMidiOut
+{
+ public:
+
+  //! Default constructor that allows an optional client name.
+  /*!
+      An exception will be thrown if a MIDI system initialization error occurs.
+  */
+  RtpMidiOut( const std::string clientName = std::string( "RTP-MIDI Output Client" ) );
+
+  //! The destructor closes any open MIDI connections.
+  ~RtpMidiOut();
+
+  //! Open the RTP-MIDI session for output, inviting the configured peers.
+  void openPort( unsigned int portNumber = 0, const std::string portName = std::string( "RTP-MIDI Output" ) );
+
+  //! Close an open MIDI connection (if one exists).
+  void closePort();
+
+  //! Virtual ports are not available for RTP-MIDI.
+  void openVirtualPort( const std::string portName = std::string( "RTP-MIDI Output" ) );
+
+  //! Return the number of available MIDI output ports.
+  unsigned int getPortCount();
+
+  //! Return a string identifier for the specified MIDI port type and number.
+  std::string getPortName( unsigned int portNumber = 0 );
+
+  //! Queue a message; it is sent along with any others queued in the same event loop iteration.
+  virtual void sendMessage( std::vector<unsigned char> *message );
+
+  void initialize( const std::string& clientName );
+};
+
+#endif // defined(NETWORK_MIDI)
+
+#endif // RTPMIDI_H
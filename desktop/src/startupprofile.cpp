@@ -0,0 +1,80 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include "startupprofile.h"
+
+bool StartupProfile::s_enabled = false;
+qint64 StartupProfile::s_phaseStart = 0;
+
+static QElapsedTimer s_clock;
+static QMutex s_printMutex;
+
+void StartupProfile::start(int argc, char *argv[])
+{
+    s_clock.start();
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--profile-startup") == 0)
+            s_enabled = true;
+    }
+    if (s_enabled)
+        fprintf(stderr, "%10s %10s  %-7s %s\n", "at (ms)", "took (ms)", "kind", "step");
+}
+
+void StartupProfile::phase(const char *name)
+{
+    if (!s_enabled)
+        return;
+    qint64 now = s_clock.nsecsElapsed();
+    print(name, now, now - s_phaseStart, "phase");
+    s_phaseStart = now;
+}
+
+void StartupProfile::milestone(const char *name)
+{
+    if (!s_enabled)
+        return;
+    print(name, s_clock.nsecsElapsed(), -1, "reached");
+}
+
+void StartupProfile::print(const char *name, qint64 end, qint64 duration, const char *kind)
+{
+    QMutexLocker locker(&s_printMutex);
+    if (duration < 0)
+        fprintf(stderr, "%10.1f %10s  %-7s %s\n", end / 1e6, "", kind, name);
+    else
+        fprintf(stderr, "%10.1f %10.1f  %-7s %s\n", end / 1e6, duration / 1e6, kind, name);
+    fflush(stderr);
+}
+
+StartupProfile::Task::Task(const char *name) :
+    m_name(name),
+    m_start(s_enabled ? s_clock.nsecsElapsed() : 0)
+{ }
+
+StartupProfile::Task::~Task()
+{
+    if (!s_enabled)
+        return;
+    qint64 now = s_clock.nsecsElapsed();
+    print(m_name, now, now - m_start, "task");
+}
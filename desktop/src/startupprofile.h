@@ -0,0 +1,58 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STARTUPPROFILE_H
+#define STARTUPPROFILE_H
+
+#include <QtGlobal>
+
+/**
+ * Startup profiler, enabled by the --profile-startup command line option.
+ *
+ * The phases run by the GUI thread are timed back to back, each one from
+ * the end of the previous one. Work moved to other threads is timed as
+ * tasks, which overlap the phases. Every line is printed on the standard
+ * error output as soon as it is known, with the time since the program
+ * started and the duration.
+ */
+class StartupProfile
+{
+public:
+    static void start(int argc, char *argv[]);
+    static bool isEnabled() { return s_enabled; }
+    static void phase(const char *name);
+    static void milestone(const char *name);
+
+    class Task
+    {
+    public:
+        explicit Task(const char *name);
+        ~Task();
+    private:
+        const char *m_name;
+        qint64 m_start;
+    };
+
+private:
+    static void print(const char *name, qint64 end, qint64 duration, const char *kind);
+
+    static bool s_enabled;
+    static qint64 s_phaseStart;
+};
+
+#endif // STARTUPPROFILE_H
@@ -0,0 +1,256 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if defined(FLUIDSYNTH_SUPPORT)
+
+#include <sstream>
+#include <QAtomicInt>
+#include <fluidsynth.h>
+#include "synthmidi.h"
+#include "mididefs.h"
+
+static const int RING_SIZE = 65536; // bytes, a power of two
+static const int RING_MASK = RING_SIZE - 1;
+static const int SYNTH_PERIOD_SIZE = 128;
+static const int SYNTH_PERIODS = 2;
+
+/*
+ * The ring holds the queued messages, each one stored as a 16 bit length
+ * (low byte first) followed by the message bytes. One byte is always left
+ * free, so head == tail means an empty ring.
+ */
+struct SynthMidiData {
+    fluid_settings_t *settings;
+    fluid_synth_t *synth;
+    fluid_audio_driver_t *driver;
+    unsigned char ring[RING_SIZE];
+    unsigned char message[RING_SIZE]; // used by the audio thread only
+    QAtomicInt head;     // written by sendMessage() only
+    QAtomicInt tail;     // written by the audio thread only
+    QAtomicInt dropped;
+};
+
+static inline int loadAcquire(QAtomicInt &value)
+{
+    return value.fetchAndAddAcquire(0);
+}
+
+static inline void storeRelease(QAtomicInt &value, int newValue)
+{
+    value.fetchAndStoreRelease(newValue);
+}
+
+static void playMessage(fluid_synth_t *synth, const unsigned char *data, int size)
+{
+    int chan = data[0] & MASK_CHANNEL;
+    switch ( data[0] & MASK_STATUS ) {
+    case STATUS_NOTEOFF:
+        if (size > 1)
+            fluid_synth_noteoff(synth, chan, data[1]);
+        break;
+    case STATUS_NOTEON:
+        if (size > 2)
+            fluid_synth_noteon(synth, chan, data[1], data[2]);
+        break;
+    case STATUS_CTLCHG:
+        if (size > 2)
+            fluid_synth_cc(synth, chan, data[1], data[2]);
+        break;
+    case STATUS_PROGRAM:
+        if (size > 1)
+            fluid_synth_program_change(synth, chan, data[1]);
+        break;
+    case STATUS_CHANAFT:
+        if (size > 1)
+            fluid_synth_channel_pressure(synth, chan, data[1]);
+        break;
+    case STATUS_BENDER:
+        if (size > 2)
+            fluid_synth_pitch_bend(synth, chan, (data[2] << 7) | data[1]);
+        break;
+    case 0xf0:
+        if (data[0] == 0xf0) {
+            // without the leading 0xF0 and the trailing 0xF7
+            int len = size - 1;
+            if (data[size - 1] == 0xf7)
+                len--;
+            if (len > 0)
+                fluid_synth_sysex(synth, (const char *) data + 1, len, 0, 0, 0, 0);
+        } else if (data[0] == 0xff) {
+            fluid_synth_system_reset(synth);
+        }
+        break;
+    default:
+        // polyphonic aftertouch and SysEx continuation packets are ignored
+        break;
+    }
+}
+
+/* SynthMidiOut */
+
+std::string SynthMidiOut :: soundFont_;
+
+SynthMidiOut :: SynthMidiOut( const std::string clientName ) : RtMidiOut()
+{
+    initialize(clientName);
+}
+
+void SynthMidiOut ::initialize( const std::string& /*clientName*/ )
+{
+    SynthMidiData *data = new SynthMidiData;
+    data->settings = 0;
+    data->synth = 0;
+    data->driver = 0;
+    apiData_ = (void *) data;
+}
+
+SynthMidiOut :: ~SynthMidiOut()
+{
+    // Close a connection if it exists.
+    closePort();
+    delete static_cast<SynthMidiData *> (apiData_);
+}
+
+void SynthMidiOut ::setSoundFont( const std::string& fileName )
+{
+    soundFont_ = fileName;
+}
+
+std::string SynthMidiOut ::soundFont()
+{
+    return soundFont_;
+}
+
+void SynthMidiOut ::openPort( unsigned int /*portNumber*/, const std::string /*portName*/ )
+{
+    SynthMidiData *data = static_cast<SynthMidiData *> (apiData_);
+    if ( connected_ ) {
+        errorString_ = "SynthMidiOut::openPort: a valid connection already exists!";
+        error( RtError::WARNING );
+        return;
+    }
+    data->settings = new_fluid_settings();
+    fluid_settings_setint(data->settings, "audio.period-size", SYNTH_PERIOD_SIZE);
+    fluid_settings_setint(data->settings, "audio.periods", SYNTH_PERIODS);
+    data->synth = new_fluid_synth(data->settings);
+    if ( !soundFont_.empty() &&
+         fluid_synth_sfload(data->synth, soundFont_.c_str(), 1) == FLUID_FAILED ) {
+        errorString_ = "SynthMidiOut::openPort: error loading the SoundFont " + soundFont_;
+        error( RtError::WARNING );
+    }
+    data->head = 0;
+    data->tail = 0;
+    data->dropped = 0;
+    data->driver = new_fluid_audio_driver2(data->settings, &SynthMidiOut::render, data);
+    if ( data->driver == 0 ) {
+        delete_fluid_synth(data->synth);
+        delete_fluid_settings(data->settings);
+        data->synth = 0;
+        data->settings = 0;
+        errorString_ = "SynthMidiOut::openPort: error starting the FluidSynth audio driver.";
+        error( RtError::DRIVER_ERROR );
+    }
+    connected_ = true;
+}
+
+void SynthMidiOut ::openVirtualPort( const std::string /*portName*/ )
+{
+    errorString_ = "SynthMidiOut::openVirtualPort: cannot be implemented for the internal synthesizer!";
+    error( RtError::WARNING );
+}
+
+unsigned int SynthMidiOut ::getPortCount()
+{
+    return 1;
+}
+
+std::string SynthMidiOut ::getPortName( unsigned int /*portNumber*/ )
+{
+    return "FluidSynth";
+}
+
+void SynthMidiOut ::closePort()
+{
+    if ( connected_ ) {
+        SynthMidiData *data = static_cast<SynthMidiData *> (apiData_);
+        // the audio thread is stopped before the synthesizer goes away
+        delete_fluid_audio_driver(data->driver);
+        delete_fluid_synth(data->synth);
+        delete_fluid_settings(data->settings);
+        data->driver = 0;
+        data->synth = 0;
+        data->settings = 0;
+        int dropped = data->dropped;
+        if ( dropped > 0 ) {
+            std::ostringstream ost;
+            ost << "SynthMidiOut::closePort: " << dropped << " messages dropped, the queue was full.";
+            errorString_ = ost.str();
+            error( RtError::WARNING );
+        }
+        connected_ = false;
+    }
+}
+
+void SynthMidiOut ::sendMessage( std::vector<unsigned char> *message )
+{
+    SynthMidiData *data = static_cast<SynthMidiData *> (apiData_);
+    int size = message->size();
+    if ( !connected_ || size == 0 )
+        return;
+    int head = data->head;
+    int used = (head - loadAcquire(data->tail)) & RING_MASK;
+    if ( size + 2 > RING_MASK - used ) {
+        data->dropped.fetchAndAddRelaxed(1);
+        return;
+    }
+    data->ring[head] = size & 0xff;
+    head = (head + 1) & RING_MASK;
+    data->ring[head] = (size >> 8) & 0xff;
+    head = (head + 1) & RING_MASK;
+    for ( int i = 0; i < size; ++i ) {
+        data->ring[head] = message->at(i);
+        head = (head + 1) & RING_MASK;
+    }
+    storeRelease(data->head, head);
+}
+
+/*
+ * FluidSynth audio driver callback, running in the audio thread: plays
+ * the messages queued since the previous period, and renders this one.
+ */
+int SynthMidiOut ::render( void *userData, int len, int nin, float **in, int nout, float **out )
+{
+    SynthMidiData *data = static_cast<SynthMidiData *> (userData);
+    int tail = data->tail;
+    int head = loadAcquire(data->head);
+    while ( tail != head ) {
+        int size = data->ring[tail];
+        tail = (tail + 1) & RING_MASK;
+        size |= data->ring[tail] << 8;
+        tail = (tail + 1) & RING_MASK;
+        for ( int i = 0; i < size; ++i ) {
+            data->message[i] = data->ring[tail];
+            tail = (tail + 1) & RING_MASK;
+        }
+        playMessage(data->synth, data->message, size);
+    }
+    storeRelease(data->tail, tail);
+    return fluid_synth_process(data->synth, len, nin, in, nout, out);
+}
+
+#endif // defined(FLUIDSYNTH_SUPPORT)
@@ -0,0 +1,86 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYNTHMIDI_H
+#define SYNTHMIDI_H
+
+#if defined(FLUIDSYNTH_SUPPORT)
+
+#include <string>
+#include <vector>
+#include <RtMidi.h>
+
+/**
+ * Internal software synthesizer output, using FluidSynth.
+ *
+ * The messages are not sent to any external port: sendMessage() stores
+ * them in a lock-free ring, and the FluidSynth audio driver thread takes
+ * them out at the start of every audio period, right before rendering it.
+ * There is no MIDI sequencer or second process in between, so the latency
+ * from a key press to the sound is bounded by the audio buffer size.
+ *
+ * The ring has a single producer: the callers of sendMessage() must be
+ * serialized, as VPiano does with its output mutex.
+ */
+class SynthMidiOut : public RtMidiOut
+{
+ public:
+
+  //! Default constructor that allows an optional client name.
+  /*!
+      An exception will be thrown if a MIDI system initialization error occurs.
+  */
+  SynthMidiOut( const std::string clientName = std::string( "FluidSynth Output Client" ) );
+
+  //! The destructor closes any open MIDI connections.
+  ~SynthMidiOut();
+
+  //! Create the synthesizer and its audio driver, and load the SoundFont.
+  void openPort( unsigned int portNumber = 0, const std::string portName = std::string( "FluidSynth" ) );
+
+  //! Stop the audio driver and destroy the synthesizer.
+  void closePort();
+
+  //! Virtual ports are not available for the internal synthesizer.
+  void openVirtualPort( const std::string portName = std::string( "FluidSynth" ) );
+
+  //! Return the number of available MIDI output ports.
+  unsigned int getPortCount();
+
+  //! Return a string identifier for the specified MIDI port type and number.
+  std::string getPortName( unsigned int portNumber = 0 );
+
+  //! Queue a message, to be played at the start of the next audio period.
+  virtual void sendMessage( std::vector<unsigned char> *message );
+
+  //! SoundFont file loaded by the next openPort() call.
+  static void setSoundFont( const std::string& fileName );
+  static std::string soundFont();
+
+ private:
+
+  void initialize( const std::string& clientName );
+
+  static int render( void *userData, int len, int nin, float **in, int nout, float **out );
+
+  static std::string soundFont_;
+};
+
+#endif // defined(FLUIDSYNTH_SUPPORT)
+
+#endif // SYNTHMIDI_H
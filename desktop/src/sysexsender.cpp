@@ -0,0 +1,190 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QDebug>
+#include "sysexsender.h"
+#include "RtMidi.h"
+
+/* the longest sleep, so a cancel request is noticed promptly */
+const qint64 PAUSE_SLICE = 10000000;
+
+SysexSender::SysexSender(QObject *parent) : QThread(parent),
+    m_out(0),
+    m_outMutex(0),
+    m_packetSize(0),
+    m_byteRate(0),
+    m_delay(0),
+    m_cancel(false),
+    m_open(false)
+{ }
+
+SysexSender::~SysexSender()
+{
+    cancel();
+    wait();
+}
+
+bool SysexSender::send(const QString& fileName, RtMidiOut *out, QMutex *outMutex,
+                       int packetSize, int byteRate, int delay)
+{
+    if (isRunning() || out == 0)
+        return false;
+    m_fileName = fileName;
+    m_out = out;
+    m_outMutex = outMutex;
+    m_packetSize = packetSize;
+    m_byteRate = byteRate;
+    m_delay = delay;
+    m_cancel = false;
+    m_open = false;
+    m_error.clear();
+    start();
+    return true;
+}
+
+void SysexSender::cancel()
+{
+    m_cancel = true;
+}
+
+bool SysexSender::sendPacket(const uchar *data, int len)
+{
+    std::vector<unsigned char> message(data, data + len);
+    try {
+        m_out->sendMessage(&message);
+    } catch (RtError& err) {
+        m_error = QString::fromStdString(err.getMessage());
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Called by the other senders with the output mutex held. While a split
+ * message is open, a message other than a real time one is kept, to be
+ * sent after its end; returns true in that case.
+ */
+bool SysexSender::defer(const std::vector<unsigned char> *message)
+{
+    if (!m_open || message->empty() || message->at(0) >= 0xF8)
+        return false;
+    m_deferred.append(*message);
+    return true;
+}
+
+/* with the output mutex held */
+void SysexSender::flushDeferred()
+{
+    while (!m_deferred.isEmpty()) {
+        std::vector<unsigned char> message = m_deferred.takeFirst();
+        try {
+            m_out->sendMessage(&message);
+        } catch (RtError& err) {
+            qWarning() << QString::fromStdString(err.getMessage());
+        }
+    }
+}
+
+/* ends a split message cut short, so the receiver leaves the SysEx state */
+void SysexSender::closeMessage()
+{
+    QMutexLocker locker(m_outMutex);
+    if (m_open) {
+        const uchar eox = 0xF7;
+        sendPacket(&eox, 1);
+        m_open = false;
+    }
+    flushDeferred();
+}
+
+bool SysexSender::pause(qint64 nsecs)
+{
+    QElapsedTimer clock;
+    clock.start();
+    qint64 remaining;
+    while (!m_cancel && (remaining = nsecs - clock.nsecsElapsed()) > 0)
+        QThread::usleep(qMin(remaining, PAUSE_SLICE) / 1000);
+    return !m_cancel;
+}
+
+void SysexSender::run()
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        m_error = file.errorString();
+        return;
+    }
+    QByteArray buffer;
+    qint64 size = file.size();
+    const uchar *data = (size > 0) ? file.map(0, size) : 0;
+    if (data == 0) {
+        buffer = file.readAll();
+        data = reinterpret_cast<const uchar *>(buffer.constData());
+        size = buffer.size();
+    }
+    QElapsedTimer clock;
+    clock.start();
+    qint64 next = 0; // earliest time for the next packet, in nanoseconds
+    int percent = -1;
+    qint64 pos = 0;
+    while (pos < size && !m_cancel) {
+        // the next message: F0 up to and including F7
+        while (pos < size && data[pos] != 0xF0)
+            ++pos;
+        if (pos == size)
+            break;
+        qint64 end = pos + 1;
+        while (end < size && data[end] != 0xF7)
+            ++end;
+        if (end < size)
+            ++end;
+        while (pos < end) {
+            qint64 len = end - pos;
+            if (m_packetSize > 0 && len > m_packetSize)
+                len = m_packetSize;
+            // never sleep with the output locked
+            if (!pause(next - clock.nsecsElapsed())) {
+                closeMessage();
+                return;
+            }
+            QMutexLocker locker(m_outMutex);
+            bool sent = sendPacket(data + pos, len);
+            pos += len;
+            // the other senders are held back until the last packet
+            m_open = sent && pos < end;
+            if (!m_open)
+                flushDeferred();
+            locker.unlock();
+            if (!sent)
+                return;
+            // a stalled output does not earn a burst afterwards
+            next = qMax(next, clock.nsecsElapsed());
+            if (m_byteRate > 0)
+                next += len * Q_INT64_C(1000000000) / m_byteRate;
+            int p = int(pos * 100 / size);
+            if (p != percent) {
+                percent = p;
+                emit progress(percent);
+            }
+        }
+        next += qint64(m_delay) * 1000000;
+    }
+}
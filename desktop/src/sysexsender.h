@@ -0,0 +1,85 @@
+/*
+    MIDI Virtual Piano Keyboard
+    Copyright (C) 2008-2013, Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYSEXSENDER_H
+#define SYSEXSENDER_H
+
+#include <QThread>
+#include <QString>
+#include <QMutex>
+#include <QList>
+#include <vector>
+
+class RtMidiOut;
+
+/**
+ * Background transmission of System Exclusive files.
+ *
+ * The file is memory mapped when the transfer starts, and every F0..F7
+ * message found in it is sent, whole or in packets of a limited size for
+ * the drivers accepting partial messages. The packets are paced to a byte
+ * rate, and an additional pause may follow the end of each message, so
+ * slow receivers are not overrun. The output port is shared with other
+ * threads, serialized by the mutex given to send(), which is only held to
+ * send each packet. While a split message is open, the other senders
+ * hand their messages to defer(), and those are sent after its end; real
+ * time messages (the MIDI clock) may go in between, as MIDI allows.
+ */
+class SysexSender : public QThread
+{
+    Q_OBJECT
+
+public:
+    SysexSender(QObject *parent = 0);
+    virtual ~SysexSender();
+
+    bool send(const QString& fileName, RtMidiOut *out, QMutex *outMutex,
+             int packetSize, int byteRate, int delay);
+    bool defer(const std::vector<unsigned char> *message);
+    bool isCancelled() const { return m_cancel; }
+    QString fileName() const { return m_fileName; }
+    QString errorString() const { return m_error; }
+
+public slots:
+    void cancel();
+
+signals:
+    void progress(int percent);
+
+protected:
+    void run();
+
+private:
+    bool sendPacket(const uchar *data, int len);
+    bool pause(qint64 nsecs);
+    void closeMessage();
+    void flushDeferred();
+
+    QString m_fileName;
+    RtMidiOut *m_out;
+    QMutex *m_outMutex;
+    int m_packetSize;
+    int m_byteRate;
+    int m_delay;
+    volatile bool m_cancel;
+    bool m_open; // a split message is being sent; guarded by m_outMutex
+    QList<std::vector<unsigned char> > m_deferred;
+    QString m_error;
+};
+
+#endif // SYSEXSENDER_H
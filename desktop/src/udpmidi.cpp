@@ -24,22 +24,44 @@
 #if defined(NETWORK_MIDI)
 
 #include <sstream>
+#include <vector>
 
 #include <QByteArray>
+#include <QVarLengthArray>
+#include <QVector>
+#include <QMap>
+#include <QMutex>
 #include <QThread>
 #include <QNetworkInterface>
 #include <QUdpSocket>
 #include <QDebug>
 
+#if defined(Q_OS_LINUX)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstring>
+#endif
+
 #include "udpmidi.h"
 #include "netsettings.h"
 #include "constants.h"
 
 const QHostAddress MULTICAST_ADDRESS(QSTR_MULTICAST_ADDRESS);
+#if defined(Q_OS_LINUX)
+const int NETWORK_RCVBUF_SIZE = 256 * 1024;
+#endif
 
 struct NetworkMidiData {
     NetworkMidiData(): socket(0) {}
     QUdpSocket *socket;
+    QMutex mutex;   // guards peers and addrs, which grow as lookups complete
+    QList<NetworkPeer> peers;
+#if defined(Q_OS_LINUX)
+    QVector<struct sockaddr_in> addrs;
+#endif
+    QMap<int, NetworkPeer> lookups; // pending host name lookups
 };
 
 /* NetMidiIn */
@@ -74,6 +96,12 @@ void NetMidiIn ::openPort( unsigned int /*portNumber*/, const std::string /*port
 
     data->socket = new QUdpSocket();
     data->socket->bind(udpPort, QUdpSocket::ShareAddress);
+#if defined(Q_OS_LINUX)
+    // room for bursts of small datagrams; the socket exists only after bind()
+    int bufferSize = NETWORK_RCVBUF_SIZE;
+    ::setsockopt(data->socket->socketDescriptor(), SOL_SOCKET, SO_RCVBUF,
+                 &bufferSize, sizeof(bufferSize));
+#endif
     data->socket->setSocketOption(QAbstractSocket::MulticastLoopbackOption, 0);
     data->socket->setSocketOption(QAbstractSocket::MulticastTtlOption, 1);
 
@@ -81,6 +109,15 @@ void NetMidiIn ::openPort( unsigned int /*portNumber*/, const std::string /*port
         data->socket->setMulticastInterface(iface);
     }
     data->socket->joinMulticastGroup(MULTICAST_ADDRESS);
+    // host names are resolved in the background, see slotHostFound()
+    foreach(const NetworkPeer& peer, NetworkSettings::instance().parsePeers()) {
+        if (peer.address.isNull()) {
+            int id = QHostInfo::lookupHost(peer.host, this, SLOT(slotHostFound(QHostInfo)));
+            data->lookups.insert(id, peer);
+        } else {
+            joinPeer(peer);
+        }
+    }
     connect(data->socket, SIGNAL(readyRead()), this, SLOT(processIncomingMessages()));
     inputData_.doInput = true;
 }
@@ -96,6 +133,28 @@ unsigned int NetMidiIn ::getPortCount()
     return 1;
 }
 
+void NetMidiIn ::joinPeer( const NetworkPeer& peer )
+{
+    NetworkMidiData *data = static_cast<NetworkMidiData *> (apiData_);
+    if (peer.isMulticast() && peer.port == NetworkSettings::instance().port() &&
+        peer.address != MULTICAST_ADDRESS)
+        data->socket->joinMulticastGroup(peer.address);
+}
+
+void NetMidiIn ::slotHostFound( const QHostInfo& info )
+{
+    NetworkMidiData *data = static_cast<NetworkMidiData *> (apiData_);
+    if (!data->lookups.contains(info.lookupId()))
+        return;
+    NetworkPeer peer = data->lookups.take(info.lookupId());
+    if (info.error() != QHostInfo::NoError || info.addresses().isEmpty()) {
+        qWarning() << "NetMidiIn: cannot resolve peer" << peer.host;
+        return;
+    }
+    peer.address = info.addresses().first();
+    joinPeer(peer);
+}
+
 std::string NetMidiIn ::getPortName( unsigned int /*portNumber*/ )
 {
     std::ostringstream ost;
@@ -107,6 +166,9 @@ void NetMidiIn ::closePort()
 {
     NetworkMidiData *data = static_cast<NetworkMidiData *> (apiData_);
     inputData_.doInput = false;
+    foreach(int id, data->lookups.keys())
+        QHostInfo::abortHostLookup(id);
+    data->lookups.clear();
     // close and delete socket
     delete data->socket;
     data->socket = 0;
@@ -122,6 +184,10 @@ void NetMidiIn ::processIncomingMessages()
             QByteArray datagram;
             datagram.resize(socket->pendingDatagramSize());
             socket->readDatagram(datagram.data(), datagram.size());
+            if (!inputData_.filter.accepts(
+                    reinterpret_cast<const unsigned char *>(datagram.constData()),
+                    datagram.size()))
+                continue;
             message.timeStamp = 0;
             message.bytes.clear();
             message.bytes.assign(datagram.begin(), datagram.end());
@@ -145,7 +211,8 @@ void NetMidiIn ::processIncomingMessages()
 
 /* NetMidiOut */
 
-NetMidiOut :: NetMidiOut( const std::string clientName ) : RtMidiOut()
+NetMidiOut :: NetMidiOut( const std::string clientName ) :
+    QObject(0), RtMidiOut()
 {
     initialize(clientName);
 }
@@ -168,7 +235,63 @@ NetMidiOut :: ~NetMidiOut()
 void NetMidiOut ::openPort( unsigned int /*portNumber*/, const std::string /*portName*/ )
 {
     NetworkMidiData *data = static_cast<NetworkMidiData *> (apiData_);
+    QNetworkInterface iface = NetworkSettings::instance().iface();
     data->socket = new QUdpSocket();
+    data->socket->bind(QHostAddress::Any, 0);
+    data->socket->setSocketOption(QAbstractSocket::MulticastTtlOption, 1);
+    if (iface.isValid()) {
+        data->socket->setMulticastInterface(iface);
+    }
+    // an empty peer list means the default multicast group, as before;
+    // host names are resolved in the background, see slotHostFound()
+    QList<NetworkPeer> peers = NetworkSettings::instance().parsePeers();
+    if (peers.isEmpty()) {
+        NetworkPeer peer;
+        peer.address = MULTICAST_ADDRESS;
+        peer.port = NetworkSettings::instance().port();
+        peer.channels = 0xffff;
+        peers << peer;
+    }
+    foreach(const NetworkPeer& peer, peers) {
+        if (peer.address.isNull()) {
+            int id = QHostInfo::lookupHost(peer.host, this, SLOT(slotHostFound(QHostInfo)));
+            data->lookups.insert(id, peer);
+        } else {
+            addPeer(peer);
+        }
+    }
+}
+
+void NetMidiOut ::addPeer( const NetworkPeer& peer )
+{
+    NetworkMidiData *data = static_cast<NetworkMidiData *> (apiData_);
+    QMutexLocker locker(&data->mutex);
+    data->peers << peer;
+#if defined(Q_OS_LINUX)
+    // the sendmmsg() destination, kept in the order of the IPv4 peers
+    if (peer.address.protocol() == QAbstractSocket::IPv4Protocol) {
+        struct sockaddr_in addr;
+        ::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(peer.port);
+        addr.sin_addr.s_addr = htonl(peer.address.toIPv4Address());
+        data->addrs.append(addr);
+    }
+#endif
+}
+
+void NetMidiOut ::slotHostFound( const QHostInfo& info )
+{
+    NetworkMidiData *data = static_cast<NetworkMidiData *> (apiData_);
+    if (!data->lookups.contains(info.lookupId()))
+        return;
+    NetworkPeer peer = data->lookups.take(info.lookupId());
+    if (info.error() != QHostInfo::NoError || info.addresses().isEmpty()) {
+        qWarning() << "NetMidiOut: cannot resolve peer" << peer.host;
+        return;
+    }
+    peer.address = info.addresses().first();
+    addPeer(peer);
 }
 
 void NetMidiOut ::openVirtualPort( const std::string /*portName*/ )
@@ -192,8 +315,16 @@ std::string NetMidiOut ::getPortName( unsigned int /*portNumber*/ )
 void NetMidiOut ::closePort()
 {
     NetworkMidiData *data = static_cast<NetworkMidiData *> (apiData_);
+    foreach(int id, data->lookups.keys())
+        QHostInfo::abortHostLookup(id);
+    data->lookups.clear();
     delete data->socket;
     data->socket = 0;
+    QMutexLocker locker(&data->mutex);
+    data->peers.clear();
+#if defined(Q_OS_LINUX)
+    data->addrs.clear();
+#endif
 }
 
 void NetMidiOut ::sendMessage( std::vector<unsigned char> *message )
@@ -203,7 +334,58 @@ void NetMidiOut ::sendMessage( std::vector<unsigned char> *message )
         qDebug() << "socket = " << data->socket;
         return;
     }
-    data->socket->writeDatagram((char *) &((*message)[0]), message->size(), MULTICAST_ADDRESS, NetworkSettings::instance().port());
+    if (message->empty())
+        return;
+    const char *buffer = (const char *) &((*message)[0]);
+    unsigned char status = message->at(0);
+    int channel = (status < 0xF0) ? (status & 0x0F) : -1;
+    // a snapshot of the destinations, as a completed lookup may add one
+    data->mutex.lock();
+    QList<NetworkPeer> peers = data->peers;
+#if defined(Q_OS_LINUX)
+    QVector<struct sockaddr_in> addrs = data->addrs;
+#endif
+    data->mutex.unlock();
+#if defined(Q_OS_LINUX)
+    // fan out to every IPv4 destination with a single system call; the
+    // headers live on the stack, as several threads may send at once
+    QVarLengthArray<struct mmsghdr, 16> msgs(addrs.size());
+    QVarLengthArray<struct iovec, 16> iovs(addrs.size());
+    unsigned int count = 0, i = 0;
+    foreach(const NetworkPeer& peer, peers) {
+        if (peer.address.protocol() != QAbstractSocket::IPv4Protocol)
+            continue;
+        if (channel < 0 || peer.acceptsChannel(channel)) {
+            struct mmsghdr &m = msgs[count];
+            ::memset(&m, 0, sizeof(m));
+            iovs[count].iov_base = (void *) buffer;
+            iovs[count].iov_len = message->size();
+            m.msg_hdr.msg_name = (void *) (addrs.constData() + i);
+            m.msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            m.msg_hdr.msg_iov = &iovs[count];
+            m.msg_hdr.msg_iovlen = 1;
+            count++;
+        }
+        i++;
+    }
+    unsigned int sent = 0;
+    while (sent < count) {
+        int res = ::sendmmsg(data->socket->socketDescriptor(), &msgs[sent], count - sent, 0);
+        if (res <= 0) {
+            qWarning() << "NetMidiOut: sendmmsg failed";
+            break;
+        }
+        sent += res;
+    }
+#endif
+    foreach(const NetworkPeer& peer, peers) {
+#if defined(Q_OS_LINUX)
+        if (peer.address.protocol() == QAbstractSocket::IPv4Protocol)
+            continue;
+#endif
+        if (channel < 0 || peer.acceptsChannel(channel))
+            data->socket->writeDatagram(buffer, message->size(), peer.address, peer.port);
+    }
 }
 
 #endif
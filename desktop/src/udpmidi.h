@@ -22,8 +22,11 @@
 #if defined(NETWORK_MIDI)
 
 #include <QObject>
+#include <QHostInfo>
 #include <RtMidi.h>
 
+struct NetworkPeer;
+
 class NetMidiIn : public QObject, public RtMidiIn
 {
 
@@ -72,14 +75,22 @@ public slots:
 
   void processIncomingMessages();
 
+private slots:
+
+  void slotHostFound( const QHostInfo& info );
+
 private:
 
   void initialize( const std::string& clientName );
+  void joinPeer( const NetworkPeer& peer );
 
 };
 
-class NetMidiOut : public RtMidiOut
+class NetMidiOut : public QObject, public RtMidiOut
 {
+
+  Q_OBJECT
+
  public:
 
   //! Default constructor that allows an optional client name.
@@ -126,6 +137,14 @@ class NetMidiOut : public RtMidiOut
   virtual void sendMessage( std::vector<unsigned char> *message );
 
   void initialize( const std::string& clientName );
+
+ private slots:
+
+  void slotHostFound( const QHostInfo& info );
+
+ private:
+
+  void addPeer( const NetworkPeer& peer );
 };
 #endif // defined(NETWORK_MIDI)
 
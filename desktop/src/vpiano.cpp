@@ -30,6 +30,13 @@
 #include "midisetup.h"
 #include "events.h"
 #include "colordialog.h"
+#include "patchfinder.h"
+#include "pianoroll.h"
+#include "riffcatalogue.h"
+#include "sysexsender.h"
+#include "midiclock.h"
+#include "midimerger.h"
+#include "startupprofile.h"
 
 #if !defined(SMALL_SCREEN)
 #include "kmapdialog.h"
@@ -44,6 +51,11 @@
 #if defined(NETWORK_MIDI)
 #include "netsettings.h"
 #include "udpmidi.h"
+#include "rtpmidi.h"
+#endif
+
+#if defined(FLUIDSYNTH_SUPPORT)
+#include "synthmidi.h"
 #endif
 
 #include <QDesktopServices>
@@ -53,23 +65,35 @@
 #include <QApplication>
 #include <QCloseEvent>
 #include <QComboBox>
+#include <QListView>
 #include <QSlider>
 #include <QSpinBox>
+#include <QDoubleSpinBox>
 #include <QDial>
 #include <QToolButton>
+#include <QProgressBar>
+#include <QFileInfo>
 #include <QToolTip>
 #include <QVBoxLayout>
 #include <QTextBrowser>
 #include <QDialogButtonBox>
 #include <QDialog>
+#include <QGridLayout>
 #include <QUrl>
 #include <QString>
 #include <QSettings>
 #include <QTranslator>
 #include <QLibraryInfo>
 #include <QMapIterator>
+#include <QtConcurrentRun>
 #include <QDebug>
 
+static bool loadTranslation(QTranslator *translator, const QString& fileName, const QString& directory)
+{
+    StartupProfile::Task task("translation loading");
+    return translator->load(fileName, directory);
+}
+
 VPiano::VPiano( QWidget * parent, Qt::WindowFlags flags )
     : QMainWindow(parent, flags),
     m_midiout(0),
@@ -86,23 +110,51 @@ VPiano::VPiano( QWidget * parent, Qt::WindowFlags flags )
     m_dlgKeyMap(0),
     m_dlgExtra(0),
     m_dlgRiffImport(0),
-    m_dlgColorPolicy(0)
-{
+    m_dlgColorPolicy(0),
+    m_comboBank(0),
+    m_patchFinder(0),
+    m_catalogue(0),
+    m_pianoRoll(0),
+    m_sysexSender(0),
+    m_sysexProgress(0),
+    m_sysexCancel(0),
+    m_midiClock(0),
+    m_merger(0),
+    m_ins(0),
+    m_tempo(120.0)
+{
+    // the translations and the locales directory are read by other threads
+    // while the session bus is contacted
+    m_trq = new QTranslator(this);
+    m_trp = new QTranslator(this);
+    QFuture<bool> qtTranslation = QtConcurrent::run(loadTranslation, m_trq,
+                 QSTR_QTPX + configuredLanguage(),
+                 QLibraryInfo::location(QLibraryInfo::TranslationsPath) );
+    QFuture<bool> vmpkTranslation = QtConcurrent::run(loadTranslation, m_trp,
+                 QSTR_VMPKPX + configuredLanguage(),
+                 VPiano::localeDirectory() );
+    m_locales = QtConcurrent::run(&VPiano::availableLocales);
 #if ENABLE_DBUS
     new VmpkAdaptor(this);
     QDBusConnection dbus = QDBusConnection::sessionBus();
     dbus.registerObject("/", this);
     dbus.registerService("net.sourceforge.vmpk");
+    StartupProfile::phase("D-Bus registration");
 #endif
-    m_trq = new QTranslator(this);
-    m_trp = new QTranslator(this);
-    m_trq->load( QSTR_QTPX + configuredLanguage(),
-                 QLibraryInfo::location(QLibraryInfo::TranslationsPath) );
-    m_trp->load( QSTR_VMPKPX + configuredLanguage(),
-                 VPiano::localeDirectory() );
+    qtTranslation.waitForFinished();
+    vmpkTranslation.waitForFinished();
     QCoreApplication::installTranslator(m_trq);
     QCoreApplication::installTranslator(m_trp);
+    StartupProfile::phase("translations");
     ui.setupUi(this);
+    m_pianoRoll = new PianoRoll(ui.pianokeybd, ui.centralwidget);
+    m_pianoRoll->setVisible(false);
+    QGridLayout *grid = static_cast<QGridLayout*>(ui.centralwidget->layout());
+    grid->removeWidget(ui.pianokeybd);
+    grid->addWidget(m_pianoRoll, 0, 0);
+    grid->addWidget(ui.pianokeybd, 1, 0);
+    grid->setRowStretch(1, 1);
+    connect(ui.actionPianoRoll, SIGNAL(toggled(bool)), m_pianoRoll, SLOT(setVisible(bool)));
     initLanguages();
     connect(ui.actionAbout, SIGNAL(triggered()), SLOT(slotAbout()));
     connect(ui.actionAboutQt, SIGNAL(triggered()), SLOT(slotAboutQt()));
@@ -113,6 +165,7 @@ VPiano::VPiano( QWidget * parent, Qt::WindowFlags flags )
     connect(ui.actionContents, SIGNAL(triggered()), SLOT(slotHelpContents()));
     connect(ui.actionWebSite, SIGNAL(triggered()), SLOT(slotOpenWebSite()));
     connect(ui.actionImportSoundFont, SIGNAL(triggered()), SLOT(slotImportSF()));
+    connect(ui.actionScanSoundFonts, SIGNAL(triggered()), SLOT(slotScanSoundFonts()));
     connect(ui.actionEditExtraControls, SIGNAL(triggered()), SLOT(slotEditExtraControls()));
     connect(ui.actionNoteNames, SIGNAL(triggered()), SLOT(slotShowNoteNames()));
     connect(ui.actionShortcuts, SIGNAL(triggered()), SLOT(slotShortcuts()));
@@ -132,6 +185,9 @@ VPiano::VPiano( QWidget * parent, Qt::WindowFlags flags )
             ui.actionPrograms, SLOT(setChecked(bool)));
     connect(ui.toolBarExtra->toggleViewAction(), SIGNAL(toggled(bool)),
             ui.actionExtraControls, SLOT(setChecked(bool)));
+    connect(ui.toolBarClock->toggleViewAction(), SIGNAL(toggled(bool)),
+            ui.actionClock, SLOT(setChecked(bool)));
+    ui.toolBarClock->hide();
 #if defined(SMALL_SCREEN)
     ui.toolBarControllers->hide();
     ui.toolBarBender->hide();
@@ -144,12 +200,38 @@ VPiano::VPiano( QWidget * parent, Qt::WindowFlags flags )
     setWindowTitle("VMPK " + PGM_VERSION);
 #endif
     currentPianoScene()->setPianoHandler(this);
+    m_catalogue = new RiffCatalogue(this);
+    connect(m_catalogue, SIGNAL(progress(int,int)), SLOT(slotCatalogueProgress(int,int)));
+    connect(m_catalogue, SIGNAL(finished()), SLOT(slotCatalogueFinished()));
+    m_sysexSender = new SysexSender(this);
+    m_sysexProgress = new QProgressBar(this);
+    m_sysexProgress->setMaximumWidth(120);
+    m_sysexProgress->setVisible(false);
+    m_sysexCancel = new QToolButton(this);
+    m_sysexCancel->setIcon(style()->standardIcon(QStyle::SP_DialogCancelButton));
+    m_sysexCancel->setAutoRaise(true);
+    m_sysexCancel->setToolTip(tr("Cancel"));
+    m_sysexCancel->setVisible(false);
+    ui.statusBar->addPermanentWidget(m_sysexProgress);
+    ui.statusBar->addPermanentWidget(m_sysexCancel);
+    connect(m_sysexSender, SIGNAL(progress(int)), SLOT(slotSysexProgress(int)));
+    connect(m_sysexSender, SIGNAL(finished()), SLOT(slotSysexFinished()));
+    connect(m_sysexCancel, SIGNAL(clicked()), m_sysexSender, SLOT(cancel()));
+    m_midiClock = new MidiClock(this);
+    connect(m_midiClock, SIGNAL(jitter(double,double)), SLOT(slotClockJitter(double,double)));
+    m_merger = new MidiMerger(this);
+    connect(ui.actionClockStart, SIGNAL(triggered()), SLOT(slotClockStart()));
+    connect(ui.actionClockContinue, SIGNAL(triggered()), SLOT(slotClockContinue()));
+    connect(ui.actionClockStop, SIGNAL(triggered()), SLOT(slotClockStop()));
+    StartupProfile::phase("main window");
     initialization();
 }
 
 VPiano::~VPiano()
 {
     //qDebug() << Q_FUNC_INFO;
+    stopOutputThreads();
+    closeMergeInputs();
     try {
         if (m_midiout != 0) {
             m_midiout->closePort();
@@ -169,24 +251,46 @@ VPiano::~VPiano()
     }
 }
 
+/*
+ * Only the work needed to play the first note runs before the event loop
+ * starts. The MIDI ports are enumerated by another thread while the tool
+ * bars are built, the instrument files are parsed in the background (see
+ * InstrumentLoader), and the language menu and the extra controllers are
+ * created once the window is shown.
+ */
 void VPiano::initialization()
 {
     readSettings();
+    StartupProfile::phase("settings");
     if ((m_initialized = initMidi())) {
-        refreshConnections();
-        readConnectionSettings();
+        StartupProfile::phase("MIDI drivers");
+        QFuture<PortNames> ports = QtConcurrent::run(&VPiano::enumeratePorts, m_midiin, m_midiout);
         readMidiControllerSettings();
-        createLanguageMenu();
         initToolBars();
+        StartupProfile::phase("tool bars");
+        refreshConnections(ports.result());
+        readConnectionSettings();
+        StartupProfile::phase("connection settings");
         applyPreferences();
+        StartupProfile::phase("preferences");
         applyConnections();
         applyInitialSettings();
-        initExtraControllers();
         enforceMIDIChannelState();
+        StartupProfile::phase("connections");
         activateWindow();
+        QMetaObject::invokeMethod(this, "slotDeferredInitialization", Qt::QueuedConnection);
     }
 }
 
+void VPiano::slotDeferredInitialization()
+{
+    StartupProfile::milestone("first playable note");
+    createLanguageMenu();
+    StartupProfile::phase("language menu");
+    initExtraControllers();
+    StartupProfile::phase("extra controllers");
+}
+
 void midiCallback( double /*deltatime*/,
                    std::vector< unsigned char > *message,
                    void *userData )
@@ -194,6 +298,8 @@ void midiCallback( double /*deltatime*/,
     QEvent* ev = 0;
     VPiano* instance = static_cast<VPiano*>(userData);
     instance->midiThru(message);
+    if (!instance->inputFilter().accepts(&message->at(0), message->size()))
+        return;
     unsigned char channel = message->at(0) & MASK_CHANNEL;
     unsigned char status = message->at(0) & MASK_STATUS;
     bool messageAccepted = (instance->baseChannel() == channel) ||
@@ -244,6 +350,13 @@ void midiCallback( double /*deltatime*/,
         QApplication::postEvent(instance, ev);
 }
 
+void mergedMidiCallback( int /*port*/,
+                         std::vector< unsigned char > *message,
+                         void *userData )
+{
+    midiCallback( 0.0, message, userData );
+}
+
 RtMidiOut *
 VPiano::MIDIOutDriverFactory(const QString driverName, const QString clientName)
 {
@@ -271,6 +384,12 @@ VPiano::MIDIOutDriverFactory(const QString driverName, const QString clientName)
 #if defined(NETWORK_MIDI)
     if (driverName == QSTR_DRIVERNAMENET)
         driver = new NetMidiOut(clientName.toStdString());
+    if (driverName == QSTR_DRIVERNAMERTP)
+        driver = new RtpMidiOut(clientName.toStdString());
+#endif
+#if defined(FLUIDSYNTH_SUPPORT)
+    if (driverName == QSTR_DRIVERNAMESYNTH)
+        driver = new SynthMidiOut(clientName.toStdString());
 #endif
     if (driver == 0 && driverName != QSTR_DRIVERDEFAULT)
         driver = MIDIOutDriverFactory(QSTR_DRIVERDEFAULT, clientName);
@@ -304,12 +423,20 @@ VPiano::MIDIInDriverFactory(const QString driverName, const QString clientName)
 #if defined(NETWORK_MIDI)
     if (driverName == QSTR_DRIVERNAMENET)
         driver = new NetMidiIn(clientName.toStdString());
+    if (driverName == QSTR_DRIVERNAMERTP)
+        driver = new RtpMidiIn(clientName.toStdString());
 #endif
     if (driver == 0 && driverName != QSTR_DRIVERDEFAULT)
         driver = MIDIInDriverFactory(QSTR_DRIVERDEFAULT, clientName);
     return driver;
 }
 
+bool VPiano::isNetworkDriver() const
+{
+    return (m_midiDriver == QSTR_DRIVERNAMENET) ||
+           (m_midiDriver == QSTR_DRIVERNAMERTP);
+}
+
 bool VPiano::initMidi()
 {
     try {
@@ -346,6 +473,7 @@ bool VPiano::initMidi()
         if (m_midiin != 0) {
             // ignore SYX, clock and active sense
             m_midiin->ignoreTypes(true,true,true);
+            updateInputFilter();
             m_midiin->setCallback( &midiCallback, this );
             m_inputActive = true;
         }
@@ -359,6 +487,8 @@ bool VPiano::initMidi()
 
 void VPiano::switchMIDIDriver()
 {
+    stopOutputThreads();
+    closeMergeInputs();
     try {
         if (m_midiout != 0) {
             m_midiout->closePort();
@@ -458,6 +588,23 @@ void VPiano::initToolBars()
              SLOT(slotVelocityUp()) );
     connect( ui.actionVelocityDown, SIGNAL(triggered()),
              SLOT(slotVelocityDown()) );
+    // Clock tool bar
+    m_lblTempo = new QLabel(this);
+    ui.toolBarClock->addWidget(m_lblTempo);
+    m_lblTempo->setMargin(TOOLBARLABELMARGIN);
+    m_sboxTempo = new QDoubleSpinBox(this);
+    m_sboxTempo->setDecimals(1);
+    m_sboxTempo->setMinimum(20.0);
+    m_sboxTempo->setMaximum(300.0);
+    m_sboxTempo->setValue(m_tempo);
+    m_sboxTempo->setFocusPolicy(Qt::NoFocus);
+    ui.toolBarClock->addWidget(m_sboxTempo);
+    m_lblJitter = new QLabel(this);
+    m_lblJitter->setMargin(TOOLBARLABELMARGIN);
+    ui.toolBarClock->addWidget(m_lblJitter);
+    m_midiClock->setTempo(m_tempo);
+    connect( m_sboxTempo, SIGNAL(valueChanged(double)),
+             SLOT(slotTempoValueChanged(double)) );
     // Controllers tool bar
     m_lblControl = new QLabel(this);
     ui.toolBarControllers->addWidget(m_lblControl);
@@ -515,6 +662,11 @@ void VPiano::initToolBars()
     m_comboProg = new QComboBox(this);
     m_comboProg->setSizeAdjustPolicy(QComboBox::AdjustToContents);
     m_comboProg->setFocusPolicy(Qt::NoFocus);
+    m_progModel = new ProgramListModel(this);
+    m_comboProg->setModel(m_progModel);
+    QListView *progView = new QListView(m_comboProg);
+    progView->setUniformItemSizes(true);
+    m_comboProg->setView(progView);
     ui.toolBarPrograms->addWidget(m_comboProg);
     connect( m_comboBank, SIGNAL(activated(int)),
              SLOT(slotComboBankActivated(int)) );
@@ -538,6 +690,8 @@ void VPiano::initToolBars()
              SLOT(slotProgramNext()) );
     connect( ui.actionPreviousProgram, SIGNAL(triggered()),
              SLOT(slotProgramPrev()) );
+    connect( ui.actionFindProgram, SIGNAL(triggered()),
+             SLOT(slotFindProgram()) );
     connect( ui.actionNextController, SIGNAL(triggered()),
              SLOT(slotControllerNext()) );
     connect( ui.actionPreviousController, SIGNAL(triggered()),
@@ -570,15 +724,6 @@ void VPiano::clearExtraControllers()
     ui.toolBarExtra->addSeparator();
 }
 
-QByteArray VPiano::readSysexDataFile(const QString& fileName)
-{
-    QFile file(fileName);
-    file.open(QIODevice::ReadOnly);
-    QByteArray res = file.readAll();
-    file.close();
-    return res;
-}
-
 void VPiano::initExtraControllers()
 {
     QWidget *w = 0;
@@ -597,9 +742,13 @@ void VPiano::initExtraControllers()
         int value = 0;
         int size = 100;
         QString fileName;
+        int packetSize = DEFAULTSYSEXPACKETSIZE;
+        int byteRate = MIDIWIREBYTERATE;
+        int delay = 0;
         ExtraControl::decodeString( s, lbl, control, type,
                                     minValue, maxValue, defValue,
-                                    size, fileName );
+                                    size, fileName,
+                                    packetSize, byteRate, delay );
         if (m_ctlState[m_baseChannel].contains(control))
             value = m_ctlState[m_baseChannel][control];
         else
@@ -659,7 +808,9 @@ void VPiano::initExtraControllers()
             button = new QToolButton(this);
             button->setText(lbl);
             button->setProperty(SYSEXFILENAME, fileName);
-            button->setProperty(SYSEXFILEDATA, readSysexDataFile(fileName));
+            button->setProperty(SYSEXPACKETSIZE, packetSize);
+            button->setProperty(SYSEXBYTERATE, byteRate);
+            button->setProperty(SYSEXDELAY, delay);
             connect(button, SIGNAL(clicked(bool)), SLOT(slotControlClicked(bool)));
             w = button;
             break;
@@ -694,14 +845,17 @@ void VPiano::readSettings()
     m_velocity = settings.value(QSTR_VELOCITY, MIDIVELOCITY).toInt();
     m_baseOctave = settings.value(QSTR_BASEOCTAVE, 3).toInt();
     m_transpose = settings.value(QSTR_TRANSPOSE, 0).toInt();
+    m_tempo = settings.value(QSTR_CLOCKTEMPO, 120.0).toDouble();
     int num_octaves = settings.value(QSTR_NUMOCTAVES, DEFAULTNUMBEROFOCTAVES).toInt();
-    QString insFileName = settings.value(QSTR_INSTRUMENTSDEFINITION).toString();
+    QStringList insFileNames = settings.value(QSTR_INSTRUMENTSDEFINITION).toStringList();
     QString insName = settings.value(QSTR_INSTRUMENTNAME).toString();
+    m_soundFontDirs = settings.value(QSTR_SOUNDFONTDIRS).toStringList();
     bool grabKb = settings.value(QSTR_GRABKB, false).toBool();
     bool styledKnobs = settings.value(QSTR_STYLEDKNOBS, true).toBool();
     bool alwaysOnTop = settings.value(QSTR_ALWAYSONTOP, false).toBool();
     bool showNames = settings.value(QSTR_SHOWNOTENAMES, false).toBool();
     bool showStatusBar = settings.value(QSTR_SHOWSTATUSBAR, false).toBool();
+    bool showPianoRoll = settings.value(QSTR_SHOWPIANOROLL, false).toBool();
     bool velocityColor = settings.value(QSTR_VELOCITYCOLOR, true).toBool();
     bool enforceChanState = settings.value(QSTR_ENFORCECHANSTATE, false).toBool();
     bool enableKeyboard = settings.value(QSTR_ENABLEKEYBOARDINPUT, true).toBool();
@@ -714,6 +868,11 @@ void VPiano::readSettings()
     NetworkSettings::instance().setPort(udpPort);
     QString iface = settings.value(QSTR_NETWORKIFACE).toString();
     NetworkSettings::instance().setIface(QNetworkInterface::interfaceFromName(iface));
+    QStringList peers = settings.value(QSTR_NETWORKPEERS).toStringList();
+    NetworkSettings::instance().setPeers(peers);
+#endif
+#if defined(FLUIDSYNTH_SUPPORT)
+    QString soundFont = settings.value(QSTR_SOUNDFONT).toString();
 #endif
     m_currentPalette = settings.value(QSTR_CURRENTPALETTE, PAL_SINGLE).toInt();
     bool colorScale = settings.value(QSTR_SHOWCOLORSCALE, false).toBool();
@@ -724,6 +883,11 @@ void VPiano::readSettings()
 #if defined(NETWORK_MIDI)
     dlgPreferences()->setNetworkPort(udpPort);
     dlgPreferences()->setNetworkIfaceName(iface);
+    dlgPreferences()->setNetworkPeers(peers);
+#endif
+#if defined(FLUIDSYNTH_SUPPORT)
+    dlgPreferences()->setSoundFontFileName(soundFont);
+    SynthMidiOut::setSoundFont(dlgPreferences()->getSoundFontFileName().toStdString());
 #endif
     dlgPreferences()->setNumOctaves(num_octaves);
     dlgPreferences()->setDrumsChannel(drumsChannel);
@@ -738,6 +902,7 @@ void VPiano::readSettings()
     dlgPreferences()->setEnabledTouch(enableTouch);
     ui.actionNoteNames->setChecked(showNames);
     ui.actionStatusBar->setChecked(showStatusBar);
+    ui.actionPianoRoll->setChecked(showPianoRoll);
     ui.pianokeybd->setNumOctaves(num_octaves);
     currentPianoScene()->setVelocity(velocityColor ? m_velocity : MIDIVELOCITY);
     ui.pianokeybd->setTranspose(m_transpose);
@@ -748,12 +913,17 @@ void VPiano::readSettings()
     currentPianoScene()->setChannel(m_baseChannel);
     ui.actionColorScale->setChecked(colorScale);
     slotShowNoteNames();
-    if (!insFileName.isEmpty()) {
-        dlgPreferences()->setInstrumentsFileName(insFileName);
-        if (!insName.isEmpty()) {
-            dlgPreferences()->setInstrumentName(insName);
-        }
-    }
+    if (!insFileNames.isEmpty())
+        dlgPreferences()->setInstrumentsFileNames(insFileNames);
+    if (!m_soundFontDirs.isEmpty() && m_catalogue->load()) {
+        InstrumentList sfInstruments;
+        m_catalogue->buildInstruments(sfInstruments);
+        dlgPreferences()->setExtraInstruments(sfInstruments);
+    }
+    if (!insName.isEmpty())
+        dlgPreferences()->setInstrumentName(insName);
+    if (!m_soundFontDirs.isEmpty())
+        m_catalogue->scan(m_soundFontDirs);
 
     settings.beginGroup(QSTR_KEYBOARD);
     bool rawKeyboard = settings.value(QSTR_RAWKEYBOARDMODE, false).toBool();
@@ -815,11 +985,25 @@ void VPiano::readConnectionSettings()
     bool inEnabled = settings.value(QSTR_INENABLED, true).toBool();
     bool thruEnabled = settings.value(QSTR_THRUENABLED, false).toBool();
     bool omniEnabled = settings.value(QSTR_OMNIENABLED, false).toBool();
-    if (m_midiDriver != QSTR_DRIVERNAMENET) {
+    m_thruFilter.statusMask = settings.value(QSTR_THRUSTATUSMASK, 0xff).toUInt();
+    m_thruFilter.channelMask = settings.value(QSTR_THRUCHANNELMASK, 0xffff).toUInt();
+    m_thruFilter.lowNote = settings.value(QSTR_THRULOWNOTE, 0).toUInt() & 0x7f;
+    m_thruFilter.highNote = settings.value(QSTR_THRUHIGHNOTE, 127).toUInt() & 0x7f;
+    if (!isNetworkDriver()) {
         in_port = settings.value(QSTR_INPORT).toString();
         out_port = settings.value(QSTR_OUTPORT).toString();
     }
+    m_mergePorts.clear();
+    m_mergeChannels.clear();
+    int size = settings.beginReadArray(QSTR_MERGEINPUTS);
+    for (int i = 0; i < size; ++i) {
+        settings.setArrayIndex(i);
+        m_mergePorts += settings.value(QSTR_MERGEPORT).toString();
+        m_mergeChannels += settings.value(QSTR_MERGECHANNEL, -1).toInt();
+    }
+    settings.endArray();
     settings.endGroup();
+    refreshMergeInputs();
     if ( m_midiDriver == QSTR_DRIVERNAMEALSA ||
          m_midiDriver == QSTR_DRIVERNAMEMACOSX ||
          m_midiDriver == QSTR_DRIVERNAMEJACK )
@@ -831,10 +1015,10 @@ void VPiano::readConnectionSettings()
         dlgMidiSetup()->setInputEnabled(inEnabled);
         dlgMidiSetup()->setThruEnabled(thruEnabled);
         dlgMidiSetup()->setOmniEnabled(omniEnabled);
-        if (m_midiDriver != QSTR_DRIVERNAMENET)
+        if (!isNetworkDriver())
             dlgMidiSetup()->setCurrentInput(in_port);
     }
-    if (m_midiDriver != QSTR_DRIVERNAMENET)
+    if (!isNetworkDriver())
         dlgMidiSetup()->setCurrentOutput(out_port);
 }
 
@@ -884,15 +1068,22 @@ void VPiano::writeSettings()
     settings.setValue(QSTR_VELOCITY, m_velocity);
     settings.setValue(QSTR_BASEOCTAVE, m_baseOctave);
     settings.setValue(QSTR_TRANSPOSE, m_transpose);
+    settings.setValue(QSTR_CLOCKTEMPO, m_tempo);
     settings.setValue(QSTR_LANGUAGE, m_language);
     settings.setValue(QSTR_NUMOCTAVES, dlgPreferences()->getNumOctaves());
-    settings.setValue(QSTR_INSTRUMENTSDEFINITION, dlgPreferences()->getInstrumentsFileName());
+    QStringList insFileNames = dlgPreferences()->getInstrumentsFileNames();
+    if (insFileNames.count() == 1)
+        settings.setValue(QSTR_INSTRUMENTSDEFINITION, insFileNames.first());
+    else
+        settings.setValue(QSTR_INSTRUMENTSDEFINITION, insFileNames);
     settings.setValue(QSTR_INSTRUMENTNAME, dlgPreferences()->getInstrumentName());
+    settings.setValue(QSTR_SOUNDFONTDIRS, m_soundFontDirs);
     settings.setValue(QSTR_GRABKB, dlgPreferences()->getGrabKeyboard());
     settings.setValue(QSTR_STYLEDKNOBS, dlgPreferences()->getStyledWidgets());
     settings.setValue(QSTR_ALWAYSONTOP, dlgPreferences()->getAlwaysOnTop());
     settings.setValue(QSTR_SHOWNOTENAMES, ui.actionNoteNames->isChecked());
     settings.setValue(QSTR_SHOWSTATUSBAR, ui.actionStatusBar->isChecked());
+    settings.setValue(QSTR_SHOWPIANOROLL, ui.actionPianoRoll->isChecked());
     settings.setValue(QSTR_DRUMSCHANNEL, dlgPreferences()->getDrumsChannel());
     settings.setValue(QSTR_VELOCITYCOLOR, dlgPreferences()->getVelocityColor());
     settings.setValue(QSTR_ENFORCECHANSTATE, dlgPreferences()->getEnforceChannelState());
@@ -903,6 +1094,10 @@ void VPiano::writeSettings()
 #if defined(NETWORK_MIDI)
     settings.setValue(QSTR_NETWORKPORT, dlgPreferences()->getNetworkPort());
     settings.setValue(QSTR_NETWORKIFACE, dlgPreferences()->getNetworkInterfaceName());
+    settings.setValue(QSTR_NETWORKPEERS, dlgPreferences()->getNetworkPeers());
+#endif
+#if defined(FLUIDSYNTH_SUPPORT)
+    settings.setValue(QSTR_SOUNDFONT, dlgPreferences()->getSoundFontFileName());
 #endif
     settings.setValue(QSTR_CURRENTPALETTE, m_currentPalette);
     settings.setValue(QSTR_SHOWCOLORSCALE, ui.actionColorScale->isChecked());
@@ -912,7 +1107,18 @@ void VPiano::writeSettings()
     settings.setValue(QSTR_INENABLED, dlgMidiSetup()->inputIsEnabled());
     settings.setValue(QSTR_THRUENABLED, dlgMidiSetup()->thruIsEnabled());
     settings.setValue(QSTR_OMNIENABLED, dlgMidiSetup()->omniIsEnabled());
-    if (m_midiDriver != QSTR_DRIVERNAMENET) {
+    settings.setValue(QSTR_THRUSTATUSMASK, m_thruFilter.statusMask);
+    settings.setValue(QSTR_THRUCHANNELMASK, m_thruFilter.channelMask);
+    settings.setValue(QSTR_THRULOWNOTE, m_thruFilter.lowNote);
+    settings.setValue(QSTR_THRUHIGHNOTE, m_thruFilter.highNote);
+    settings.beginWriteArray(QSTR_MERGEINPUTS);
+    for (int i = 0; i < m_mergePorts.count(); ++i) {
+        settings.setArrayIndex(i);
+        settings.setValue(QSTR_MERGEPORT, m_mergePorts[i]);
+        settings.setValue(QSTR_MERGECHANNEL, m_mergeChannels.value(i, -1));
+    }
+    settings.endArray();
+    if (!isNetworkDriver()) {
         settings.setValue(QSTR_INPORT,  dlgMidiSetup()->selectedInputName());
         settings.setValue(QSTR_OUTPORT, dlgMidiSetup()->selectedOutputName());
     }
@@ -985,20 +1191,18 @@ void VPiano::closeEvent( QCloseEvent *event )
     event->accept();
 }
 
-QColor VPiano::getColorFromPolicy(NoteOnEvent *ev)
+const QBrush& VPiano::getBrushFromPolicy(NoteOnEvent *ev, int vel)
 {
     PianoPalette *palette = dlgColorPolicy()->currentPalette();
     switch (palette->paletteId()) {
-    case PAL_SINGLE:
-        return palette->getColor(0);
     case PAL_DOUBLE:
-        return palette->getColor(ev->getType());
+        return palette->getBrush(ev->getType(), vel);
     case PAL_CHANNELS:
-        return palette->getColor(ev->getChannel());
+        return palette->getBrush(ev->getChannel(), vel);
     case PAL_SCALE:
-        return palette->getColor(ev->getDegree());
+        return palette->getBrush(ev->getDegree(), vel);
     }
-    return QColor();
+    return palette->getBrush(0, vel);
 }
 
 void VPiano::customEvent ( QEvent *event )
@@ -1007,9 +1211,9 @@ void VPiano::customEvent ( QEvent *event )
     if ( event->type() == NoteOnEventType ) {
         NoteOnEvent *ev = static_cast<NoteOnEvent*>(event);
         int n = ev->getNote();
-        QColor c = getColorFromPolicy(ev);
         int v = (dlgPreferences()->getVelocityColor() ? ev->getValue() : MIDIVELOCITY );
-        currentPianoScene()->showNoteOn(n, c, v);
+        currentPianoScene()->showNoteOn(n, getBrushFromPolicy(ev, v));
+        m_pianoRoll->noteOn(ev->getChannel(), n, ev->getValue(), PianoRoll::Input);
 #ifdef ENABLE_DBUS
         emit event_noteon(n);
 #endif
@@ -1018,6 +1222,7 @@ void VPiano::customEvent ( QEvent *event )
         NoteOffEvent *ev = static_cast<NoteOffEvent*>(event);
         int n = ev->getNote();
         currentPianoScene()->showNoteOff(n);
+        m_pianoRoll->noteOff(ev->getChannel(), n, PianoRoll::Input);
 #ifdef ENABLE_DBUS
         emit event_noteoff(n);
 #endif
@@ -1100,7 +1305,10 @@ void VPiano::hideEvent( QHideEvent *event )
 
 void VPiano::midiThru(std::vector<unsigned char> *message) const
 {
-    if (m_midiThru) {
+    if (m_midiThru && m_thruFilter.accepts(&message->at(0), message->size())) {
+        QMutexLocker locker(&m_outMutex);
+        if (m_sysexSender != 0 && m_sysexSender->defer(message))
+            return;
         try {
             m_midiout->sendMessage( message );
         } catch (RtError& err) {
@@ -1111,6 +1319,10 @@ void VPiano::midiThru(std::vector<unsigned char> *message) const
 
 void VPiano::sendMessageWrapper(std::vector<unsigned char> *message) const
 {
+    QMutexLocker locker(&m_outMutex);
+    // held back while a split SysEx message is open
+    if (m_sysexSender != 0 && m_sysexSender->defer(message))
+        return;
     try {
         m_midiout->sendMessage( message );
     } catch (RtError& err) {
@@ -1129,6 +1341,7 @@ void VPiano::sendNoteOn(const int midiNote, const int vel)
         message.push_back(midiNote & MASK_SAFETY);
         message.push_back(vel & MASK_SAFETY);
         sendMessageWrapper( &message );
+        m_pianoRoll->noteOn(chan, midiNote, vel, PianoRoll::Output);
     }
 }
 
@@ -1151,6 +1364,7 @@ void VPiano::sendNoteOff(const int midiNote, const int vel)
         message.push_back(midiNote & MASK_SAFETY);
         message.push_back(vel & MASK_SAFETY);
         sendMessageWrapper( &message );
+        m_pianoRoll->noteOff(chan, midiNote, PianoRoll::Output);
     }
 }
 
@@ -1218,6 +1432,7 @@ void VPiano::allNotesOff()
 {
     sendController(CTL_ALL_NOTES_OFF, 0);
     currentPianoScene()->allKeysOff();
+    m_pianoRoll->allNotesOff();
 }
 
 void VPiano::sendProgramChange(const int program)
@@ -1308,13 +1523,135 @@ void VPiano::slotResetBender()
     sendBender(0);
 }
 
-void VPiano::sendSysex(const QByteArray& data)
+void VPiano::sendSysexFile(const QString& fileName, int packetSize, int byteRate, int delay)
 {
-    std::vector<unsigned char> message;
-    foreach(const char byte, data) {
-        message.push_back(byte);
+    if (m_sysexSender->isRunning()) {
+        ui.statusBar->showMessage(tr("Still sending %1").arg(QFileInfo(m_sysexSender->fileName()).fileName()));
+        return;
     }
-    sendMessageWrapper( &message );
+    // only the ALSA sequencer accepts a System Exclusive message in pieces;
+    // the other drivers get whole messages, paced all the same
+    if (m_midiDriver != QSTR_DRIVERNAMEALSA)
+        packetSize = 0;
+    if (m_sysexSender->send(fileName, m_midiout, &m_outMutex, packetSize, byteRate, delay)) {
+        m_sysexProgress->setValue(0);
+        m_sysexProgress->setVisible(true);
+        m_sysexCancel->setVisible(true);
+        ui.statusBar->showMessage(tr("Sending %1").arg(QFileInfo(fileName).fileName()));
+    }
+}
+
+void VPiano::stopOutputThreads()
+{
+    if (m_sysexSender != 0 && m_sysexSender->isRunning()) {
+        m_sysexSender->cancel();
+        m_sysexSender->wait();
+    }
+    if (m_midiClock != 0 && m_midiClock->isPlaying()) {
+        m_midiClock->stop();
+        updateClockActions();
+    }
+}
+
+/*
+ * The input filter keeps the channel messages of the base channel, or of
+ * every channel in omni mode. With MIDI thru the driver must also let the
+ * traffic accepted by the thru filter pass, so the union of both is set
+ * into the driver, and midiCallback() checks the input filter again.
+ */
+void VPiano::updateInputFilter()
+{
+    if (m_midiin == 0)
+        return;
+    m_inputFilter = RtMidiIn::MidiFilter();
+    m_inputFilter.statusMask = 0x7f;
+    m_inputFilter.channelMask = m_midiOmni ? 0xffff : (1 << m_baseChannel);
+    RtMidiIn::MidiFilter driverFilter = m_inputFilter;
+    if (m_midiThru) {
+        driverFilter.statusMask |= m_thruFilter.statusMask;
+        driverFilter.channelMask |= m_thruFilter.channelMask;
+    }
+    try {
+        m_midiin->setFilter(driverFilter);
+        // mapped ports accept every channel, the input filter applies after mapping
+        for (int id = 0; id < m_merger->portCount(); ++id) {
+            RtMidiIn *input = m_merger->port(id);
+            if (input == m_midiin)
+                continue;
+            RtMidiIn::MidiFilter portFilter = driverFilter;
+            if (m_merger->channelMap(id) >= 0)
+                portFilter.channelMask = 0xffff;
+            input->setFilter(portFilter);
+        }
+    } catch (RtError& err) {
+        qWarning() << QString::fromStdString(err.getMessage());
+    }
+}
+
+void VPiano::slotTempoValueChanged(double value)
+{
+    m_tempo = value;
+    m_midiClock->setTempo(value);
+}
+
+void VPiano::slotClockStart()
+{
+    m_midiClock->setOutput(m_midiout, &m_outMutex);
+    m_midiClock->play();
+    updateClockActions();
+}
+
+void VPiano::slotClockContinue()
+{
+    m_midiClock->setOutput(m_midiout, &m_outMutex);
+    m_midiClock->cont();
+    updateClockActions();
+}
+
+void VPiano::slotClockStop()
+{
+    m_midiClock->stop();
+    updateClockActions();
+}
+
+void VPiano::slotClockJitter(double meanMs, double maxMs)
+{
+    if (!m_midiClock->isPlaying())
+        return;
+    m_lblJitter->setText(tr("Jitter: %1 ms").arg(meanMs, 0, 'f', 3));
+    m_lblJitter->setToolTip(tr("Clock lateness in the last second: mean %1 ms, maximum %2 ms")
+                            .arg(meanMs, 0, 'f', 3).arg(maxMs, 0, 'f', 3));
+#ifdef ENABLE_DBUS
+    emit event_clockjitter(meanMs, maxMs);
+#endif
+}
+
+void VPiano::updateClockActions()
+{
+    bool playing = m_midiClock->isPlaying();
+    ui.actionClockContinue->setEnabled(!playing);
+    ui.actionClockStop->setEnabled(playing);
+    if (!playing) {
+        m_lblJitter->clear();
+        m_lblJitter->setToolTip(QString());
+    }
+}
+
+void VPiano::slotSysexProgress(int percent)
+{
+    m_sysexProgress->setValue(percent);
+}
+
+void VPiano::slotSysexFinished()
+{
+    m_sysexProgress->setVisible(false);
+    m_sysexCancel->setVisible(false);
+    if (!m_sysexSender->errorString().isEmpty())
+        ui.statusBar->showMessage(m_sysexSender->errorString());
+    else if (m_sysexSender->isCancelled())
+        ui.statusBar->showMessage(tr("Cancelled"));
+    else
+        ui.statusBar->clearMessage();
 }
 
 void VPiano::slotControlClicked(const bool boolValue)
@@ -1330,8 +1667,10 @@ void VPiano::slotControlClicked(const bool boolValue)
             sendController( controller, value );
             updateController( controller, value );
         } else {
-            QVariant data = s->property(SYSEXFILEDATA);
-            sendSysex(data.toByteArray());
+            sendSysexFile( s->property(SYSEXFILENAME).toString(),
+                           s->property(SYSEXPACKETSIZE).toInt(),
+                           s->property(SYSEXBYTERATE).toInt(),
+                           s->property(SYSEXDELAY).toInt() );
         }
     }
 }
@@ -1392,37 +1731,61 @@ void VPiano::slotAboutQt()
     grabKb();
 }
 
-void VPiano::refreshConnections()
+/*
+ * Port enumeration may be slow with some drivers, so it doesn't touch the
+ * user interface and can run in another thread.
+ */
+VPiano::PortNames VPiano::enumeratePorts(RtMidiIn *midiin, RtMidiOut *midiout)
 {
-    int i = 0, nInPorts = 0, nOutPorts = 0;
+    StartupProfile::Task task("port enumeration");
+    PortNames ports;
     try {
-        dlgMidiSetup()->clearCombos();
-        // inputs
-        if (m_midiin == 0) {
-            dlgMidiSetup()->inputNotAvailable();
-            dlgMidiSetup()->setInputEnabled(false);
-        } else {
+        if (midiin != 0) {
+            unsigned int nInPorts = midiin->getPortCount();
+            for (unsigned int i = 0; i < nInPorts; ++i)
+                ports.inputs += QString::fromStdString(midiin->getPortName(i));
+        }
+        unsigned int nOutPorts = midiout->getPortCount();
+        for (unsigned int i = 0; i < nOutPorts; ++i)
+            ports.outputs += QString::fromStdString(midiout->getPortName(i));
+    } catch (RtError& err) {
+        ports.error = QString::fromStdString(err.getMessage());
+    }
+    return ports;
+}
+
+void VPiano::refreshConnections()
+{
+    refreshConnections(enumeratePorts(m_midiin, m_midiout));
+}
+
+void VPiano::refreshConnections(const PortNames& ports)
+{
+    int i = 0;
+    dlgMidiSetup()->clearCombos();
+    // inputs
+    if (m_midiin == 0) {
+        dlgMidiSetup()->inputNotAvailable();
+        dlgMidiSetup()->setInputEnabled(false);
+    } else {
 #if !defined(__LINUX_ALSASEQ__) && !defined(__MACOSX_CORE__)
-            dlgMidiSetup()->setInputEnabled(m_currentIn != -1);
+        dlgMidiSetup()->setInputEnabled(m_currentIn != -1);
 #endif
-            dlgMidiSetup()->addInputPortName(QString::null, -1);
-            nInPorts = m_midiin->getPortCount();
-            for ( i = 0; i < nInPorts; i++ ) {
-                QString name = QString::fromStdString(m_midiin->getPortName(i));
-                if (!name.startsWith(QSTR_VMPK))
-                    dlgMidiSetup()->addInputPortName(name, i);
-            }
+        dlgMidiSetup()->addInputPortName(QString::null, -1);
+        for ( i = 0; i < ports.inputs.count(); i++ ) {
+            if (!ports.inputs[i].startsWith(QSTR_VMPK))
+                dlgMidiSetup()->addInputPortName(ports.inputs[i], i);
         }
-        // outputs
-        nOutPorts = m_midiout->getPortCount();
-        for ( i = 0; i < nOutPorts; i++ ) {
-            QString name = QString::fromStdString(m_midiout->getPortName(i));
-            if (!name.startsWith(QSTR_VMPK))
-                dlgMidiSetup()->addOutputPortName(name, i);
-        }
-    } catch (RtError& err) {
-        ui.statusBar->showMessage(QString::fromStdString(err.getMessage()));
     }
+    // outputs
+    for ( i = 0; i < ports.outputs.count(); i++ ) {
+        if (!ports.outputs[i].startsWith(QSTR_VMPK))
+            dlgMidiSetup()->addOutputPortName(ports.outputs[i], i);
+    }
+    if (!ports.error.isEmpty())
+        ui.statusBar->showMessage(ports.error);
+    m_inputPorts = ports.inputs;
+    refreshMergeInputs();
 }
 
 void VPiano::slotConnections()
@@ -1445,11 +1808,13 @@ void VPiano::applyConnections()
         nOutPorts = m_midiout->getPortCount();
         i = dlgMidiSetup()->selectedOutput();
         if ((i >= 0) && (i < nOutPorts) && (i != m_currentOut)) {
+            stopOutputThreads();
             m_midiout->closePort();
             m_midiout->openPort(i);
         }
         m_currentOut = i;
         if (m_midiin != 0) {
+            closeMergeInputs();
             nInPorts = m_midiin->getPortCount();
             i = dlgMidiSetup()->selectedInput();
             if (m_inputActive && (i != m_currentIn)) {
@@ -1467,12 +1832,108 @@ void VPiano::applyConnections()
             m_currentIn = i;
             m_midiThru = dlgMidiSetup()->thruIsEnabled();
             m_midiOmni = dlgMidiSetup()->omniIsEnabled();
+            m_mergePorts = dlgMidiSetup()->mergeInputNames();
+            m_mergeChannels = dlgMidiSetup()->mergeInputChannels();
+            openMergeInputs();
+            updateInputFilter();
         }
     } catch (RtError& err) {
         ui.statusBar->showMessage(QString::fromStdString(err.getMessage()));
     }
 }
 
+/*
+ * The merged input ports are opened with their own driver instances.
+ * Messages of all the ports, the input connection included, go through
+ * the merger, which delivers them to midiCallback() in arrival order.
+ */
+void VPiano::openMergeInputs()
+{
+    closeMergeInputs();
+    if (m_midiin == 0 || isNetworkDriver() || m_mergePorts.isEmpty() ||
+        !dlgMidiSetup()->inputIsEnabled())
+        return;
+    QString current = m_inputActive ? dlgMidiSetup()->selectedInputName() : QString();
+    try {
+        for (int i = 0; i < m_mergePorts.count(); ++i) {
+            const QString& name = m_mergePorts[i];
+            if (name == current)
+                continue;
+            QString clientName = QSTR_VMPKINPUT + QString::number(m_mergeIns.count() + 2);
+            RtMidiIn *input = MIDIInDriverFactory(m_midiDriver, clientName);
+            m_mergeIns.append(input);
+            int port, nInPorts = input->getPortCount();
+            for (port = 0; port < nInPorts; ++port) {
+                if (QString::fromStdString(input->getPortName(port)) == name)
+                    break;
+            }
+            if (port == nInPorts)
+                continue;
+            input->openPort(port, clientName.toStdString());
+            input->ignoreTypes(true,true,true);
+            m_mergeIds[name] = m_merger->addPort(input, m_mergeChannels.value(i, -1));
+        }
+    } catch (RtError& err) {
+        ui.statusBar->showMessage(QString::fromStdString(err.getMessage()));
+    }
+    if (m_merger->portCount() == 0)
+        return;
+    if (m_inputActive) {
+        m_midiin->cancelCallback();
+        m_merger->addPort(m_midiin);
+    }
+    m_merger->setCallback(&mergedMidiCallback, this);
+    m_merger->startMerging();
+}
+
+void VPiano::closeMergeInputs()
+{
+    if (m_merger == 0)
+        return;
+    bool merging = m_merger->portCount() > 0;
+    m_merger->stopMerging();
+    // deleting a driver instance stops its input thread
+    foreach(RtMidiIn *input, m_mergeIns) {
+        try {
+            input->closePort();
+        } catch (RtError& err) {
+            qWarning() << QString::fromStdString(err.getMessage());
+        }
+        delete input;
+    }
+    m_mergeIns.clear();
+    m_mergeIds.clear();
+    if (merging && m_inputActive) {
+        try {
+            m_midiin->cancelCallback();
+            m_midiin->setCallback( &midiCallback, this );
+        } catch (RtError& err) {
+            qWarning() << QString::fromStdString(err.getMessage());
+        }
+    }
+    m_merger->removePorts();
+}
+
+void VPiano::refreshMergeInputs()
+{
+    dlgMidiSetup()->clearMergeInputs();
+    if (m_midiin == 0 || isNetworkDriver())
+        return;
+    foreach(const QString& name, m_inputPorts) {
+        if (name.startsWith(QSTR_VMPK))
+            continue;
+        int idx = m_mergePorts.indexOf(name);
+        QString statistics;
+        if (m_mergeIds.contains(name)) {
+            MidiMerger::PortStatistics stats = m_merger->statistics(m_mergeIds[name]);
+            statistics = tr("%1 received, %2 dropped, %3 ms")
+                         .arg(stats.received).arg(stats.dropped)
+                         .arg(stats.maxDelay, 0, 'f', 1);
+        }
+        dlgMidiSetup()->addMergeInput(name, idx >= 0, m_mergeChannels.value(idx, -1), statistics);
+    }
+}
+
 void VPiano::initControllers(int channel)
 {
     if (m_ins != 0) {
@@ -1535,6 +1996,10 @@ void VPiano::applyPreferences()
     int udpPort = dlgPreferences()->getNetworkPort();
     NetworkSettings::instance().setPort(udpPort);
     NetworkSettings::instance().setIface(dlgPreferences()->getNetworkInterface());
+    NetworkSettings::instance().setPeers(dlgPreferences()->getNetworkPeers());
+#endif
+#if defined(FLUIDSYNTH_SUPPORT)
+    SynthMidiOut::setSoundFont(dlgPreferences()->getSoundFontFileName().toStdString());
 #endif
 
     KeyboardMap* map = dlgPreferences()->getKeyboardMap();
@@ -1575,27 +2040,83 @@ void VPiano::populateInstruments()
 {
     m_ins = 0;
     m_comboBank->clear();
-    m_comboProg->clear();
-    if (!dlgPreferences()->getInstrumentsFileName().isEmpty() &&
-         dlgPreferences()->getInstrumentsFileName() != QSTR_DEFAULT) {
-        if (m_baseChannel == dlgPreferences()->getDrumsChannel())
-            m_ins = dlgPreferences()->getDrumsInstrument();
-        else
-            m_ins = dlgPreferences()->getInstrument();
-        if (m_ins != 0) {
-            //qDebug() << "Instrument Name:" << m_ins->instrumentName();
-            //qDebug() << "Bank Selection method: " << m_ins->bankSelMethod();
-            InstrumentPatches patches = m_ins->patches();
-            InstrumentPatches::ConstIterator j;
-            for( j = patches.constBegin(); j != patches.constEnd(); ++j ) {
-                //if (j.key() < 0) continue;
-                InstrumentData patch = j.value();
-                m_comboBank->addItem(patch.name(), j.key());
-                //qDebug() << "---- Bank[" << j.key() << "]=" << patch.name();
-            }
-            updateBankChange(m_lastBank[m_baseChannel]);
+    m_progModel->setPatch(InstrumentData());
+    // from the definition files or the SoundFont catalogue
+    if (m_baseChannel == dlgPreferences()->getDrumsChannel())
+        m_ins = dlgPreferences()->getDrumsInstrument();
+    else
+        m_ins = dlgPreferences()->getInstrument();
+    if (m_ins != 0) {
+        //qDebug() << "Instrument Name:" << m_ins->instrumentName();
+        //qDebug() << "Bank Selection method: " << m_ins->bankSelMethod();
+        InstrumentPatches patches = m_ins->patches();
+        InstrumentPatches::ConstIterator j;
+        for( j = patches.constBegin(); j != patches.constEnd(); ++j ) {
+            //if (j.key() < 0) continue;
+            InstrumentData patch = j.value();
+            m_comboBank->addItem(patch.name(), j.key());
+            //qDebug() << "---- Bank[" << j.key() << "]=" << patch.name();
         }
+        updateBankChange(m_lastBank[m_baseChannel]);
+    }
+}
+
+void VPiano::slotInstrumentsProgress(int done, int total)
+{
+    ui.statusBar->showMessage(tr("Loading instruments... %1/%2").arg(done).arg(total));
+}
+
+void VPiano::slotInstrumentsLoaded()
+{
+    StartupProfile::milestone("instruments loaded");
+    ui.statusBar->clearMessage();
+    m_patchIndex.build(dlgPreferences()->getInstruments());
+    // the SoundFont catalogue may be read before the tool bars exist;
+    // applyPreferences() fills them later
+    if (m_comboBank == 0) {
+        m_ins = 0;
+        return;
+    }
+    populateInstruments();
+    populateControllers();
+    int idx = m_comboControl->findData(m_lastCtl[m_baseChannel]);
+    if (idx != -1)
+        m_comboControl->setCurrentIndex(idx);
+    idx = m_comboProg->findData(m_lastProg[m_baseChannel]);
+    m_comboProg->setCurrentIndex(idx);
+}
+
+void VPiano::slotFindProgram()
+{
+    if (m_patchFinder == 0) {
+        m_patchFinder = new PatchFinder(this);
+        m_patchFinder->setIndex(&m_patchIndex);
+        connect(m_patchFinder, SIGNAL(patchSelected(QString,int,int)),
+                SLOT(slotPatchSelected(QString,int,int)));
+        connect(m_patchFinder, SIGNAL(closed()), SLOT(slotFindProgramClosed()));
     }
+    releaseKb();
+    m_patchFinder->popup(m_comboProg->mapToGlobal(QPoint(0, m_comboProg->height())));
+}
+
+void VPiano::slotFindProgramClosed()
+{
+    grabKb();
+}
+
+void VPiano::slotPatchSelected(const QString& instrument, int bank, int program)
+{
+    if (m_ins == 0 || m_ins->instrumentName() != instrument) {
+        QString name = instrument;
+        if (name.endsWith(QLatin1String(" Drums"), Qt::CaseInsensitive))
+            name.chop(6);
+        dlgPreferences()->setInstrumentName(name);
+        populateInstruments();
+        populateControllers();
+    }
+    updateBankChange(bank);
+    updateProgramChange(program);
+    slotComboProgActivated(m_comboProg->currentIndex());
 }
 
 void VPiano::applyInitialSettings()
@@ -1628,6 +2149,10 @@ void VPiano::slotPreferences()
 #if defined(NETWORK_MIDI)
     int old_udpPort = NetworkSettings::instance().port();
     QString old_iface = NetworkSettings::instance().iface().name();
+    QStringList old_peers = NetworkSettings::instance().peers();
+#endif
+#if defined(FLUIDSYNTH_SUPPORT)
+    QString old_soundFont = dlgPreferences()->getSoundFontFileName();
 #endif
     QString old_driver = dlgPreferences()->getDriver();
     releaseKb();
@@ -1638,9 +2163,34 @@ void VPiano::slotPreferences()
         }
 #if defined(NETWORK_MIDI)
         if (old_udpPort != NetworkSettings::instance().port() ||
-            old_iface != NetworkSettings::instance().iface().name() ) {
+            old_iface != NetworkSettings::instance().iface().name() ||
+            old_peers != NetworkSettings::instance().peers() ) {
+            // reopen the network ports, so the new addresses are used
+            if (isNetworkDriver()) {
+                closeMergeInputs();
+                if (m_midiin != 0 && m_inputActive) {
+                    m_midiin->cancelCallback();
+                    m_midiin->closePort();
+                    m_inputActive = false;
+                }
+                stopOutputThreads();
+                m_midiout->closePort();
+                m_currentIn = m_currentOut = -1;
+            }
             applyConnections();
         }
+#endif
+#if defined(FLUIDSYNTH_SUPPORT)
+        if (old_soundFont != dlgPreferences()->getSoundFontFileName() &&
+            old_driver == dlgPreferences()->getDriver() &&
+            m_midiDriver == QSTR_DRIVERNAMESYNTH) {
+            // a new synthesizer is created with the new SoundFont
+            stopOutputThreads();
+            m_midiout->closePort();
+            m_currentOut = -1;
+            applyConnections();
+            enforceMIDIChannelState();
+        }
 #endif
     }
     grabKb();
@@ -1694,14 +2244,10 @@ void VPiano::populatePrograms(int bank)
 {
     if (bank < 0)
         return;
-    m_comboProg->clear();
-    if (m_ins != 0) {
-        InstrumentData patch = m_ins->patch(bank);
-        InstrumentData::ConstIterator k;
-        for( k = patch.constBegin(); k != patch.constEnd(); ++k )
-            m_comboProg->addItem(k.value(), k.key());
-            //qDebug() << "patch[" << k.key() << "]=" << k.value();
-    }
+    if (m_ins != 0)
+        m_progModel->setPatch(m_ins->patch(bank));
+    else
+        m_progModel->setPatch(InstrumentData());
 }
 
 void VPiano::slotComboBankActivated(const int index)
@@ -1777,6 +2323,7 @@ void VPiano::slotChannelValueChanged(const int channel)
         bool updDrums = ((c == drms) || (m_baseChannel == drms));
         m_baseChannel = c;
         ui.pianokeybd->getPianoScene()->setChannel(c);
+        updateInputFilter();
         if (updDrums) {
             populateInstruments();
             populateControllers();
@@ -1975,6 +2522,34 @@ void VPiano::slotImportSF()
     grabKb();
 }
 
+// The folder is remembered and rescanned in the background at startup;
+// only new or modified files are read again.
+void VPiano::slotScanSoundFonts()
+{
+    releaseKb();
+    QString dir = QFileDialog::getExistingDirectory(this,
+                        tr("Scan SoundFont Folder"), m_soundFontDirs.value(0));
+    if (!dir.isEmpty()) {
+        if (!m_soundFontDirs.contains(dir))
+            m_soundFontDirs.append(dir);
+        m_catalogue->scan(m_soundFontDirs);
+    }
+    grabKb();
+}
+
+void VPiano::slotCatalogueProgress(int done, int total)
+{
+    ui.statusBar->showMessage(tr("Scanning SoundFonts... %1/%2").arg(done).arg(total));
+}
+
+void VPiano::slotCatalogueFinished()
+{
+    ui.statusBar->clearMessage();
+    InstrumentList sfInstruments;
+    m_catalogue->buildInstruments(sfInstruments);
+    dlgPreferences()->setExtraInstruments(sfInstruments);
+}
+
 void VPiano::slotEditExtraControls()
 {
     dlgExtra()->setControls(m_extraControls);
@@ -2000,6 +2575,10 @@ Preferences* VPiano::dlgPreferences()
     if (m_dlgPreferences == 0) {
         m_dlgPreferences = new Preferences(this);
         m_dlgPreferences->setColorPolicyDialog(dlgColorPolicy());
+        connect(m_dlgPreferences, SIGNAL(instrumentsProgress(int,int)),
+                SLOT(slotInstrumentsProgress(int,int)));
+        connect(m_dlgPreferences, SIGNAL(instrumentsLoaded()),
+                SLOT(slotInstrumentsLoaded()));
     }
     return m_dlgPreferences;
 }
@@ -2099,6 +2678,26 @@ void VPiano::velocity(int value)
     m_Velocity->setValue(value);
 }
 
+void VPiano::tempo(double value)
+{
+    m_sboxTempo->setValue(value);
+}
+
+void VPiano::clock_start()
+{
+    slotClockStart();
+}
+
+void VPiano::clock_continue()
+{
+    slotClockContinue();
+}
+
+void VPiano::clock_stop()
+{
+    slotClockStop();
+}
+
 void VPiano::connect_in(const QString &value)
 {
     if( m_midiin != 0) {
@@ -2295,12 +2894,9 @@ void VPiano::slotSwitchLanguage(QAction *action)
     }
 }
 
-void VPiano::createLanguageMenu()
+QStringList VPiano::availableLocales()
 {
-    QString currentLang = configuredLanguage();
-    QActionGroup *languageGroup = new QActionGroup(this);
-    connect(languageGroup, SIGNAL(triggered(QAction *)),
-            SLOT(slotSwitchLanguage(QAction *)));
+    StartupProfile::Task task("locales scan");
     QDir dir(VPiano::localeDirectory());
     QStringList fileNames = dir.entryList(QStringList(QSTR_VMPKPX + "*.qm"));
     QStringList locales;
@@ -2312,7 +2908,16 @@ void VPiano::createLanguageMenu()
         locales << locale;
     }
     locales.sort();
-    foreach (const QString& loc, locales) {
+    return locales;
+}
+
+void VPiano::createLanguageMenu()
+{
+    QString currentLang = configuredLanguage();
+    QActionGroup *languageGroup = new QActionGroup(this);
+    connect(languageGroup, SIGNAL(triggered(QAction *)),
+            SLOT(slotSwitchLanguage(QAction *)));
+    foreach (const QString& loc, m_locales.result()) {
         QAction *action = new QAction(m_supportedLangs.value(loc), this);
         action->setCheckable(true);
         action->setData(loc);
@@ -2418,6 +3023,7 @@ void VPiano::retranslateToolbars()
         tr("Velocity:")
 #endif
     );
+    m_lblTempo->setText(tr("Tempo:"));
     m_lblBank->setText(tr("Bank:"));
     m_lblBender->setText(tr("Bender:"));
     m_lblControl->setText(tr("Control:"));
@@ -21,18 +21,29 @@
 
 #include "ui_vpiano.h"
 #include "pianoscene.h"
+#include "patchindex.h"
+#include "RtMidi.h"
 #include <QMainWindow>
+#include <QMutex>
+#include <QFuture>
 
 class QTranslator;
 class QLabel;
 class QComboBox;
+class QDoubleSpinBox;
 class QSpinBox;
 class QSlider;
 class QStyle;
+class QProgressBar;
+class QToolButton;
 class Knob;
 class Instrument;
-class RtMidiIn;
-class RtMidiOut;
+class PatchFinder;
+class RiffCatalogue;
+class PianoRoll;
+class SysexSender;
+class MidiClock;
+class MidiMerger;
 class About;
 class Preferences;
 class MidiSetup;
@@ -51,6 +62,7 @@ public:
     virtual ~VPiano();
     unsigned char baseChannel() const { return m_baseChannel; }
     bool omniMode() const { return m_midiOmni; }
+    const RtMidiIn::MidiFilter& inputFilter() const { return m_inputFilter; }
     void midiThru(std::vector<unsigned char> *message) const;
     bool isInitialized() const { return m_initialized; }
     void retranslateUi();
@@ -89,6 +101,11 @@ public Q_SLOTS:
     void chankeypress(int value);
     void pitchwheel(int value);
 
+    void tempo(double value);
+    void clock_start();
+    void clock_continue();
+    void clock_stop();
+
 Q_SIGNALS:
     void event_noteoff(int note);
     void event_noteon(int note);
@@ -97,6 +114,7 @@ Q_SIGNALS:
     void event_programchange(int value);
     void event_chankeypress(int value);
     void event_pitchwheel(int value);
+    void event_clockjitter(double mean, double max);
 
 #endif /*ENABLE_DBUS*/
 
@@ -113,6 +131,7 @@ protected Q_SLOTS:
     void slotHelpContents();
     void slotOpenWebSite();
     void slotImportSF();
+    void slotScanSoundFonts();
     void slotEditExtraControls();
     void slotShowNoteNames();
     void slotControlSliderMoved(const int value);
@@ -144,6 +163,21 @@ protected Q_SLOTS:
     void slotTouchScreenInput(bool value);
     void slotColorPolicy();
     void slotColorScale(bool value);
+    void slotInstrumentsProgress(int done, int total);
+    void slotInstrumentsLoaded();
+    void slotDeferredInitialization();
+    void slotFindProgram();
+    void slotFindProgramClosed();
+    void slotPatchSelected(const QString& instrument, int bank, int program);
+    void slotCatalogueProgress(int done, int total);
+    void slotCatalogueFinished();
+    void slotSysexProgress(int percent);
+    void slotSysexFinished();
+    void slotTempoValueChanged(double value);
+    void slotClockStart();
+    void slotClockContinue();
+    void slotClockStop();
+    void slotClockJitter(double meanMs, double maxMs);
     //void slotEditPrograms();
     //void slotDebugDestroyed(QObject *obj);
 
@@ -157,6 +191,7 @@ private:
     void initialization();
     bool initMidi();
     void switchMIDIDriver();
+    bool isNetworkDriver() const;
     void readSettings();
     void readConnectionSettings();
     void readMidiControllerSettings();
@@ -167,7 +202,18 @@ private:
     void populateControllers();
     void populateInstruments();
     void populatePrograms(int bank = -1);
+    struct PortNames {
+        QStringList inputs;
+        QStringList outputs;
+        QString error;
+    };
+    static PortNames enumeratePorts(RtMidiIn *midiin, RtMidiOut *midiout);
+    static QStringList availableLocales();
     void refreshConnections();
+    void refreshConnections(const PortNames& ports);
+    void refreshMergeInputs();
+    void openMergeInputs();
+    void closeMergeInputs();
     void initToolBars();
     void clearExtraControllers();
     void initExtraControllers();
@@ -183,7 +229,10 @@ private:
     void sendBender(const int value);
     void sendPolyKeyPress(const int note, const int value);
     void sendChanKeyPress(const int value);
-    void sendSysex(const QByteArray& data);
+    void sendSysexFile(const QString& fileName, int packetSize, int byteRate, int delay);
+    void stopOutputThreads();
+    void updateInputFilter();
+    void updateClockActions();
     void sendMessageWrapper(std::vector<unsigned char> *message) const;
     void updateController(int ctl, int val);
     void updateExtraController(int ctl, int val);
@@ -194,11 +243,10 @@ private:
     void updateStyles();
     void updateNoteNames(bool drums);
     void setWidgetTip(QWidget* w, int val);
-    QByteArray readSysexDataFile(const QString& fileName);
     void createLanguageMenu();
     QString configuredLanguage();
     void enforceMIDIChannelState();
-    QColor getColorFromPolicy(NoteOnEvent *ev);
+    const QBrush& getBrushFromPolicy(NoteOnEvent *ev, int vel);
     PianoScene *currentPianoScene();
 
     About *dlgAbout();
@@ -219,6 +267,8 @@ private:
     bool m_inputActive;
     bool m_midiThru;
     bool m_midiOmni;
+    RtMidiIn::MidiFilter m_inputFilter;
+    RtMidiIn::MidiFilter m_thruFilter;
     bool m_initialized;
 
     About *m_dlgAbout;
@@ -240,15 +290,35 @@ private:
     QLabel* m_lblTranspose;
     QLabel* m_lblValue;
     QLabel* m_lblVelocity;
+    QLabel* m_lblTempo;
+    QLabel* m_lblJitter;
     QSpinBox* m_sboxChannel;
     QSpinBox* m_sboxOctave;
     QSpinBox* m_sboxTranspose;
     Knob* m_Velocity;
+    QDoubleSpinBox* m_sboxTempo;
     QComboBox* m_comboControl;
     Knob* m_Control;
     QSlider* m_bender;
     QComboBox* m_comboBank;
     QComboBox* m_comboProg;
+    ProgramListModel* m_progModel;
+    PatchIndex m_patchIndex;
+    PatchFinder* m_patchFinder;
+    RiffCatalogue* m_catalogue;
+    PianoRoll* m_pianoRoll;
+    SysexSender* m_sysexSender;
+    QProgressBar* m_sysexProgress;
+    QToolButton* m_sysexCancel;
+    MidiClock* m_midiClock;
+    MidiMerger* m_merger;
+    QList<RtMidiIn*> m_mergeIns;
+    QMap<QString,int> m_mergeIds;
+    QStringList m_mergePorts;
+    QList<int> m_mergeChannels;
+    QStringList m_inputPorts;
+    mutable QMutex m_outMutex;
+    QStringList m_soundFontDirs;
     QStyle* m_dialStyle;
     Instrument* m_ins;
     QStringList m_extraControls;
@@ -260,9 +330,11 @@ private:
     int m_velocity;
     int m_baseOctave;
     int m_transpose;
+    double m_tempo;
     QString m_language;
     QMap<QString, QString> m_supportedLangs;
     QTranslator *m_trq, *m_trp;
+    QFuture<QStringList> m_locales;
     QAction *m_currentLang;
     QString m_midiDriver;
     QHash<QString,QList<QKeySequence> > m_defaultShortcuts;
@@ -31,7 +31,7 @@ contains(QT_VERSION, ^4\\.[0-7]\\..*) {
     error("Use Qt 4.8 or newer")
 }
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 DEFINES += VERSION=$$VERSION
 
@@ -81,13 +81,19 @@ linux*:!simulator {
     DEFINES += RAWKBD_SUPPORT
     CONFIG += link_pkgconfig x11
     PKGCONFIG += alsa
-    LIBS += -lpthread
+    LIBS += -lpthread -lrt
     jack_midi {
         PKGCONFIG += jack
         DEFINES += __LINUX_JACK__
     }
 }
 
+fluidsynth {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += fluidsynth
+    DEFINES += FLUIDSYNTH_SUPPORT
+}
+
 macx {
     CONFIG += x86 \
         ppc
@@ -160,23 +166,34 @@ HEADERS += src/about.h \
     src/events.h \
     src/extracontrols.h \
     src/instrument.h \
+    src/instrumentloader.h \
     src/keyboardmap.h \
     src/keylabel.h \
     src/knob.h \
+    src/midiclock.h \
+    src/midimerger.h \
     src/mididefs.h \
     src/midisetup.h \
     src/netsettings.h \
+    src/patchfinder.h \
+    src/patchindex.h \
     src/pianodefs.h \
     src/pianokeybd.h \
     src/pianokey.h \
     src/pianopalette.h \
+    src/pianoroll.h \
     src/pianoscene.h \
     src/preferences.h \
     src/rawkeybdapp.h \
     src/riff.h \
+    src/riffcatalogue.h \
     src/riffimportdlg.h \
     src/RtError.h \
     src/RtMidi.h \
+    src/rtpmidi.h \
+    src/startupprofile.h \
+    src/synthmidi.h \
+    src/sysexsender.h \
     src/udpmidi.h \
     src/vpiano.h
 
@@ -186,19 +203,31 @@ SOURCES += src/about.cpp \
     src/colorwidget.cpp \
     src/extracontrols.cpp \
     src/instrument.cpp \
+    src/instrumentloader.cpp \
     src/keyboardmap.cpp \
     src/keylabel.cpp \
     src/knob.cpp \
     src/main.cpp \
+    src/midiclock.cpp \
+    src/midimerger.cpp \
     src/midisetup.cpp \
+    src/netsettings.cpp \
+    src/patchfinder.cpp \
+    src/patchindex.cpp \
     src/pianokeybd.cpp \
     src/pianokey.cpp \
     src/pianopalette.cpp \
+    src/pianoroll.cpp \
     src/pianoscene.cpp \
     src/preferences.cpp \
     src/riff.cpp \
+    src/riffcatalogue.cpp \
     src/riffimportdlg.cpp \
     src/RtMidi.cpp \
+    src/rtpmidi.cpp \
+    src/startupprofile.cpp \
+    src/synthmidi.cpp \
+    src/sysexsender.cpp \
     src/udpmidi.cpp \
     src/vpiano.cpp
 